@@ -15,13 +15,157 @@
 // See the Apache 2 License for the specific language governing permissions and
 // limitations under the License.
 
+#include <sys/time.h>
+#include <malloc.h>
+#include <fnmatch.h>
+#include <algorithm>
+#include <climits>
+#include <cstdio>
+#include <set>
+
 #include "base/kaldi-common.h"
 #include "util/common-utils.h"
 #include "tree/context-dep.h"
 #include "hmm/transition-model.h"
 #include "fstext/fstext-lib.h"
 #include "decoder/training-graph-compiler-vis.h"
+#include "decoder/training-graph-cache.h"
+#include "decoder/mapped-graph-archive.h"
+#include "decoder/transcript-index.h"
+#include "decoder/compile-work-queue.h"
+#include "decoder/vis-model-cache.h"
+#include "util/sharded-table-writer.h"
+#include "util/trace-events.h"
+
+namespace kaldi {
+
+/// Reads either all the transcripts of an rspecifier, in order, only those
+/// of the selected keys, through a TranscriptIndex, or the chunks taken from
+/// a CompileWorkQueue
+class TranscriptSource {
+ public:
+  explicit TranscriptSource(const std::string &rspecifier):
+      reader_(new SequentialInt32VectorReader(rspecifier)), index_(NULL),
+      queue_(NULL), pos_(0), end_(0) {}
+
+  TranscriptSource(TranscriptIndex *index,
+                   const std::vector<std::string> &keys):
+      reader_(NULL), index_(index), queue_(NULL), keys_(keys), pos_(0),
+      end_(keys.size()) {
+    Load();
+  }
+
+  explicit TranscriptSource(CompileWorkQueue *queue):
+      reader_(NULL), index_(NULL), queue_(queue), pos_(0), end_(0) {
+    Load();
+  }
+
+  ~TranscriptSource() { delete reader_; }
+
+  bool Done() const {
+    return reader_ != NULL ? reader_->Done() : pos_ >= end_;
+  }
+
+  std::string Key() const {
+    if (reader_ != NULL) return reader_->Key();
+    return queue_ != NULL ? queue_->Key(pos_) : keys_[pos_];
+  }
+
+  const std::vector<int32> &Value() const {
+    return reader_ != NULL ? reader_->Value() : transcript_;
+  }
+
+  void Next() {
+    if (reader_ != NULL) {
+      reader_->Next();
+    } else {
+      pos_++;
+      Load();
+    }
+  }
+
+ private:
+  void Load() {
+    if (queue_ != NULL) {
+      if (pos_ >= end_ && !queue_->Take(&pos_, &end_))
+        return;  // the queue is empty, and pos_ >= end_
+      queue_->Transcript(pos_, &transcript_);
+    } else if (pos_ < end_ && !index_->Read(keys_[pos_], &transcript_)) {
+      KALDI_ERR << "No transcript for " << keys_[pos_];
+    }
+  }
+
+  SequentialInt32VectorReader *reader_;
+  TranscriptIndex *index_;
+  CompileWorkQueue *queue_;
+  std::vector<std::string> keys_;
+  int64 pos_, end_;
+  std::vector<int32> transcript_;
+
+  KALDI_DISALLOW_COPY_AND_ASSIGN(TranscriptSource);
+};
+
+/// Selects the keys of the index that are listed in "keys" or match the
+/// shell wildcard "pattern", in the order of the archive
+void SelectTranscriptKeys(const TranscriptIndex &index,
+                          const std::vector<std::string> &keys,
+                          const std::string &pattern,
+                          std::vector<std::string> *selected) {
+  std::set<std::string> listed(keys.begin(), keys.end());
+  for (std::set<std::string>::const_iterator it = listed.begin();
+       it != listed.end(); ++it)
+    if (!index.HasKey(*it))
+      KALDI_WARN << "No transcript for " << *it;
+  selected->clear();
+  for (size_t i = 0; i < index.NumKeys(); i++) {
+    const std::string &key = index.Key(i);
+    if (listed.count(key) != 0 ||
+        (pattern != "" && fnmatch(pattern.c_str(), key.c_str(), 0) == 0))
+      selected->push_back(key);
+  }
+}
 
+/// The wspecifier of a worker's output: "%d" is replaced by the worker's
+/// index(1..n). Outputs that are discarded(/dev/null) need no "%d".
+std::string WorkerWspecifier(const std::string &wspec, int32 worker) {
+  const std::string null = "/dev/null";
+  if (wspec.find("%d") == std::string::npos && wspec.size() >= null.size() &&
+      wspec.compare(wspec.size() - null.size(), null.size(), null) == 0)
+    return wspec;
+  return ShardWspecifier(wspec, worker);
+}
+
+/// The name of a worker's archive or trace: "<filename>.<worker>"
+std::string WorkerFilename(const std::string &filename, int32 worker) {
+  std::ostringstream name;
+  name << filename << '.' << worker;
+  return name.str();
+}
+
+/// Copies the graphs of the workers' archives into "filename"(or merges them
+/// into it) and removes the workers' archives
+void MergeWorkerArchives(const std::string &filename, int32 num_workers,
+                         bool merge) {
+  GraphArchiveWriter writer;
+  if (merge)
+    writer.OpenForMerge(filename);
+  else
+    writer.Open(filename);
+  for (int32 w = 1; w <= num_workers; w++) {
+    GraphArchiveReader reader;
+    reader.Open(WorkerFilename(filename, w));
+    MappedGraphFst graph;
+    for (int64 i = 0; i < reader.NumGraphs(); i++) {
+      reader.Graph(i, &graph);
+      writer.Write(reader.Key(i), graph);
+    }
+  }
+  writer.Close();
+  for (int32 w = 1; w <= num_workers; w++)
+    std::remove(WorkerFilename(filename, w).c_str());
+}
+
+}  // end namespace kaldi
 
 // This is a trivial modification of compile-train-graphs, to visualize the intermediate
 // cascades(stages) that are needed to produce the final training graph
@@ -39,7 +183,13 @@ int main(int argc, char *argv[]) {
         "Usage:   compile-train-graphs [options] tree-in model-in lex-fst-in transcript-rspec transit-wspec "
         "lg-wspec clg-wspec hclg-noloop-wspec\n"
         "e.g.: \n"
-        " compile-train-graphs tree 1.mdl lex.fst ark:train.tra ark:graphs.fsts ...\n";
+        " compile-train-graphs tree 1.mdl lex.fst ark:train.tra ark:graphs.fsts ...\n"
+        " compile-train-graphs --num-shards=4 tree 1.mdl lex.fst ark:train.tra "
+        "ark:graphs.%d.fsts ...\n"
+        " compile-train-graphs --keys=utt1,utt2 --archive-out=graphs.kvg "
+        "--archive-merge=true tree 1.mdl lex.fst ark:train.tra ark:/dev/null ...\n"
+        " compile-train-graphs --num-workers=8 --archive-out=graphs.kvg tree 1.mdl "
+        "lex.fst ark:train.tra ark:/dev/null ...\n";
     ParseOptions po(usage);
 
     TrainingGraphCompilerVisOptions gopts;
@@ -48,6 +198,17 @@ int main(int argc, char *argv[]) {
     // transition probs in the alignment phase (since they change eacm time)
     gopts.self_loop_scale = 0.0;  // Ditto for self-loop probs.
     std::string disambig_rxfilename;
+    std::string stats_wxfilename, stats_summary_wxfilename;
+    int32 malloc_pad_mb = 0;
+    bool dedup = true;
+    std::string graph_cache_dir;
+    int32 max_cached_graphs = 10000;
+    std::string archive_filename;
+    int32 num_shards = 1;
+    std::string keys_str, keys_rxfilename, key_pattern, index_filename;
+    bool archive_merge = false;
+    int32 num_workers = 1;
+    std::string trace_wxfilename;
     gopts.Register(&po);
 
     po.Register("batch-size", &batch_size,
@@ -55,13 +216,69 @@ int main(int argc, char *argv[]) {
                 "more memory.  E.g. 500");
     po.Register("read-disambig-syms", &disambig_rxfilename, "File containing "
                 "list of disambiguation symbols in phone symbol table");
-    
+    po.Register("malloc-pad-mb", &malloc_pad_mb, "Keep up to this many "
+                "megabytes of freed heap memory for reuse, instead of "
+                "returning it to the system after each graph and requesting "
+                "it again for the next (0 keeps the malloc defaults)");
+    po.Register("dedup", &dedup, "Compile the graph for each distinct "
+                "transcript only once, and write it for all of its utterances");
+    po.Register("graph-cache-dir", &graph_cache_dir, "Directory in which to "
+                "keep the compiled graphs across runs, for as long as the "
+                "tree, model, lexicon and options stay the same (implies "
+                "--dedup)");
+    po.Register("max-cached-graphs", &max_cached_graphs, "Maximum number of "
+                "distinct transcripts whose graphs are kept in memory");
+    po.Register("archive-out", &archive_filename, "Also write the graphs to "
+                "this file, in a page-aligned format that can be mmap()-ed "
+                "and used without parsing (give ark:/dev/null as "
+                "transit-wspec to write only this archive)");
+    po.Register("stats-out", &stats_wxfilename, "Write the time, size and "
+                "memory use of each compilation stage of each utterance to "
+                "this file (format: utt stage seconds states arcs rss-kb, "
+                "rss-kb being the resident set size after the stage)");
+    po.Register("stats-summary-out", &stats_summary_wxfilename, "Write "
+                "per-stage totals and histograms of the compilation time and "
+                "graph sizes to this file at the end of the run");
+    po.Register("num-shards", &num_shards, "Split the graphs into this many "
+                "contiguous archives of about the same size(estimated from the "
+                "transcript lengths); \"%d\" in transit-wspec is replaced by the "
+                "shard index(1-based)");
+    po.Register("keys", &keys_str, "Compile only the utterances with these "
+                "(comma separated) keys; the transcripts are looked up in an "
+                "index of the transcript archive, which has to be a text archive "
+                "in a regular file");
+    po.Register("keys-from", &keys_rxfilename, "Compile only the utterances "
+                "whose keys are listed in this file(the first field of each "
+                "line, so e.g. an utt2spk file can be given)");
+    po.Register("key-pattern", &key_pattern, "Compile only the utterances "
+                "whose keys match this shell wildcard pattern, e.g. "
+                "\"trn_adg04_*\"");
+    po.Register("transcript-index", &index_filename, "Keep the index of the "
+                "transcript archive used by --keys, --keys-from and "
+                "--key-pattern in this file, and reuse it while it is newer "
+                "than the archive");
+    po.Register("archive-merge", &archive_merge, "Merge the graphs into the "
+                "existing --archive-out archive: the graphs of the compiled "
+                "utterances are appended and replace the old ones, and the "
+                "other graphs are left as they are");
+    po.Register("num-workers", &num_workers, "Compile the graphs in this many "
+                "processes, which share the model, the tree and the prepared "
+                "lexicon; \"%d\" in the wspecifiers is replaced by the "
+                "worker's index(1..n)");
+    po.Register("trace-out", &trace_wxfilename, "Write the time spent in the "
+                "loading, in each stage of the composition and in the writing "
+                "as Chrome trace events(JSON)");
+
     po.Read(argc, argv);
 
-    if (po.NumArgs() != 8) {
+    if (po.NumArgs() != 8 || num_shards < 1 || num_workers < 1) {
       po.PrintUsage();
       exit(1);
     }
+    if (num_workers > 1 && (num_shards > 1 || stats_wxfilename != "" ||
+                            stats_summary_wxfilename != ""))
+      KALDI_ERR << "--num-workers can't be used with --num-shards or the "
+                << "statistics options";
 
     std::string tree_rxfilename = po.GetArg(1);
     std::string model_rxfilename = po.GetArg(2);
@@ -72,21 +289,26 @@ int main(int argc, char *argv[]) {
     std::string clg_wspec = po.GetArg(7);
     std::string hclg_noloop_wspec = po.GetArg(8);
 
-    ContextDependency ctx_dep;  // the tree.
-    {
-      bool binary;
-      Input ki(tree_rxfilename, &binary);
-      ctx_dep.Read(ki.Stream(), binary);
+    if (malloc_pad_mb > 0) {
+      // The graphs of consecutive utterances have similar sizes, so the
+      // memory freed after one is best kept for the next. Large blocks(the
+      // arc vectors of big graphs) are also taken from the heap rather
+      // than mmap()-ed and unmapped each time.
+      // mallopt() takes an int; larger pads are clamped to INT_MAX bytes
+      int bytes = static_cast<int>(std::min<int64>(
+          static_cast<int64>(malloc_pad_mb) * 1024 * 1024, INT_MAX));
+      mallopt(M_TOP_PAD, bytes);
+      mallopt(M_TRIM_THRESHOLD, bytes);
+      mallopt(M_MMAP_THRESHOLD, std::min(bytes, 32 * 1024 * 1024));
     }
 
-    TransitionModel trans_model;
-    {
-      bool binary;
-      Input ki(model_rxfilename, &binary);
-      trans_model.Read(ki.Stream(), binary);
-      // AmDiagGmm am_gmm;
-      // am_gmm.Read(ki.Stream(), binary);
-    }
+    TraceSession trace_session(trace_wxfilename, "compile-train-graphs-vis");
+    TraceScope load_scope("LoadModel");
+    VisModelCache &cache = VisModelCache::Default();
+    const ContextDependency &ctx_dep =
+        cache.GetContextDependency(tree_rxfilename);  // the tree.
+    const TransitionModel &trans_model =
+        cache.GetTransitionModel(model_rxfilename);
 
     // need VectorFst because we will change it by adding subseq symbol.
     VectorFst<StdArc> *lex_fst = NULL;  // ownership will be taken by gc.
@@ -105,34 +327,221 @@ int main(int argc, char *argv[]) {
         KALDI_ERR << "fstcomposecontext: Could not read disambiguation symbols from "
                   << disambig_rxfilename;
     
+    TrainingGraphCache *graph_cache = NULL;
+    if (dedup || graph_cache_dir != "") {
+      // the fingerprint has to be computed before gc modifies the lexicon
+      int32 num_graphs = (batch_size == 1 ? 4 : 1);
+      std::string fingerprint =
+          TrainingGraphFingerprint(ctx_dep, trans_model, *lex_fst,
+                                   disambig_syms, gopts, num_graphs);
+      graph_cache = new TrainingGraphCache(fingerprint, graph_cache_dir,
+                                           max_cached_graphs);
+    }
+
+    load_scope.End();
+
+    TraceScope prepare_scope("PrepareLexicon");
     TrainingGraphCompilerVis gc(trans_model, ctx_dep, lex_fst, disambig_syms, gopts);
+    prepare_scope.End();
 
     lex_fst = NULL;  // we gave ownership to gc.
 
-    SequentialInt32VectorReader transcript_reader(transcript_rspecifier);
-    TableWriter<fst::VectorFstHolder> fst_writer(fsts_wspecifier);
+    Output stats_output;
+    TrainingGraphCompilerVisStats *stats = NULL;
+    if (stats_wxfilename != "" || stats_summary_wxfilename != "") {
+      std::ostream *records_os = NULL;
+      if (stats_wxfilename != "") {
+        if (!stats_output.Open(stats_wxfilename, false, false))
+          KALDI_ERR << "Could not open " << stats_wxfilename;
+        records_os = &stats_output.Stream();
+      }
+      stats = new TrainingGraphCompilerVisStats(records_os);
+      gc.SetStats(stats);
+    }
+
+    // With a key selection only the selected transcripts are read, through
+    // an index of the archive
+    bool select_keys = (keys_str != "" || keys_rxfilename != "" ||
+                        key_pattern != "");
+    TranscriptIndex transcript_index;
+    std::vector<std::string> selected_keys;
+    if (select_keys) {
+      transcript_index.Open(transcript_rspecifier, index_filename);
+      std::vector<std::string> keys;
+      SplitStringToVector(keys_str, ",", true, &keys);
+      if (keys_rxfilename != "") {
+        Input ki(keys_rxfilename);
+        std::string line;
+        while (std::getline(ki.Stream(), line)) {
+          std::vector<std::string> fields;
+          SplitStringToVector(line, " \t\r", true, &fields);
+          if (!fields.empty())
+            keys.push_back(fields[0]);
+        }
+      }
+      SelectTranscriptKeys(transcript_index, keys, key_pattern,
+                           &selected_keys);
+      KALDI_LOG << "Compiling the graphs of " << selected_keys.size()
+                << " of the " << transcript_index.NumKeys() << " utterances";
+    }
+
+    // With several workers the transcripts are put in a shared queue and the
+    // workers are forked only now, so that they share the model, the tree
+    // and the lexicon prepared by gc. Each worker takes chunks of the queue
+    // and writes its own outputs; the coordinator merges their archives.
+    CompileWorkQueue work_queue;
+    int32 worker = -1;
+    if (num_workers > 1) {
+      // fail here rather than in each worker if a "%d" is missing
+      WorkerWspecifier(fsts_wspecifier, 1);
+      WorkerWspecifier(lg_wspec, 1);
+      WorkerWspecifier(clg_wspec, 1);
+      WorkerWspecifier(hclg_noloop_wspec, 1);
+      std::vector<std::string> keys;
+      std::vector<std::vector<int32> > transcripts;
+      TranscriptSource *reader = (select_keys ?
+          new TranscriptSource(&transcript_index, selected_keys) :
+          new TranscriptSource(transcript_rspecifier));
+      for (; !reader->Done(); reader->Next()) {
+        keys.push_back(reader->Key());
+        transcripts.push_back(reader->Value());
+      }
+      delete reader;
+      work_queue.Create(keys, transcripts, std::max(batch_size, 1),
+                        num_workers);
+      keys.clear();
+      transcripts.clear();
+      worker = work_queue.ForkWorkers();
+      if (worker < 0) {
+        if (!work_queue.WaitForWorkers())
+          KALDI_ERR << "Some of the workers failed";
+        // only these wrote outputs, if some of the fork() calls failed
+        int32 num_started = work_queue.NumStarted();
+        int64 num_succeed = 0, num_fail = 0, num_det_failures = 0;
+        for (int32 w = 0; w < num_started; w++) {
+          num_succeed += work_queue.Result(w)->num_succeed;
+          num_fail += work_queue.Result(w)->num_fail;
+          num_det_failures += work_queue.Result(w)->num_det_failures;
+        }
+        if (archive_filename != "") {
+          TraceScope merge_scope("MergeArchives");
+          MergeWorkerArchives(archive_filename, num_started, archive_merge);
+        }
+        if (trace_wxfilename != "") {
+          for (int32 w = 1; w <= num_started; w++) {
+            std::string worker_trace = WorkerFilename(trace_wxfilename, w);
+            TraceRecorder::Default().AddFile(worker_trace);
+            std::remove(worker_trace.c_str());
+          }
+        }
+        KALDI_LOG << "compile-train-graphs: succeeded for " << num_succeed
+                  << " graphs, failed for " << num_fail << " ("
+                  << num_started << " workers)";
+        if (num_det_failures != 0)
+          KALDI_LOG << "The determinization was aborted for "
+                    << num_det_failures << " graphs (fallback: "
+                    << gopts.det_fallback << ")";
+        delete graph_cache;
+        return 0;
+      }
+      fsts_wspecifier = WorkerWspecifier(fsts_wspecifier, worker + 1);
+      lg_wspec = WorkerWspecifier(lg_wspec, worker + 1);
+      clg_wspec = WorkerWspecifier(clg_wspec, worker + 1);
+      hclg_noloop_wspec = WorkerWspecifier(hclg_noloop_wspec, worker + 1);
+      if (trace_wxfilename != "") {
+        std::ostringstream name;
+        name << "compile-train-graphs-vis worker " << (worker + 1);
+        trace_session.Reopen(WorkerFilename(trace_wxfilename, worker + 1),
+                             name.str());
+      }
+      if (archive_filename != "") {
+        archive_filename = WorkerFilename(archive_filename, worker + 1);
+        archive_merge = false;
+      }
+    }
+
+    ShardedTableWriter<fst::VectorFstHolder> fst_writer;
+    if (num_shards > 1) {
+      // The transcripts are read twice: first to balance the shards. The size
+      // of a graph grows linearly with the length of its transcript.
+      std::string transcript_rxfilename;
+      RspecifierOptions ropts;
+      ClassifyRspecifier(transcript_rspecifier, &transcript_rxfilename, &ropts);
+      if (ClassifyRxfilename(transcript_rxfilename) != kFileInput)
+        KALDI_ERR << "--num-shards needs transcripts that can be read twice "
+                  << "(not a pipe or the standard input)";
+      std::vector<std::string> keys;
+      std::vector<double> weights;
+      TranscriptSource *reader = (select_keys ?
+          new TranscriptSource(&transcript_index, selected_keys) :
+          new TranscriptSource(transcript_rspecifier));
+      for (; !reader->Done(); reader->Next()) {
+        keys.push_back(reader->Key());
+        weights.push_back(reader->Value().size() + 1);
+      }
+      delete reader;
+      if (!fst_writer.Open(fsts_wspecifier, num_shards, keys, weights))
+        KALDI_ERR << "Could not open " << fsts_wspecifier;
+    } else if (!fst_writer.Open(fsts_wspecifier)) {
+      KALDI_ERR << "Could not open " << fsts_wspecifier;
+    }
+    TranscriptSource *transcript_reader = (worker >= 0 ?
+        new TranscriptSource(&work_queue) : select_keys ?
+        new TranscriptSource(&transcript_index, selected_keys) :
+        new TranscriptSource(transcript_rspecifier));
     TableWriter<fst::VectorFstHolder> lg_fst_writer(lg_wspec);
     TableWriter<fst::VectorFstHolder> clg_fst_writer(clg_wspec);
     TableWriter<fst::VectorFstHolder> hclg_noloop_fst_writer(hclg_noloop_wspec);
 
+    GraphArchiveWriter archive_writer;
+    if (archive_filename != "" && archive_merge)
+      archive_writer.OpenForMerge(archive_filename);
+    else if (archive_filename != "")
+      archive_writer.Open(archive_filename);
+
     int num_succeed = 0, num_fail = 0;
 
     if (batch_size == 1) {  // We treat batch_size of 1 as a special case in order
       // to test more parts of the code.
-      for (; !transcript_reader.Done(); transcript_reader.Next()) {
-        std::string key = transcript_reader.Key();
-        const std::vector<int32> &transcript = transcript_reader.Value();
+      for (; !transcript_reader->Done(); transcript_reader->Next()) {
+        std::string key = transcript_reader->Key();
+        const std::vector<int32> &transcript = transcript_reader->Value();
+        TrainingGraphCache::Graphs cached;
+        if (graph_cache != NULL && graph_cache->Lookup(transcript, &cached)) {
+          num_succeed++;
+          fst_writer.Write(key, *cached[0]);
+          if (archive_filename != "")
+            archive_writer.Write(key, *cached[0]);
+          lg_fst_writer.Write(key, *cached[1]);
+          clg_fst_writer.Write(key, *cached[2]);
+          hclg_noloop_fst_writer.Write(key, *cached[3]);
+          DeletePointers(&cached);
+          continue;
+        }
         VectorFst<StdArc> decode_fst, lg_fst, clg_fst, hclg_noloop_fst;
 
+        if (stats != NULL)
+          stats->StartBatch(std::vector<std::string>(1, key));
         if (!gc.CompileGraphFromText(transcript, &decode_fst,
                                      &lg_fst, &clg_fst, &hclg_noloop_fst)) {
           KALDI_WARN << "Problem creating decoding graph for utterance "
-                     << key << " [serious error]";
+                     << key;
           decode_fst.DeleteStates();  // Just make it empty.
         }
         if (decode_fst.Start() != fst::kNoStateId) num_succeed++;
         else num_fail++;
+        if (graph_cache != NULL) {
+          TrainingGraphCache::Graphs graphs;
+          graphs.push_back(&decode_fst);
+          graphs.push_back(&lg_fst);
+          graphs.push_back(&clg_fst);
+          graphs.push_back(&hclg_noloop_fst);
+          graph_cache->Insert(transcript, graphs);
+        }
+        TraceScope write_scope("WriteGraphs");
         fst_writer.Write(key, decode_fst);
+        if (archive_filename != "")
+          archive_writer.Write(key, decode_fst);
         lg_fst_writer.Write(key, lg_fst);
         clg_fst_writer.Write(key, clg_fst);
         hclg_noloop_fst_writer.Write(key, hclg_noloop_fst);
@@ -140,28 +549,118 @@ int main(int argc, char *argv[]) {
     } else {
       std::vector<std::string> keys;
       std::vector<std::vector<int32> > transcripts;
-      while (!transcript_reader.Done()) {
+      while (!transcript_reader->Done()) {
         keys.clear();
         transcripts.clear();
-        for (; !transcript_reader.Done() &&
+        TraceScope read_scope("ReadTranscripts");
+        for (; !transcript_reader->Done() &&
                 static_cast<int32>(transcripts.size()) < batch_size;
-            transcript_reader.Next()) {
-          keys.push_back(transcript_reader.Key());
-          transcripts.push_back(transcript_reader.Value());
+            transcript_reader->Next()) {
+          keys.push_back(transcript_reader->Key());
+          transcripts.push_back(transcript_reader->Value());
         }
+        read_scope.End();
+
+        // Only the transcripts that are not cached are compiled, and each
+        // distinct one only once. "source[i]" is the index in "todo" of the
+        // transcript of the i-th utterance, or -1 if its graph was cached.
+        std::vector<VectorFst<StdArc>*> cached_fsts(keys.size(), NULL);
+        std::vector<int32> source(keys.size(), -1);
+        std::vector<std::string> todo_keys;
+        std::vector<std::vector<int32> > todo;
+        std::map<std::vector<int32>, int32> todo_index;
+        for (size_t i = 0; i < keys.size(); i++) {
+          if (graph_cache != NULL) {
+            std::map<std::vector<int32>, int32>::const_iterator it =
+                todo_index.find(transcripts[i]);
+            if (it != todo_index.end()) {
+              source[i] = it->second;
+              continue;
+            }
+            TrainingGraphCache::Graphs cached;
+            if (graph_cache->Lookup(transcripts[i], &cached)) {
+              cached_fsts[i] = cached[0];
+              continue;
+            }
+            todo_index[transcripts[i]] = todo.size();
+          }
+          source[i] = todo.size();
+          todo_keys.push_back(keys[i]);
+          todo.push_back(transcripts[i]);
+        }
+
         std::vector<fst::VectorFst<fst::StdArc>* > fsts;
-        if (!gc.CompileGraphsFromText(transcripts, &fsts)) {
+        if (stats != NULL)
+          stats->StartBatch(todo_keys);
+        if (!gc.CompileGraphsFromText(todo, &fsts)) {
           KALDI_ERR << "Not expecting CompileGraphs to fail.";
         }
-        assert(fsts.size() == keys.size());
-        for (size_t i = 0; i < fsts.size(); i++)
-          fst_writer.Write(keys[i], *(fsts[i]));
-        num_succeed += fsts.size();
+        assert(fsts.size() == todo.size());
+        if (graph_cache != NULL) {
+          for (size_t i = 0; i < fsts.size(); i++)
+            graph_cache->Insert(todo[i], TrainingGraphCache::Graphs(1, fsts[i]));
+        }
+        TraceScope write_scope("WriteGraphs");
+        for (size_t i = 0; i < keys.size(); i++) {
+          const VectorFst<StdArc> &graph =
+              (source[i] < 0 ? *cached_fsts[i] : *fsts[source[i]]);
+          // the graphs that failed to compile are empty
+          if (graph.Start() != fst::kNoStateId) {
+            num_succeed++;
+          } else {
+            KALDI_WARN << "Problem creating decoding graph for utterance "
+                       << keys[i];
+            num_fail++;
+          }
+          fst_writer.Write(keys[i], graph);
+          if (archive_filename != "")
+            archive_writer.Write(keys[i], graph);
+        }
+        write_scope.End();
+        TraceCounter("graphs", num_succeed);
         DeletePointers(&fsts);
+        DeletePointers(&cached_fsts);
       }
     }
+    delete transcript_reader;
+    if (archive_filename != "")
+      archive_writer.Close();
+    if (!fst_writer.Close())
+      KALDI_ERR << "Error closing " << fsts_wspecifier;
     KALDI_LOG << "compile-train-graphs: succeeded for " << num_succeed
               << " graphs, failed for " << num_fail;
+    if (gc.NumDetFailures() != 0)
+      KALDI_LOG << "The determinization was aborted for "
+                << gc.NumDetFailures() << " graphs (fallback: "
+                << gopts.det_fallback << ")";
+    if (gopts.share_prefixes && gc.NumSharedStates() != 0)
+      KALDI_LOG << "Prefix sharing: composed " << gc.NumSharedStates()
+                << " states for graphs with " << gc.NumSplitStates()
+                << " states in total";
+    if (graph_cache != NULL) {
+      KALDI_LOG << "Graph cache: " << graph_cache->NumHits() << " hits in "
+                << "memory, " << graph_cache->NumDiskHits() << " on disk, "
+                << graph_cache->NumMisses() << " misses";
+      delete graph_cache;
+    }
+    if (stats != NULL) {
+      std::ostringstream summary;
+      stats->WriteSummary(summary);
+      KALDI_LOG << "Graph compilation statistics:\n" << summary.str();
+      if (stats_summary_wxfilename != "") {
+        Output ko(stats_summary_wxfilename, false);
+        ko.Stream() << summary.str();
+      }
+      gc.SetStats(NULL);
+      delete stats;
+    }
+    if (worker >= 0) {
+      CompileWorkerResult *result = work_queue.Result(worker);
+      result->num_succeed = num_succeed;
+      result->num_fail = num_fail;
+      result->num_det_failures = gc.NumDetFailures();
+      result->finished = 1;
+    }
     return 0;
   } catch(const std::exception& e) {
     std::cerr << e.what();
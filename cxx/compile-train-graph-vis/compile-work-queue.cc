@@ -0,0 +1,183 @@
+// decoder/compile-work-queue.cc
+
+// Copyright 2012  Vassil Panayotov <vd.panayotov@gmail.com>
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+
+#include "decoder/compile-work-queue.h"
+
+namespace kaldi {
+
+namespace {
+
+int64 Align(int64 offset) {
+  return (offset + 7) / 8 * 8;
+}
+
+}  // namespace
+
+void CompileWorkQueue::Create(
+    const std::vector<std::string> &keys,
+    const std::vector<std::vector<int32> > &transcripts,
+    int32 chunk_size, int32 num_workers) {
+  KALDI_ASSERT(keys.size() == transcripts.size() && chunk_size > 0 &&
+               num_workers > 0);
+  Close();
+  int64 num_words = 0, keys_size = 0;
+  for (size_t i = 0; i < keys.size(); i++) {
+    num_words += transcripts[i].size();
+    keys_size += keys[i].size();
+  }
+  CompileQueueHeader header;
+  memset(&header, 0, sizeof(header));
+  header.num_utts = keys.size();
+  header.chunk_size = chunk_size;
+  header.num_workers = num_workers;
+  header.results_offset = Align(sizeof(header));
+  header.utts_offset = header.results_offset +
+      num_workers * sizeof(CompileWorkerResult);
+  header.words_offset = header.utts_offset +
+      header.num_utts * sizeof(CompileQueueUtt);
+  header.keys_offset = Align(header.words_offset + num_words * sizeof(int32));
+  size_ = header.keys_offset + keys_size;
+
+  std::ostringstream name;
+  name << "/kaldi-compile-graphs." << getpid();
+  int fd = shm_open(name.str().c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+  if (fd < 0)
+    KALDI_ERR << "Could not create shared memory segment " << name.str()
+              << ": " << strerror(errno);
+  shm_unlink(name.str().c_str());  // the mappings stay valid
+  if (ftruncate(fd, size_) != 0) {
+    close(fd);
+    KALDI_ERR << "Could not allocate " << size_ << " bytes of shared memory: "
+              << strerror(errno);
+  }
+  void *data = mmap(NULL, size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED)
+    KALDI_ERR << "Could not map the shared memory segment: "
+              << strerror(errno);
+  data_ = static_cast<char*>(data);
+  header_ = reinterpret_cast<CompileQueueHeader*>(data_);
+  *header_ = header;  // the results are zeroed by ftruncate
+
+  CompileQueueUtt *utts = reinterpret_cast<CompileQueueUtt*>(data_ +
+      header.utts_offset);
+  int32 *words = reinterpret_cast<int32*>(data_ + header.words_offset);
+  char *key_data = data_ + header.keys_offset;
+  int64 words_offset = 0, key_offset = 0;
+  for (size_t i = 0; i < keys.size(); i++) {
+    utts[i].words_offset = words_offset;
+    utts[i].num_words = transcripts[i].size();
+    if (!transcripts[i].empty())
+      memcpy(words + words_offset, &transcripts[i][0],
+             transcripts[i].size() * sizeof(int32));
+    words_offset += transcripts[i].size();
+    utts[i].key_offset = key_offset;
+    utts[i].key_size = keys[i].size();
+    memcpy(key_data + key_offset, keys[i].data(), keys[i].size());
+    key_offset += keys[i].size();
+  }
+}
+
+void CompileWorkQueue::Close() {
+  if (data_ != NULL)
+    munmap(data_, size_);
+  data_ = NULL;
+  size_ = 0;
+  header_ = NULL;
+}
+
+bool CompileWorkQueue::Take(int64 *begin, int64 *end) {
+  int64 first = __sync_fetch_and_add(&header_->next_utt, header_->chunk_size);
+  if (first >= header_->num_utts)
+    return false;
+  *begin = first;
+  *end = std::min(first + header_->chunk_size, header_->num_utts);
+  return true;
+}
+
+std::string CompileWorkQueue::Key(int64 i) const {
+  const CompileQueueUtt &utt = Utt(i);
+  return std::string(data_ + header_->keys_offset + utt.key_offset,
+                     utt.key_size);
+}
+
+void CompileWorkQueue::Transcript(int64 i,
+                                  std::vector<int32> *transcript) const {
+  const CompileQueueUtt &utt = Utt(i);
+  const int32 *words = reinterpret_cast<const int32*>(data_ +
+      header_->words_offset) + utt.words_offset;
+  transcript->assign(words, words + utt.num_words);
+}
+
+int32 CompileWorkQueue::ForkWorkers() {
+  KALDI_ASSERT(header_ != NULL && workers_.empty());
+  num_started_ = 0;
+  // what is buffered now would be written by each process
+  std::cout.flush();
+  std::cerr.flush();
+  fflush(NULL);
+  for (int32 w = 0; w < header_->num_workers; w++) {
+    pid_t pid = fork();
+    if (pid < 0) {
+      KALDI_WARN << "Could not start worker " << w << ": " << strerror(errno);
+      break;  // the remaining workers take the rest of the queue
+    }
+    if (pid == 0) {
+      workers_.clear();
+      return w;
+    }
+    workers_.push_back(pid);
+  }
+  if (workers_.empty())
+    KALDI_ERR << "Could not start any worker";
+  num_started_ = workers_.size();
+  return -1;
+}
+
+bool CompileWorkQueue::WaitForWorkers() {
+  bool ans = true;
+  for (size_t w = 0; w < workers_.size(); w++) {
+    int status;
+    while (waitpid(workers_[w], &status, 0) < 0) {
+      if (errno != EINTR)
+        KALDI_ERR << "Error waiting for worker " << w << ": "
+                  << strerror(errno);
+    }
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0 ||
+        !Result(w)->finished) {
+      KALDI_WARN << "Worker " << w << " failed";
+      ans = false;
+    }
+  }
+  workers_.clear();
+  // the chunks taken by failed workers are lost
+  return ans && header_->next_utt >= header_->num_utts;
+}
+
+}  // end namespace kaldi
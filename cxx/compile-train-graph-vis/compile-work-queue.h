@@ -0,0 +1,131 @@
+// decoder/compile-work-queue.h
+
+// Copyright 2012  Vassil Panayotov <vd.panayotov@gmail.com>
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef KALDI_DECODER_COMPILE_WORK_QUEUE_H_
+#define KALDI_DECODER_COMPILE_WORK_QUEUE_H_
+
+#include <sys/types.h>
+#include <string>
+#include <vector>
+
+#include "base/kaldi-common.h"
+
+namespace kaldi {
+
+// The transcripts to be compiled by the worker processes of
+// compile-train-graphs-vis --num-workers, in a POSIX shared-memory segment.
+// The coordinator loads and prepares the tree, the model and the lexicon,
+// fills the queue and forks the workers, which take chunks of consecutive
+// utterances from the queue until it is empty(so the faster workers take
+// more chunks). Only the queue and the results are in the shared segment;
+// the prepared structures are ordinary objects, which the workers inherit
+// through fork() and share only for as long as their pages are not written.
+//
+// Layout of the segment(pointer-free, so it is valid at any address):
+//   CompileQueueHeader
+//   CompileWorkerResult[num_workers]
+//   CompileQueueUtt[num_utts]
+//   int32[]                    the transcripts, one after another
+//   char[]                     the keys, concatenated
+
+struct CompileQueueHeader {
+  int64 num_utts;
+  int64 chunk_size;
+  int64 next_utt;               // the first utterance not taken yet(atomic)
+  int64 results_offset;
+  int64 utts_offset;
+  int64 words_offset;
+  int64 keys_offset;
+  int32 num_workers;
+  int32 reserved;
+};
+
+struct CompileQueueUtt {
+  int64 words_offset;           // in words, from the start of the words
+  int64 key_offset;             // in bytes, from the start of the keys
+  int32 num_words;
+  int32 key_size;
+};
+
+/// Written by each worker at the end of its run
+struct CompileWorkerResult {
+  int64 num_succeed;
+  int64 num_fail;
+  int64 num_det_failures;
+  int32 finished;
+  int32 reserved;
+};
+
+class CompileWorkQueue {
+ public:
+  CompileWorkQueue(): data_(NULL), size_(0), header_(NULL), num_started_(0) {}
+  ~CompileWorkQueue() { Close(); }
+
+  /// Creates the segment and stores the transcripts in it. The segment is
+  /// unlinked right away, so it goes away with the last process using it.
+  void Create(const std::vector<std::string> &keys,
+              const std::vector<std::vector<int32> > &transcripts,
+              int32 chunk_size, int32 num_workers);
+
+  void Close();
+
+  int64 NumUtts() const { return header_->num_utts; }
+
+  /// Takes the next chunk of utterances, [*begin, *end). Returns false if
+  /// all utterances have been taken. Can be called by any of the processes.
+  bool Take(int64 *begin, int64 *end);
+
+  std::string Key(int64 i) const;
+  void Transcript(int64 i, std::vector<int32> *transcript) const;
+
+  CompileWorkerResult *Result(int32 worker) {
+    KALDI_ASSERT(worker >= 0 && worker < header_->num_workers);
+    return reinterpret_cast<CompileWorkerResult*>(data_ +
+        header_->results_offset) + worker;
+  }
+
+  /// Forks the workers. Returns the index(0-based) of the worker in the
+  /// workers, and -1 in the coordinator. If a fork() fails, the workers
+  /// already started take the rest of the queue(see NumStarted()).
+  int32 ForkWorkers();
+
+  /// The number of workers started by ForkWorkers(), i.e. workers
+  /// 0 .. NumStarted()-1 ran; their results and outputs are the only ones.
+  int32 NumStarted() const { return num_started_; }
+
+  /// Waits for all the workers; returns false if any of them failed
+  bool WaitForWorkers();
+
+ private:
+  const CompileQueueUtt &Utt(int64 i) const {
+    KALDI_ASSERT(i >= 0 && i < header_->num_utts);
+    return reinterpret_cast<const CompileQueueUtt*>(data_ +
+        header_->utts_offset)[i];
+  }
+
+  char *data_;
+  size_t size_;
+  CompileQueueHeader *header_;
+  std::vector<pid_t> workers_;
+  int32 num_started_;
+
+  KALDI_DISALLOW_COPY_AND_ASSIGN(CompileWorkQueue);
+};
+
+}  // end namespace kaldi
+
+#endif  // KALDI_DECODER_COMPILE_WORK_QUEUE_H_
@@ -0,0 +1,187 @@
+// decoder/mapped-graph-archive-test.cc
+
+// Copyright 2012  Vassil Panayotov <vd.panayotov@gmail.com>
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#include <sys/stat.h>
+#include <unistd.h>
+#include <fstream>
+#include <map>
+#include <sstream>
+
+#include "decoder/mapped-graph-archive.h"
+#include "fstext/rand-fst.h"
+
+namespace kaldi {
+
+typedef std::map<std::string, fst::VectorFst<fst::StdArc>*> GraphMap;
+
+static void DeleteGraphs(GraphMap *graphs) {
+  for (GraphMap::iterator it = graphs->begin(); it != graphs->end(); ++it)
+    delete it->second;
+  graphs->clear();
+}
+
+static std::string GraphKey(int32 i) {
+  std::ostringstream ss;
+  ss << "utt" << i;
+  return ss.str();
+}
+
+static int64 FileSize(const std::string &filename) {
+  struct stat st;
+  KALDI_ASSERT(stat(filename.c_str(), &st) == 0);
+  return st.st_size;
+}
+
+/// Writes "graphs" in key order to a new archive
+static void WriteArchive(const std::string &filename, const GraphMap &graphs) {
+  GraphArchiveWriter writer;
+  writer.Open(filename);
+  for (GraphMap::const_iterator it = graphs.begin(); it != graphs.end(); ++it)
+    writer.Write(it->first, *(it->second));
+  writer.Close();
+}
+
+/// Checks that the archive holds exactly "graphs"
+static void CheckArchive(const std::string &filename, const GraphMap &graphs) {
+  GraphArchiveReader reader;
+  reader.Open(filename);
+  KALDI_ASSERT(reader.NumGraphs() == static_cast<int64>(graphs.size()));
+  int64 i = 0;
+  for (GraphMap::const_iterator it = graphs.begin(); it != graphs.end();
+       ++it, ++i) {
+    KALDI_ASSERT(reader.Key(i) == it->first);
+    KALDI_ASSERT(reader.Find(it->first) == i);
+    MappedGraphFst fst;
+    KALDI_ASSERT(reader.Graph(it->first, &fst));
+    KALDI_ASSERT(fst.NumStates() == it->second->NumStates());
+    KALDI_ASSERT(fst::Equal(*(it->second), fst));
+  }
+  MappedGraphFst fst;
+  KALDI_ASSERT(reader.Find("") == -1);
+  KALDI_ASSERT(reader.Find("utt") == -1);  // a prefix of all keys
+  KALDI_ASSERT(reader.Find("utt99999") == -1);
+  KALDI_ASSERT(!reader.Graph("zzz", &fst));
+}
+
+/// Returns true if GraphArchiveReader::Open() rejects the file
+static bool OpenFails(const std::string &filename) {
+  GraphArchiveReader reader;
+  try {
+    reader.Open(filename);
+  } catch (const std::exception &e) {
+    return true;
+  }
+  return false;
+}
+
+void UnitTestGraphArchiveReadWrite() {
+  std::string filename = "tmp.graphs";
+  GraphMap graphs;
+  int32 num_graphs = 1 + rand() % 10;
+  for (int32 i = 0; i < num_graphs; i++)
+    graphs[GraphKey(rand() % 1000)] = fst::RandFst<fst::StdArc>();
+  WriteArchive(filename, graphs);
+  KALDI_ASSERT(GraphArchiveReader::IsGraphArchive(filename));
+  CheckArchive(filename, graphs);
+  DeleteGraphs(&graphs);
+
+  // an empty archive
+  WriteArchive(filename, graphs);
+  CheckArchive(filename, graphs);
+  unlink(filename.c_str());
+}
+
+void UnitTestGraphArchiveMerge() {
+  std::string filename = "tmp.graphs", compact_filename = "tmp.compact.graphs";
+  GraphMap graphs;
+  for (int32 i = 0; i < 3; i++)
+    graphs[GraphKey(i)] = fst::RandFst<fst::StdArc>();
+  WriteArchive(filename, graphs);
+
+  // replace utt1 and add utt3
+  GraphArchiveWriter writer;
+  writer.OpenForMerge(filename);
+  delete graphs[GraphKey(1)];
+  graphs[GraphKey(1)] = fst::RandFst<fst::StdArc>();
+  graphs[GraphKey(3)] = fst::RandFst<fst::StdArc>();
+  writer.Write(GraphKey(1), *graphs[GraphKey(1)]);
+  writer.Write(GraphKey(3), *graphs[GraphKey(3)]);
+  writer.Close();
+  CheckArchive(filename, graphs);
+
+  // The old keys and index take two pages, more than the small random graphs,
+  // so the merge must have compacted the archive: it is then the same size
+  // as an archive written afresh.
+  WriteArchive(compact_filename, graphs);
+  KALDI_ASSERT(FileSize(filename) == FileSize(compact_filename));
+  KALDI_ASSERT(access((filename + ".tmp").c_str(), F_OK) != 0);
+
+  // merging into a file that doesn't exist creates it
+  unlink(filename.c_str());
+  writer.OpenForMerge(filename);
+  for (GraphMap::iterator it = graphs.begin(); it != graphs.end(); ++it)
+    writer.Write(it->first, *(it->second));
+  writer.Close();
+  CheckArchive(filename, graphs);
+
+  DeleteGraphs(&graphs);
+  unlink(filename.c_str());
+  unlink(compact_filename.c_str());
+}
+
+void UnitTestGraphArchiveTruncated() {
+  std::string filename = "tmp.graphs", truncated_filename = "tmp.trunc.graphs";
+  GraphMap graphs;
+  for (int32 i = 0; i < 3; i++)
+    graphs[GraphKey(i)] = fst::RandFst<fst::StdArc>();
+  WriteArchive(filename, graphs);
+  DeleteGraphs(&graphs);
+
+  std::string data;
+  {
+    std::ifstream is(filename.c_str(), std::ios::binary);
+    std::ostringstream ss;
+    ss << is.rdbuf();
+    data = ss.str();
+  }
+  // without the last byte of the index, and without most of the header
+  size_t sizes[] = { data.size() - 1, 10 };
+  for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+    {
+      std::ofstream os(truncated_filename.c_str(), std::ios::binary);
+      os.write(data.data(), sizes[i]);
+      KALDI_ASSERT(os.good());
+    }
+    KALDI_ASSERT(OpenFails(truncated_filename));
+  }
+  KALDI_ASSERT(!OpenFails(filename));
+  unlink(filename.c_str());
+  unlink(truncated_filename.c_str());
+}
+
+}  // end namespace kaldi
+
+int main() {
+  using namespace kaldi;
+  for (int32 i = 0; i < 10; i++) {
+    UnitTestGraphArchiveReadWrite();
+    UnitTestGraphArchiveMerge();
+    UnitTestGraphArchiveTruncated();
+  }
+  std::cout << "Test OK.\n";
+  return 0;
+}
@@ -0,0 +1,366 @@
+// decoder/mapped-graph-archive.cc
+
+// Copyright 2012  Vassil Panayotov <vd.panayotov@gmail.com>
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+#include "decoder/mapped-graph-archive.h"
+
+namespace kaldi {
+
+namespace {
+
+const char kGraphArchiveMagic[8] = { 'K', 'V', 'G', 'R', 'A', 'P', 'H', 0 };
+const int32 kGraphArchiveVersion = 1;
+const uint32 kGraphArchiveByteOrder = 0x01020304;
+
+int32 PageSize() {
+  return static_cast<int32>(sysconf(_SC_PAGESIZE));
+}
+
+/// Whether "count" items of "item_size" bytes starting at "offset" lie within
+/// "size" bytes(written so that corrupt values can't overflow)
+bool InRange(int64 offset, int64 count, int64 item_size, int64 size) {
+  return offset >= 0 && count >= 0 && offset <= size &&
+      count <= (size - offset) / item_size;
+}
+
+bool EntryKeyLess(const std::pair<std::string, GraphArchiveEntry> &a,
+                  const std::pair<std::string, GraphArchiveEntry> &b) {
+  return a.first < b.first;
+}
+
+}  // namespace
+
+GraphArchiveWriter::~GraphArchiveWriter() {
+  if (file_ != NULL) {  // the archive is left without a header
+    KALDI_WARN << "Graph archive " << filename_ << " was not closed";
+    fclose(file_);
+  }
+}
+
+void GraphArchiveWriter::WriteBytes(const void *data, size_t size) {
+  if (size != 0 && fwrite(data, 1, size, file_) != size)
+    KALDI_ERR << "Error writing graph archive " << filename_;
+  offset_ += size;
+}
+
+void GraphArchiveWriter::Pad(int64 alignment) {
+  static const char zeros[64] = { 0 };
+  int64 padding = (alignment - offset_ % alignment) % alignment;
+  while (padding > 0) {
+    int64 n = std::min(padding, static_cast<int64>(sizeof(zeros)));
+    WriteBytes(zeros, n);
+    padding -= n;
+  }
+}
+
+void GraphArchiveWriter::Open(const std::string &filename) {
+  KALDI_ASSERT(file_ == NULL);
+  filename_ = filename;
+  file_ = fopen(filename.c_str(), "wb");
+  if (file_ == NULL)
+    KALDI_ERR << "Could not open graph archive " << filename << " for writing";
+  offset_ = 0;
+  entries_.clear();
+  num_merged_ = 0;
+  merging_ = false;
+  // the header is written by Close(); reserve the first page for it
+  GraphArchiveHeader header;
+  memset(&header, 0, sizeof(header));
+  WriteBytes(&header, sizeof(header));
+  Pad(PageSize());
+}
+
+void GraphArchiveWriter::OpenForMerge(const std::string &filename) {
+  KALDI_ASSERT(file_ == NULL);
+  if (access(filename.c_str(), F_OK) != 0) {
+    Open(filename);
+    return;
+  }
+  filename_ = filename;
+  entries_.clear();
+  {
+    GraphArchiveReader reader;
+    reader.Open(filename);  // checks the format
+    for (int64 i = 0; i < reader.NumGraphs(); i++)
+      entries_.push_back(std::make_pair(reader.Key(i), reader.Entry(i)));
+  }
+  num_merged_ = entries_.size();
+  merging_ = true;
+  // The graphs are appended after the old keys and index, which stay valid
+  // until the header is rewritten
+  file_ = fopen(filename.c_str(), "r+b");
+  if (file_ == NULL || fseek(file_, 0, SEEK_END) != 0 ||
+      (offset_ = ftell(file_)) < 0)
+    KALDI_ERR << "Could not open graph archive " << filename << " for writing";
+}
+
+void GraphArchiveWriter::Write(const std::string &key,
+                               const fst::ExpandedFst<fst::StdArc> &fst) {
+  typedef fst::StdArc Arc;
+  KALDI_ASSERT(file_ != NULL);
+
+  states_.resize(fst.NumStates());
+  arcs_.clear();
+  for (Arc::StateId s = 0; s < fst.NumStates(); s++) {
+    MappedGraphState &state = states_[s];
+    state.final = fst.Final(s).Value();
+    state.first_arc = arcs_.size();
+    state.num_iepsilons = state.num_oepsilons = 0;
+    for (fst::ArcIterator<fst::ExpandedFst<Arc> > aiter(fst, s);
+         !aiter.Done(); aiter.Next()) {
+      const Arc &arc = aiter.Value();
+      if (arc.ilabel == 0) state.num_iepsilons++;
+      if (arc.olabel == 0) state.num_oepsilons++;
+      arcs_.push_back(arc);
+    }
+    state.num_arcs = arcs_.size() - state.first_arc;
+  }
+
+  GraphArchiveEntry entry;
+  memset(&entry, 0, sizeof(entry));
+  entry.start = fst.Start();
+  entry.num_states = states_.size();
+  entry.num_arcs = arcs_.size();
+  entry.properties = fst.Properties(fst::kCopyProperties, false);
+  entry.key_size = key.size();
+
+  Pad(16);
+  entry.states_offset = offset_;
+  WriteBytes(states_.empty() ? NULL : &states_[0],
+             states_.size() * sizeof(MappedGraphState));
+  Pad(16);
+  entry.arcs_offset = offset_;
+  WriteBytes(arcs_.empty() ? NULL : &arcs_[0], arcs_.size() * sizeof(Arc));
+
+  entries_.push_back(std::make_pair(key, entry));
+}
+
+void GraphArchiveWriter::Close() {
+  KALDI_ASSERT(file_ != NULL);
+  if (num_merged_ > 0) {
+    // drop the old graphs that have been written again
+    std::vector<std::string> new_keys;
+    for (size_t i = num_merged_; i < entries_.size(); i++)
+      new_keys.push_back(entries_[i].first);
+    std::sort(new_keys.begin(), new_keys.end());
+    size_t num_kept = 0;
+    for (size_t i = 0; i < num_merged_; i++)
+      if (!std::binary_search(new_keys.begin(), new_keys.end(),
+                              entries_[i].first))
+        entries_[num_kept++] = entries_[i];
+    KALDI_LOG << "Graph archive " << filename_ << ": kept " << num_kept
+              << " graphs, replaced " << (num_merged_ - num_kept)
+              << ", added " << (new_keys.size() - (num_merged_ - num_kept));
+    entries_.erase(entries_.begin() + num_kept,
+                   entries_.begin() + num_merged_);
+    num_merged_ = 0;
+  }
+  std::sort(entries_.begin(), entries_.end(), EntryKeyLess);
+
+  GraphArchiveHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, kGraphArchiveMagic, sizeof(header.magic));
+  header.version = kGraphArchiveVersion;
+  header.arc_size = sizeof(fst::StdArc);
+  header.byte_order = kGraphArchiveByteOrder;
+  header.page_size = PageSize();
+  header.num_graphs = entries_.size();
+
+  Pad(header.page_size);
+  header.keys_offset = offset_;
+  for (size_t i = 0; i < entries_.size(); i++) {
+    if (i > 0 && entries_[i].first == entries_[i - 1].first)
+      KALDI_ERR << "Duplicate key " << entries_[i].first << " in graph archive "
+                << filename_;
+    entries_[i].second.key_offset = offset_ - header.keys_offset;
+    WriteBytes(entries_[i].first.data(), entries_[i].first.size());
+  }
+  header.keys_size = offset_ - header.keys_offset;
+
+  Pad(header.page_size);
+  header.index_offset = offset_;
+  int64 used_size = 0;  // the graph data still indexed
+  for (size_t i = 0; i < entries_.size(); i++) {
+    const GraphArchiveEntry &entry = entries_[i].second;
+    WriteBytes(&entry, sizeof(GraphArchiveEntry));
+    used_size += entry.num_states * sizeof(MappedGraphState) +
+        entry.num_arcs * sizeof(fst::StdArc);
+  }
+
+  // The graphs, keys and index must be on disk before the header that points
+  // to them, or a crash could leave a merged archive with a header pointing
+  // to data that was never written.
+  if (fflush(file_) != 0 || fsync(fileno(file_)) != 0 ||
+      fseek(file_, 0, SEEK_SET) != 0 ||
+      fwrite(&header, sizeof(header), 1, file_) != 1 ||
+      fflush(file_) != 0 || fsync(fileno(file_)) != 0 || fclose(file_) != 0)
+    KALDI_ERR << "Error writing graph archive " << filename_;
+  file_ = NULL;
+  entries_.clear();
+
+  int64 unused_size = header.keys_offset - header.page_size - used_size;
+  if (merging_ && unused_size > used_size) {
+    KALDI_LOG << "Compacting graph archive " << filename_ << " (" << unused_size
+              << " of " << (used_size + unused_size) << " bytes unused)";
+    Compact(filename_);
+  }
+  merging_ = false;
+}
+
+void GraphArchiveWriter::Compact(const std::string &filename) {
+  std::string tmp_filename = filename + ".tmp";
+  {
+    GraphArchiveReader reader;
+    reader.Open(filename);
+    GraphArchiveWriter writer;
+    writer.Open(tmp_filename);
+    MappedGraphFst fst;
+    for (int64 i = 0; i < reader.NumGraphs(); i++) {
+      reader.Graph(i, &fst);
+      writer.Write(reader.Key(i), fst);
+    }
+    writer.Close();
+  }
+  if (rename(tmp_filename.c_str(), filename.c_str()) != 0)
+    KALDI_ERR << "Could not rename " << tmp_filename << " to " << filename
+              << ": " << strerror(errno);
+}
+
+
+bool GraphArchiveReader::IsGraphArchive(const std::string &filename) {
+  FILE *file = fopen(filename.c_str(), "rb");
+  if (file == NULL)
+    return false;
+  char magic[sizeof(kGraphArchiveMagic)];
+  bool ans = (fread(magic, sizeof(magic), 1, file) == 1 &&
+              memcmp(magic, kGraphArchiveMagic, sizeof(magic)) == 0);
+  fclose(file);
+  return ans;
+}
+
+void GraphArchiveReader::Open(const std::string &filename) {
+  Close();
+  filename_ = filename;
+  int fd = open(filename.c_str(), O_RDONLY);
+  if (fd < 0)
+    KALDI_ERR << "Could not open graph archive " << filename;
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size < (off_t) sizeof(GraphArchiveHeader)) {
+    close(fd);
+    KALDI_ERR << "Invalid graph archive " << filename;
+  }
+  void *data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);  // the mapping stays valid
+  if (data == MAP_FAILED)
+    KALDI_ERR << "Could not mmap graph archive " << filename;
+  data_ = static_cast<char*>(data);
+  size_ = st.st_size;
+  // The graphs are usually accessed in no particular order
+  madvise(data_, size_, MADV_RANDOM);
+
+  header_ = reinterpret_cast<const GraphArchiveHeader*>(data_);
+  if (memcmp(header_->magic, kGraphArchiveMagic, sizeof(header_->magic)) != 0 ||
+      header_->version != kGraphArchiveVersion) {
+    Close();
+    KALDI_ERR << "Not a graph archive(or unsupported version): " << filename;
+  }
+  if (header_->byte_order != kGraphArchiveByteOrder ||
+      header_->arc_size != static_cast<int32>(sizeof(fst::StdArc))) {
+    Close();
+    KALDI_ERR << "Graph archive " << filename << " was written on a machine "
+              << "with a different byte order or arc layout";
+  }
+  int64 size = size_;
+  if (!InRange(header_->keys_offset, header_->keys_size, 1, size) ||
+      !InRange(header_->index_offset, header_->num_graphs,
+               sizeof(GraphArchiveEntry), size) ||
+      header_->index_offset % sizeof(int64) != 0) {
+    Close();
+    KALDI_ERR << "Truncated or corrupt graph archive " << filename;
+  }
+  index_ = reinterpret_cast<const GraphArchiveEntry*>(data_ +
+                                                      header_->index_offset);
+  keys_ = data_ + header_->keys_offset;
+  num_graphs_ = header_->num_graphs;
+
+  // Every entry has to point into the file, so that Key() and Graph() can't
+  // read beyond the mapping. The states' arc ranges are not checked, as that
+  // would read the whole file.
+  for (int64 i = 0; i < num_graphs_; i++) {
+    const GraphArchiveEntry &entry = index_[i];
+    bool ok = InRange(entry.key_offset, entry.key_size, 1,
+                      header_->keys_size) &&
+        InRange(entry.states_offset, entry.num_states,
+                sizeof(MappedGraphState), size) &&
+        InRange(entry.arcs_offset, entry.num_arcs, sizeof(fst::StdArc), size) &&
+        entry.states_offset % sizeof(uint32) == 0 &&
+        entry.arcs_offset % sizeof(float) == 0 &&
+        (entry.start == fst::kNoStateId ||
+         (entry.start >= 0 && entry.start < entry.num_states));
+    if (!ok) {
+      Close();
+      KALDI_ERR << "Corrupt entry " << i << " in graph archive " << filename;
+    }
+  }
+}
+
+void GraphArchiveReader::Close() {
+  if (data_ != NULL)
+    munmap(data_, size_);
+  data_ = NULL;
+  size_ = 0;
+  header_ = NULL;
+  index_ = NULL;
+  keys_ = NULL;
+  num_graphs_ = 0;
+}
+
+void GraphArchiveReader::Graph(int64 i, MappedGraphFst *fst) const {
+  KALDI_ASSERT(i >= 0 && i < NumGraphs());
+  const GraphArchiveEntry &entry = index_[i];
+  fst->Init(reinterpret_cast<const MappedGraphState*>(data_ +
+                                                      entry.states_offset),
+            reinterpret_cast<const fst::StdArc*>(data_ + entry.arcs_offset),
+            entry.start, entry.num_states, entry.properties);
+}
+
+int64 GraphArchiveReader::Find(const std::string &key) const {
+  int64 lo = 0, hi = NumGraphs();
+  while (lo < hi) {  // binary search in the sorted index
+    int64 mid = lo + (hi - lo) / 2;
+    const GraphArchiveEntry &entry = index_[mid];
+    int cmp = key.compare(0, std::string::npos,
+                          keys_ + entry.key_offset, entry.key_size);
+    if (cmp == 0)
+      return mid;
+    if (cmp < 0)
+      hi = mid;
+    else
+      lo = mid + 1;
+  }
+  return -1;
+}
+
+}  // end namespace kaldi
@@ -0,0 +1,255 @@
+// decoder/mapped-graph-archive.h
+
+// Copyright 2012  Vassil Panayotov <vd.panayotov@gmail.com>
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef KALDI_DECODER_MAPPED_GRAPH_ARCHIVE_H_
+#define KALDI_DECODER_MAPPED_GRAPH_ARCHIVE_H_
+
+#include <cstdio>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "base/kaldi-common.h"
+#include "fst/fstlib.h"
+
+namespace kaldi {
+
+// An archive of graphs meant to be mmap()-ed and used in place.
+//
+// Layout (all integers in native byte order; the header records it):
+//   page 0     GraphArchiveHeader
+//   page 1...  the graphs, one after another: an array of MappedGraphState
+//              followed by an array of StdArc(16-byte aligned)
+//   next page  the keys, concatenated(not null-terminated)
+//   next page  an array of GraphArchiveEntry sorted by key
+// As the arcs are stored exactly as fst::StdArc, the arc iterators of
+// MappedGraphFst point directly into the mapped file.
+
+struct GraphArchiveHeader {
+  char magic[8];        // "KVGRAPH\0"
+  int32 version;
+  int32 arc_size;       // sizeof(fst::StdArc)
+  uint32 byte_order;    // kGraphArchiveByteOrder, as written
+  int32 page_size;
+  int64 num_graphs;
+  int64 keys_offset;
+  int64 keys_size;
+  int64 index_offset;
+};
+
+struct GraphArchiveEntry {
+  int64 key_offset;     // relative to the start of the keys
+  int64 states_offset;  // absolute file offsets
+  int64 arcs_offset;
+  uint64 properties;
+  int32 key_size;
+  int32 start;
+  int32 num_states;
+  int32 num_arcs;
+};
+
+struct MappedGraphState {
+  float final;          // the value of the TropicalWeight
+  uint32 first_arc;     // index in the graph's arc array
+  uint32 num_arcs;
+  uint32 num_iepsilons;
+  uint32 num_oepsilons;
+};
+
+
+/// Read-only view of a graph stored in a GraphArchiveReader. It owns nothing:
+/// copying it is cheap and it is valid for as long as the archive is open.
+class MappedGraphFst : public fst::ExpandedFst<fst::StdArc> {
+ public:
+  typedef fst::StdArc Arc;
+  typedef Arc::StateId StateId;
+  typedef Arc::Weight Weight;
+
+  MappedGraphFst(): states_(NULL), arcs_(NULL), start_(fst::kNoStateId),
+                    num_states_(0), properties_(0) {}
+
+  void Init(const MappedGraphState *states, const Arc *arcs,
+            StateId start, StateId num_states, uint64 properties) {
+    states_ = states;
+    arcs_ = arcs;
+    start_ = start;
+    num_states_ = num_states;
+    properties_ = properties;
+  }
+
+  virtual StateId Start() const { return start_; }
+
+  virtual Weight Final(StateId s) const { return Weight(states_[s].final); }
+
+  virtual StateId NumStates() const { return num_states_; }
+
+  virtual size_t NumArcs(StateId s) const { return states_[s].num_arcs; }
+
+  virtual size_t NumInputEpsilons(StateId s) const {
+    return states_[s].num_iepsilons;
+  }
+
+  virtual size_t NumOutputEpsilons(StateId s) const {
+    return states_[s].num_oepsilons;
+  }
+
+  virtual uint64 Properties(uint64 mask, bool test) const {
+    if (test) {
+      uint64 known;
+      return fst::TestProperties(*this, mask, &known) & mask;
+    }
+    return properties_ & mask;
+  }
+
+  virtual const std::string &Type() const {
+    static const std::string type = "mapped-graph";
+    return type;
+  }
+
+  virtual MappedGraphFst *Copy(bool safe = false) const {
+    return new MappedGraphFst(*this);
+  }
+
+  virtual const fst::SymbolTable *InputSymbols() const { return NULL; }
+
+  virtual const fst::SymbolTable *OutputSymbols() const { return NULL; }
+
+  virtual void InitStateIterator(fst::StateIteratorData<Arc> *data) const {
+    data->base = NULL;
+    data->nstates = num_states_;
+  }
+
+  virtual void InitArcIterator(StateId s,
+                               fst::ArcIteratorData<Arc> *data) const {
+    data->base = NULL;
+    data->arcs = arcs_ + states_[s].first_arc;
+    data->narcs = states_[s].num_arcs;
+    data->ref_count = NULL;
+  }
+
+ private:
+  const MappedGraphState *states_;
+  const Arc *arcs_;
+  StateId start_;
+  StateId num_states_;
+  uint64 properties_;
+};
+
+
+/// Writes a graph archive. The output has to be a regular file, as the header
+/// is written last.
+class GraphArchiveWriter {
+ public:
+  GraphArchiveWriter(): file_(NULL), offset_(0), num_merged_(0),
+                        merging_(false) {}
+  ~GraphArchiveWriter();
+
+  void Open(const std::string &filename);
+
+  /// Opens an existing archive to add graphs to it. The new graphs are
+  /// appended and replace the graphs with the same keys; the other graphs are
+  /// neither read nor rewritten. Until Close() rewrites the header the file
+  /// stays a valid copy of the old archive. Creates the archive if it doesn't
+  /// exist. The space of the replaced graphs(and of the old keys and index)
+  /// is not reused, so Close() compacts the archive once more than half of
+  /// its graph data is unused.
+  void OpenForMerge(const std::string &filename);
+
+  void Write(const std::string &key, const fst::ExpandedFst<fst::StdArc> &fst);
+
+  /// Writes the keys, the index and the header. The keys must be unique
+  /// (apart from those replaced in a merge).
+  void Close();
+
+  /// Rewrites an archive with only the graphs it indexes, dropping the space
+  /// left by merges. The new archive is written next to the old one and
+  /// renamed over it, so the readers that have the old one mapped are not
+  /// affected.
+  static void Compact(const std::string &filename);
+
+ private:
+  void WriteBytes(const void *data, size_t size);
+  void Pad(int64 alignment);
+
+  std::string filename_;
+  FILE *file_;
+  int64 offset_;
+  std::vector<std::pair<std::string, GraphArchiveEntry> > entries_;
+  size_t num_merged_;  // the first entries_, from the archive merged into
+  bool merging_;       // opened by OpenForMerge() on an existing archive
+  std::vector<MappedGraphState> states_;  // scratch space for Write()
+  std::vector<fst::StdArc> arcs_;
+};
+
+
+/// Maps a graph archive in memory. The graphs can be accessed in any order
+/// without reading or allocating anything.
+class GraphArchiveReader {
+ public:
+  GraphArchiveReader(): data_(NULL), size_(0), header_(NULL), index_(NULL),
+                        keys_(NULL), num_graphs_(0) {}
+  ~GraphArchiveReader() { Close(); }
+
+  /// Checks the magic string at the start of the file
+  static bool IsGraphArchive(const std::string &filename);
+
+  void Open(const std::string &filename);
+  void Close();
+
+  int64 NumGraphs() const { return num_graphs_; }
+
+  /// The i-th key, in sorted order
+  std::string Key(int64 i) const {
+    return std::string(keys_ + index_[i].key_offset, index_[i].key_size);
+  }
+
+  const GraphArchiveEntry &Entry(int64 i) const {
+    KALDI_ASSERT(i >= 0 && i < NumGraphs());
+    return index_[i];
+  }
+
+  /// Makes "fst" a view of the i-th graph
+  void Graph(int64 i, MappedGraphFst *fst) const;
+
+  /// Returns the index of the graph with this key, or -1
+  int64 Find(const std::string &key) const;
+
+  /// Makes "fst" a view of the graph with this key; returns false if there
+  /// is no such graph.
+  bool Graph(const std::string &key, MappedGraphFst *fst) const {
+    int64 i = Find(key);
+    if (i < 0) return false;
+    Graph(i, fst);
+    return true;
+  }
+
+ private:
+  std::string filename_;
+  char *data_;
+  size_t size_;
+  const GraphArchiveHeader *header_;
+  const GraphArchiveEntry *index_;
+  const char *keys_;
+  // as at Open(): the header may be rewritten by a merge while mapped
+  int64 num_graphs_;
+
+  KALDI_DISALLOW_COPY_AND_ASSIGN(GraphArchiveReader);
+};
+
+}  // end namespace kaldi
+
+#endif  // KALDI_DECODER_MAPPED_GRAPH_ARCHIVE_H_
@@ -0,0 +1,227 @@
+// decoder/training-graph-cache.cc
+
+// Copyright 2012  Vassil Panayotov <vd.panayotov@gmail.com>
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+
+#include "decoder/training-graph-cache.h"
+
+namespace kaldi {
+
+namespace {
+
+// 64-bit FNV-1a
+uint64 HashBytes(const char *data, size_t size, uint64 hash) {
+  for (size_t i = 0; i < size; i++) {
+    hash ^= static_cast<unsigned char>(data[i]);
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+const uint64 kHashInit = 14695981039346656037ULL;
+
+std::string HashToString(uint64 hash) {
+  char buf[17];
+  snprintf(buf, sizeof(buf), "%016llx", static_cast<unsigned long long>(hash));
+  return buf;
+}
+
+void DeleteGraphs(TrainingGraphCache::Graphs *graphs) {
+  for (size_t i = 0; i < graphs->size(); i++)
+    delete (*graphs)[i];
+  graphs->clear();
+}
+
+}  // namespace
+
+std::string TrainingGraphFingerprint(const ContextDependency &ctx_dep,
+                                     const TransitionModel &trans_model,
+                                     const fst::VectorFst<fst::StdArc> &lex_fst,
+                                     const std::vector<int32> &disambig_syms,
+                                     const TrainingGraphCompilerVisOptions &opts,
+                                     int32 num_graphs) {
+  // The objects are hashed in their binary form, so that the fingerprint
+  // doesn't depend on where they were read from. Of the transition model
+  // only the parts that make up the graphs are hashed: the topology and the
+  // (phone, HMM state, pdf) tuples, which define the transition-ids. The
+  // transition probabilities are re-estimated in each training pass, but
+  // they reach the graphs only if they are scaled in, so otherwise the
+  // graphs can be reused across the passes.
+  std::ostringstream os;
+  ctx_dep.Write(os, true);
+  trans_model.GetTopo().Write(os, true);
+  WriteBasicType(os, true, trans_model.NumTransitionStates());
+  for (int32 tstate = 1; tstate <= trans_model.NumTransitionStates();
+       tstate++) {
+    WriteBasicType(os, true, trans_model.TransitionStateToPhone(tstate));
+    WriteBasicType(os, true, trans_model.TransitionStateToHmmState(tstate));
+    WriteBasicType(os, true, trans_model.TransitionStateToPdf(tstate));
+  }
+  WriteBasicType(os, true, trans_model.NumTransitionIds());
+  if (opts.transition_scale != 0.0 || opts.self_loop_scale != 0.0) {
+    for (int32 tid = 1; tid <= trans_model.NumTransitionIds(); tid++)
+      WriteBasicType(os, true, trans_model.GetTransitionLogProb(tid));
+  }
+  lex_fst.Write(os, fst::FstWriteOptions("lexicon"));
+  WriteIntegerVector(os, true, disambig_syms);
+  WriteBasicType(os, true, opts.transition_scale);
+  WriteBasicType(os, true, opts.self_loop_scale);
+  WriteBasicType(os, true, opts.rm_eps);
+  WriteBasicType(os, true, opts.reorder);
+  WriteBasicType(os, true, opts.max_det_states);
+  WriteBasicType(os, true, opts.max_det_mem_mb);
+  WriteToken(os, true, opts.det_fallback);
+  WriteBasicType(os, true, num_graphs);
+  std::string data = os.str();
+  return HashToString(HashBytes(data.data(), data.size(), kHashInit));
+}
+
+TrainingGraphCache::TrainingGraphCache(const std::string &fingerprint,
+                                       const std::string &cache_dir,
+                                       int32 max_entries):
+    max_entries_(max_entries), num_hits_(0), num_disk_hits_(0),
+    num_misses_(0) {
+  if (cache_dir.empty())
+    return;
+  mkdir(cache_dir.c_str(), 0777);
+  dir_ = cache_dir + "/" + fingerprint;
+  if (mkdir(dir_.c_str(), 0777) != 0 && errno != EEXIST) {
+    KALDI_WARN << "Could not create the graph cache directory " << dir_
+               << "; the graphs will be cached in memory only";
+    dir_.clear();
+  }
+}
+
+TrainingGraphCache::~TrainingGraphCache() {
+  std::map<std::vector<int32>, Graphs>::iterator it = entries_.begin();
+  for (; it != entries_.end(); ++it)
+    DeleteGraphs(&it->second);
+}
+
+std::string TrainingGraphCache::CacheFile(
+    const std::vector<int32> &transcript) const {
+  uint64 hash = HashBytes(reinterpret_cast<const char*>(transcript.empty() ?
+                                                        NULL : &transcript[0]),
+                          transcript.size() * sizeof(int32), kHashInit);
+  return dir_ + "/" + HashToString(hash) + ".fsts";
+}
+
+bool TrainingGraphCache::ReadGraphs(const std::string &filename,
+                                    const std::vector<int32> &transcript,
+                                    Graphs *graphs) const {
+  std::ifstream is(filename.c_str(), std::ios::binary);
+  if (!is.good())
+    return false;
+  try {
+    // The transcript is stored too, to guard against hash collisions
+    std::vector<int32> stored;
+    ReadIntegerVector(is, true, &stored);
+    if (stored != transcript)
+      return false;
+    int32 num_graphs;
+    ReadBasicType(is, true, &num_graphs);
+    for (int32 i = 0; i < num_graphs; i++) {
+      fst::VectorFst<fst::StdArc> *graph =
+          fst::VectorFst<fst::StdArc>::Read(is, fst::FstReadOptions(filename));
+      if (graph == NULL) {
+        DeleteGraphs(graphs);
+        return false;
+      }
+      graphs->push_back(graph);
+    }
+  } catch (const std::exception &e) {
+    KALDI_WARN << "Ignoring the corrupted graph cache file " << filename;
+    DeleteGraphs(graphs);
+    return false;
+  }
+  return true;
+}
+
+void TrainingGraphCache::WriteGraphs(const std::string &filename,
+                                     const std::vector<int32> &transcript,
+                                     const Graphs &graphs) const {
+  // Several jobs may share the cache directory, so the file is written
+  // under a temporary name and then renamed.
+  std::ostringstream tmp_name;
+  tmp_name << filename << ".tmp." << getpid();
+  {
+    std::ofstream os(tmp_name.str().c_str(), std::ios::binary);
+    WriteIntegerVector(os, true, transcript);
+    WriteBasicType(os, true, static_cast<int32>(graphs.size()));
+    for (size_t i = 0; i < graphs.size(); i++)
+      graphs[i]->Write(os, fst::FstWriteOptions(filename));
+    if (!os.good()) {
+      KALDI_WARN << "Error writing the graph cache file " << tmp_name.str();
+      unlink(tmp_name.str().c_str());
+      return;
+    }
+  }
+  if (rename(tmp_name.str().c_str(), filename.c_str()) != 0) {
+    KALDI_WARN << "Could not rename " << tmp_name.str() << " to " << filename;
+    unlink(tmp_name.str().c_str());
+  }
+}
+
+void TrainingGraphCache::Retain(const std::vector<int32> &transcript,
+                                const Graphs &graphs) {
+  if (static_cast<int32>(entries_.size()) >= max_entries_ ||
+      entries_.count(transcript) != 0)
+    return;
+  Graphs &copies = entries_[transcript];
+  for (size_t i = 0; i < graphs.size(); i++)
+    copies.push_back(new fst::VectorFst<fst::StdArc>(*graphs[i]));
+}
+
+bool TrainingGraphCache::Lookup(const std::vector<int32> &transcript,
+                                Graphs *graphs) {
+  std::map<std::vector<int32>, Graphs>::iterator it = entries_.find(transcript);
+  if (it != entries_.end()) {
+    num_hits_++;
+    for (size_t i = 0; i < it->second.size(); i++)
+      graphs->push_back(new fst::VectorFst<fst::StdArc>(*it->second[i]));
+    return true;
+  }
+  if (!dir_.empty()) {
+    Graphs read;
+    if (ReadGraphs(CacheFile(transcript), transcript, &read)) {
+      num_disk_hits_++;
+      Retain(transcript, read);
+      graphs->insert(graphs->end(), read.begin(), read.end());
+      return true;
+    }
+  }
+  num_misses_++;
+  return false;
+}
+
+void TrainingGraphCache::Insert(const std::vector<int32> &transcript,
+                                const Graphs &graphs) {
+  for (size_t i = 0; i < graphs.size(); i++)
+    if (graphs[i]->Start() == fst::kNoStateId)
+      return;
+  if (!dir_.empty())
+    WriteGraphs(CacheFile(transcript), transcript, graphs);
+  Retain(transcript, graphs);
+}
+
+}  // end namespace kaldi
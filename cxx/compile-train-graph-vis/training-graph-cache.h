@@ -0,0 +1,94 @@
+// decoder/training-graph-cache.h
+
+// Copyright 2012  Vassil Panayotov <vd.panayotov@gmail.com>
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef KALDI_DECODER_TRAINING_GRAPH_CACHE_H_
+#define KALDI_DECODER_TRAINING_GRAPH_CACHE_H_
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "base/kaldi-common.h"
+#include "hmm/transition-model.h"
+#include "tree/context-dep.h"
+#include "fst/fstlib.h"
+#include "decoder/training-graph-compiler-vis.h"
+
+namespace kaldi {
+
+/// Computes a string identifying everything, besides the transcript, that a
+/// training graph depends on: the tree, the model's topology and transition
+/// states(and its transition probabilities, only if they are scaled into the
+/// graphs), the lexicon, the disambiguation symbols and the compiler options.
+/// "num_graphs" is the number of graphs stored per transcript (see
+/// TrainingGraphCache).
+/// Must be called before the lexicon is handed to TrainingGraphCompilerVis.
+std::string TrainingGraphFingerprint(const ContextDependency &ctx_dep,
+                                     const TransitionModel &trans_model,
+                                     const fst::VectorFst<fst::StdArc> &lex_fst,
+                                     const std::vector<int32> &disambig_syms,
+                                     const TrainingGraphCompilerVisOptions &opts,
+                                     int32 num_graphs);
+
+/// Content-addressed cache of compiled training graphs, keyed by the word
+/// sequence of the transcript. For each transcript a fixed number of graphs
+/// is stored (e.g. just the final graph, or also the intermediate LG, CLG
+/// and HCLG graphs). The graphs are kept in memory(up to "max_entries"
+/// transcripts) and, if "cache_dir" is not empty, also in files under
+/// <cache-dir>/<fingerprint>/, so that they can be reused by later runs for
+/// as long as the fingerprint stays the same.
+class TrainingGraphCache {
+ public:
+  typedef std::vector<fst::VectorFst<fst::StdArc>*> Graphs;
+
+  TrainingGraphCache(const std::string &fingerprint,
+                     const std::string &cache_dir,
+                     int32 max_entries);
+
+  ~TrainingGraphCache();
+
+  /// Appends to "graphs" copies of the graphs for this transcript, which the
+  /// caller has to delete. Returns false if the transcript is not cached.
+  /// (VectorFst copies share the data until modified, so they are cheap.)
+  bool Lookup(const std::vector<int32> &transcript, Graphs *graphs);
+
+  /// Adds copies of the graphs of a transcript. Empty graphs(i.e. failed
+  /// compilations) are not cached.
+  void Insert(const std::vector<int32> &transcript, const Graphs &graphs);
+
+  int64 NumHits() const { return num_hits_; }
+  int64 NumDiskHits() const { return num_disk_hits_; }
+  int64 NumMisses() const { return num_misses_; }
+
+ private:
+  std::string CacheFile(const std::vector<int32> &transcript) const;
+  bool ReadGraphs(const std::string &filename,
+                  const std::vector<int32> &transcript, Graphs *graphs) const;
+  void WriteGraphs(const std::string &filename,
+                   const std::vector<int32> &transcript,
+                   const Graphs &graphs) const;
+  void Retain(const std::vector<int32> &transcript, const Graphs &graphs);
+
+  std::string dir_;  // <cache-dir>/<fingerprint>, or empty
+  int32 max_entries_;
+  std::map<std::vector<int32>, Graphs> entries_;
+  int64 num_hits_, num_disk_hits_, num_misses_;
+};
+
+}  // end namespace kaldi
+
+#endif  // KALDI_DECODER_TRAINING_GRAPH_CACHE_H_
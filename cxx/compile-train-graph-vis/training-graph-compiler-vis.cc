@@ -14,11 +14,245 @@
 // See the Apache 2 License for the specific language governing permissions and
 // limitations under the License.
 
+#include <unistd.h>
+#include <algorithm>
+#include <cstdio>
+#include <limits>
+#include <map>
+
 #include "decoder/training-graph-compiler-vis.h"
 #include "hmm/hmm-utils.h" // for GetHTransducer
 
 namespace kaldi {
 
+void Log2Histogram::Add(double value) {
+  size_t bucket = 0;
+  for (double bound = 1.0; value >= bound; bound *= 2.0)
+    bucket++;
+  if (bucket >= counts_.size())
+    counts_.resize(bucket + 1, 0);
+  counts_[bucket]++;
+}
+
+void Log2Histogram::Write(std::ostream &os) const {
+  for (size_t i = 0; i < counts_.size(); i++) {
+    if (counts_[i] == 0) continue;
+    if (i == 0)
+      os << " [0,1):" << counts_[i];
+    else
+      os << " [" << (1LL << (i - 1)) << ',' << (1LL << i) << "):" << counts_[i];
+  }
+  os << '\n';
+}
+
+const char *TrainingGraphCompilerVisStats::StageName(int32 stage) {
+  static const char *names[] = { "lex-compose", "context-compose",
+                                 "prefix-split", "h-transducer", "h-compose", "determinize",
+                                 "minimize", "self-loops" };
+  KALDI_ASSERT(stage >= 0 && stage < kNumStages);
+  return names[stage];
+}
+
+TrainingGraphCompilerVisStats::TrainingGraphCompilerVisStats(
+    std::ostream *records_os, bool collect_sizes):
+    records_os_(records_os), collect_sizes_(collect_sizes), batch_offset_(0),
+    stages_(kNumStages) { }
+
+void TrainingGraphCompilerVisStats::StartBatch(
+    const std::vector<std::string> &keys) {
+  batch_offset_ += keys_.size();
+  keys_ = keys;
+}
+
+std::string TrainingGraphCompilerVisStats::UttKey(int32 utt) const {
+  if (utt < 0)
+    return "-";
+  if (static_cast<size_t>(utt) < keys_.size())
+    return keys_[utt];
+  std::ostringstream oss; // no keys given: use the utterance number
+  oss << (batch_offset_ + utt);
+  return oss.str();
+}
+
+void TrainingGraphCompilerVisStats::Record(int32 utt, Stage stage,
+                                           double seconds,
+                                           const fst::Fst<fst::StdArc> *fst) {
+  using fst::StdArc;
+  int64 num_states = 0, num_arcs = 0;
+  if (fst != NULL && collect_sizes_) {
+    if (records_os_ == NULL && fst->Properties(fst::kExpanded, false)) {
+      // only the number of states is needed(for the summary)
+      num_states = static_cast<const fst::ExpandedFst<StdArc>*>(fst)->
+          NumStates();
+    } else {
+      for (fst::StateIterator<fst::Fst<StdArc> > siter(*fst);
+           !siter.Done(); siter.Next()) {
+        num_states++;
+        num_arcs += fst->NumArcs(siter.Value());
+      }
+    }
+  }
+
+  std::string key = UttKey(utt);
+  StageStats &st = stages_[stage];
+  st.count++;
+  st.total_time += seconds;
+  if (seconds > st.max_time) {
+    st.max_time = seconds;
+    st.max_time_key = key;
+  }
+  if (num_states > st.max_states) {
+    st.max_states = num_states;
+    st.max_states_key = key;
+  }
+  st.time_ms_hist.Add(seconds * 1000.0);
+  st.states_hist.Add(num_states);
+
+  if (records_os_ != NULL)
+    *records_os_ << key << ' ' << StageName(stage) << ' ' << seconds << ' '
+                 << num_states << ' ' << num_arcs << ' ' << CurrentRssKb()
+                 << '\n';
+}
+
+int64 TrainingGraphCompilerVisStats::CurrentRssKb() {
+  // ru_maxrss would be the peak of the whole run so far, not the memory in
+  // use after this stage
+  FILE *statm = fopen("/proc/self/statm", "r");
+  if (statm == NULL)
+    return -1;
+  long size, resident;
+  int n = fscanf(statm, "%ld %ld", &size, &resident);
+  fclose(statm);
+  if (n != 2)
+    return -1;
+  return static_cast<int64>(resident) * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+void TrainingGraphCompilerVisStats::WriteSummary(std::ostream &os) const {
+  double total = 0.0;
+  for (int32 i = 0; i < kNumStages; i++)
+    total += stages_[i].total_time;
+  for (int32 i = 0; i < kNumStages; i++) {
+    const StageStats &st = stages_[i];
+    if (st.count == 0) continue;
+    os << StageName(i) << ": count " << st.count
+       << ", total " << st.total_time << " sec. ("
+       << (total > 0 ? 100.0 * st.total_time / total : 0.0) << "%)"
+       << ", max " << st.max_time << " sec. (" << st.max_time_key << ")"
+       << ", max states " << st.max_states << " (" << st.max_states_key
+       << ")\n";
+    os << "  time(ms):";
+    st.time_ms_hist.Write(os);
+    os << "  states:";
+    st.states_hist.Write(os);
+  }
+}
+
+
+LexiconFragments::LexiconFragments(
+    const fst::VectorFst<fst::StdArc> &lex_fst): lex_fst_(lex_fst) {
+  using namespace fst;
+  for (StateIterator<VectorFst<StdArc> > siter(lex_fst); !siter.Done();
+       siter.Next()) {
+    StateId s = siter.Value();
+    for (ArcIterator<VectorFst<StdArc> > aiter(lex_fst, s); !aiter.Done();
+         aiter.Next())
+      if (aiter.Value().olabel != 0)
+        word_arcs_[aiter.Value().olabel].push_back(
+            std::make_pair(s, aiter.Value()));
+  }
+}
+
+const LexiconFragments::Fragment &LexiconFragments::GetFragment(
+    const std::vector<StateId> &entries) {
+  using namespace fst;
+  std::map<std::vector<StateId>, Fragment>::iterator it =
+      fragments_.find(entries);
+  if (it != fragments_.end())
+    return it->second;
+
+  Fragment &frag = fragments_[entries];
+  for (size_t i = 0; i < entries.size(); i++) {
+    frag.index[entries[i]] = i;
+    frag.states.push_back(entries[i]);
+  }
+  // the closure over the arcs without words(the arcs are added in the
+  // order the states are visited)
+  for (size_t i = 0; i < frag.states.size(); i++) {
+    for (ArcIterator<VectorFst<StdArc> > aiter(lex_fst_, frag.states[i]);
+         !aiter.Done(); aiter.Next()) {
+      StdArc arc = aiter.Value();
+      if (arc.olabel != 0) continue;
+      std::map<StateId, int32>::iterator next = frag.index.find(arc.nextstate);
+      if (next == frag.index.end()) {
+        next = frag.index.insert(std::make_pair(arc.nextstate,
+                                                frag.states.size())).first;
+        frag.states.push_back(arc.nextstate);
+      }
+      arc.nextstate = next->second;
+      frag.arcs.push_back(std::make_pair(i, arc));
+    }
+  }
+  return frag;
+}
+
+void LexiconFragments::Compose(const std::vector<int32> &transcript,
+                               fst::VectorFst<fst::StdArc> *ofst) {
+  using namespace fst;
+  ofst->DeleteStates();
+  if (lex_fst_.Start() == kNoStateId)
+    return;
+
+  std::vector<StateId> entries(1, lex_fst_.Start());
+  // the arcs into the current fragment: (state in ofst, arc to a state of L)
+  std::vector<std::pair<StateId, StdArc> > incoming;
+  for (size_t j = 0; ; j++) {
+    const Fragment &frag = GetFragment(entries);
+    StateId base = ofst->NumStates();
+    for (size_t i = 0; i < frag.states.size(); i++)
+      ofst->AddState();
+    if (j == 0)
+      ofst->SetStart(base);
+    for (size_t i = 0; i < incoming.size(); i++) {
+      StdArc arc = incoming[i].second;
+      arc.nextstate = base + frag.index.find(arc.nextstate)->second;
+      ofst->AddArc(incoming[i].first, arc);
+    }
+    for (size_t i = 0; i < frag.arcs.size(); i++) {
+      StdArc arc = frag.arcs[i].second;
+      arc.nextstate += base;
+      ofst->AddArc(base + frag.arcs[i].first, arc);
+    }
+
+    if (j == transcript.size()) {
+      for (size_t i = 0; i < frag.states.size(); i++)
+        ofst->SetFinal(base + i, lex_fst_.Final(frag.states[i]));
+      break;
+    }
+
+    // the arcs for the next word, leaving this fragment
+    incoming.clear();
+    entries.clear();
+    std::map<int32, std::vector<std::pair<StateId, StdArc> > >::const_iterator
+        word_it = word_arcs_.find(transcript[j]);
+    if (word_it == word_arcs_.end())
+      break;  // the word is not in the lexicon: no successful path
+    const std::vector<std::pair<StateId, StdArc> > &word_arcs = word_it->second;
+    for (size_t i = 0; i < word_arcs.size(); i++) {
+      std::map<StateId, int32>::const_iterator src =
+          frag.index.find(word_arcs[i].first);
+      if (src == frag.index.end()) continue;
+      incoming.push_back(std::make_pair(base + src->second,
+                                        word_arcs[i].second));
+      entries.push_back(word_arcs[i].second.nextstate);
+    }
+    if (entries.empty())
+      break;
+    SortAndUniq(&entries);
+  }
+  Connect(ofst);
+}
+
 
 TrainingGraphCompilerVis::TrainingGraphCompilerVis(const TransitionModel &trans_model,
                                              const ContextDependency &ctx_dep,  // Does not maintain reference to this.
@@ -26,8 +260,12 @@ TrainingGraphCompilerVis::TrainingGraphCompilerVis(const TransitionModel &trans_
                                              const std::vector<int32> &disambig_syms,
                                              const TrainingGraphCompilerVisOptions &opts):
     trans_model_(trans_model), ctx_dep_(ctx_dep), lex_fst_(lex_fst),
-    disambig_syms_(disambig_syms), opts_(opts) {
+    disambig_syms_(disambig_syms), opts_(opts), stats_(NULL),
+    num_det_failures_(0), num_shared_states_(0), num_split_states_(0),
+    fragments_(NULL), lazy_cfst_(NULL), lazy_h_(NULL), lazy_h_ilabels_(0) {
   using namespace fst;
+  if (opts_.det_fallback != "skip" && opts_.det_fallback != "rmeps")
+    KALDI_ERR << "Invalid --det-fallback option: " << opts_.det_fallback;
   const std::vector<int32> &phone_syms = trans_model_.GetPhones();  // needed to create context fst.
 
   assert(!phone_syms.empty());
@@ -56,6 +294,324 @@ TrainingGraphCompilerVis::TrainingGraphCompilerVis(const TransitionModel &trans_
     fst::OLabelCompare<fst::StdArc> olabel_comp;
     fst::ArcSort(lex_fst_, olabel_comp);
   }
+
+  if (opts_.word_fragments)
+    fragments_ = new LexiconFragments(*lex_fst_);
+}
+
+TrainingGraphCompilerVis::~TrainingGraphCompilerVis() {
+  delete lazy_h_;
+  delete lazy_cfst_;
+  delete fragments_;
+  delete lex_fst_;
+}
+
+void TrainingGraphCompilerVis::ExtendLazyH() {
+  using namespace fst;
+  typedef StdArc::StateId StateId;
+  const std::vector<std::vector<int32> > &ilabel_info = lazy_cfst_->ILabelInfo();
+  if (lazy_h_ == NULL) {
+    lazy_h_ = new VectorFst<StdArc>();
+    StateId hub = lazy_h_->AddState();
+    lazy_h_->SetStart(hub);
+    lazy_h_->SetFinal(hub, StdArc::Weight::One());
+    lazy_h_ilabels_ = 1;  // 0 is epsilon
+  }
+  if (lazy_h_ilabels_ == ilabel_info.size())
+    return;
+
+  StateId hub = lazy_h_->Start();
+  for (size_t j = lazy_h_ilabels_; j < ilabel_info.size(); j++) {
+    const std::vector<int32> &phone_window = ilabel_info[j];
+    if (phone_window.empty())
+      continue;  // epsilon
+    if (phone_window.size() == 1 && phone_window[0] <= 0) {
+      // disambiguation symbol: removed from the input, as in CompileGraph
+      lazy_h_->AddArc(hub, StdArc(0, j, StdArc::Weight::One(), hub));
+      continue;
+    }
+    // The HMM(with its self-loops) is entered from the hub by an arc with
+    // the context-dependent phone on the output, and its final states lead
+    // back to the hub.
+    VectorFst<StdArc> *hmm = GetHmmAsFstSimple(phone_window, ctx_dep_,
+                                               trans_model_,
+                                               opts_.transition_scale);
+    StateId offset = lazy_h_->NumStates();
+    for (StateId s = 0; s < hmm->NumStates(); s++)
+      lazy_h_->AddState();
+    lazy_h_->AddArc(hub, StdArc(0, j, StdArc::Weight::One(),
+                                offset + hmm->Start()));
+    for (StateId s = 0; s < hmm->NumStates(); s++) {
+      for (ArcIterator<VectorFst<StdArc> > aiter(*hmm, s); !aiter.Done();
+           aiter.Next()) {
+        StdArc arc = aiter.Value();
+        arc.nextstate += offset;
+        lazy_h_->AddArc(offset + s, arc);
+      }
+      if (hmm->Final(s) != StdArc::Weight::Zero())
+        lazy_h_->AddArc(offset + s, StdArc(0, 0, hmm->Final(s), hub));
+    }
+    delete hmm;
+  }
+  lazy_h_ilabels_ = ilabel_info.size();
+  ArcSort(lazy_h_, OLabelCompare<StdArc>());
+}
+
+bool TrainingGraphCompilerVis::CompileLazyGraph(
+    const std::vector<int32> &transcript,
+    LazyTrainingGraph *graph) {
+  using namespace fst;
+  delete graph->hclg_;
+  graph->hclg_ = NULL;
+
+  if (lazy_cfst_ == NULL) {
+    const std::vector<int32> &phone_syms = trans_model_.GetPhones();
+    int32 subseq_symbol = phone_syms.back() + 1;
+    if (!disambig_syms_.empty() && subseq_symbol <= disambig_syms_.back())
+      subseq_symbol = 1 + disambig_syms_.back();
+    lazy_cfst_ = new ContextFst<StdArc>(subseq_symbol,
+                                        phone_syms,
+                                        disambig_syms_,
+                                        ctx_dep_.ContextWidth(),
+                                        ctx_dep_.CentralPosition());
+  }
+
+  VectorFst<StdArc> word_fst;
+  MakeLinearAcceptor(transcript, &word_fst);
+  VectorFst<StdArc> phone2word_fst;
+  ComposeLexicon(word_fst, &phone2word_fst);
+  if (phone2word_fst.Start() == kNoStateId)
+    return false;
+  VectorFst<StdArc> ctx2word_fst;
+  ComposeContextFst(*lazy_cfst_, phone2word_fst, &ctx2word_fst);
+  if (ctx2word_fst.Start() == kNoStateId)
+    return false;
+  ArcSort(&ctx2word_fst, ILabelCompare<StdArc>());
+
+  // C may have new input labels, for which H needs the HMMs. (The graphs
+  // compiled earlier keep their copy of H.)
+  ExtendLazyH();
+
+  ComposeFstOptions<StdArc> copts(CacheOptions(true, graph->cache_bytes_));
+  graph->hclg_ = new ComposeFst<StdArc>(*lazy_h_, ctx2word_fst, copts);
+  return true;
+}
+
+void TrainingGraphCompilerVis::ComposeLexicon(
+    const fst::VectorFst<fst::StdArc> &word_fst,
+    fst::VectorFst<fst::StdArc> *phone2word_fst) {
+  using namespace fst;
+  if (fragments_ != NULL) {
+    std::vector<int32> ilabels, olabels;
+    StdArc::Weight weight;
+    if (GetLinearSymbolSequence(word_fst, &ilabels, &olabels, &weight) &&
+        ilabels == olabels && weight == StdArc::Weight::One()) {
+      fragments_->Compose(olabels, phone2word_fst);
+      return;
+    }
+  }
+  // TableCompose more efficient than compose.
+  TableCompose(*lex_fst_, word_fst, phone2word_fst, &lex_cache_);
+}
+
+bool TrainingGraphCompilerVis::DeterminizeGuarded(
+    const std::vector<int32> &disambig_syms_h,
+    fst::VectorFst<fst::StdArc> *fst,
+    bool *determinized) {
+  using namespace fst;
+  bool keep_input = (opts_.det_fallback == "rmeps");
+
+  // This is DeterminizeStarInLog, unrolled so that the input survives a
+  // failure without having to be copied. When it is not needed for the
+  // fallback it is freed before determinizing, as DeterminizeStarInLog does.
+  ArcSort(fst, ILabelCompare<StdArc>());
+  VectorFst<LogArc> *fst_log = new VectorFst<LogArc>;
+  Cast(*fst, fst_log);
+  if (!keep_input)
+    fst->DeleteStates();
+
+  // The memory limit is turned into a limit on the states of the output.
+  // Each output state is charged for its arcs and for the subset of input
+  // states it stands for in the determinizer(about as many entries as the
+  // fan-out of the input), plus the fixed overhead of a state and its hash
+  // entry, so this is only an estimate.
+  int32 max_states = opts_.max_det_states;
+  if (opts_.max_det_mem_mb > 0) {
+    int64 num_states = fst_log->NumStates(), num_arcs = 0;
+    for (StateIterator<VectorFst<LogArc> > siter(*fst_log);
+         !siter.Done(); siter.Next())
+      num_arcs += fst_log->NumArcs(siter.Value());
+    double fan_out = num_arcs / std::max(static_cast<double>(num_states), 1.0);
+    double state_bytes = 128.0 + 2.0 * (fan_out + 1.0) * sizeof(LogArc);
+    double mem_states = std::max(1.0,
+        opts_.max_det_mem_mb * 1048576.0 / state_bytes);
+    if (mem_states < std::numeric_limits<int32>::max() &&
+        (max_states < 0 || mem_states < max_states))
+      max_states = static_cast<int32>(mem_states);
+  }
+
+  *determinized = true;
+  try {
+    // Epsilon-removal and determinization combined. This will fail if not
+    // determinizable.
+    VectorFst<LogArc> det_log;
+    DeterminizeStar(*fst_log, &det_log, kDelta, NULL, max_states);
+    delete fst_log;
+    fst_log = NULL;
+    Cast(det_log, fst);
+  } catch (const std::exception &e) {
+    // either the state limit was reached or we ran out of memory
+    delete fst_log;
+    *determinized = false;
+    num_det_failures_++;
+    KALDI_WARN << "Determinization failed (" << e.what() << "); "
+               << (keep_input ? "keeping the non-deterministic graph" :
+                   "skipping the utterance");
+    if (!keep_input)
+      return false;  // "fst" is already empty
+  }
+
+  if (!disambig_syms_h.empty()) {
+    RemoveSomeInputSymbols(disambig_syms_h, fst);
+    // we elect not to remove epsilons after this phase, as it is
+    // a little slow.
+    if (opts_.rm_eps && *determinized)
+      RemoveEpsLocal(fst);
+  }
+  if (!*determinized)
+    RmEpsilon(fst);
+  return true;
+}
+
+void TrainingGraphCompilerVis::ComposeSharedPrefixes(
+    const std::vector<std::vector<int32> > &transcripts,
+    fst::ContextFst<fst::StdArc> *cfst,
+    std::vector<fst::VectorFst<fst::StdArc>* > *ctx_fsts) {
+  using namespace fst;
+  typedef StdArc::StateId StateId;
+  typedef TrainingGraphCompilerVisStats Stats;
+  Timer timer;
+
+  // Build the prefix tree: node 0 is the root, and "ends[i]" is the node
+  // at which the i-th transcript ends.
+  VectorFst<StdArc> trie;
+  std::map<std::pair<int32, int32>, int32> children;  // (node, word) -> node
+  std::vector<int32> ends(transcripts.size());
+  trie.AddState();
+  trie.SetStart(0);
+  for (size_t i = 0; i < transcripts.size(); i++) {
+    int32 node = 0;
+    for (size_t j = 0; j < transcripts[i].size(); j++) {
+      std::pair<int32, int32> edge(node, transcripts[i][j]);
+      std::map<std::pair<int32, int32>, int32>::const_iterator it =
+          children.find(edge);
+      if (it == children.end()) {
+        int32 child = trie.AddState();
+        trie.AddArc(node, StdArc(edge.second, edge.second,
+                                 StdArc::Weight::One(), child));
+        children[edge] = child;
+        node = child;
+      } else {
+        node = it->second;
+      }
+    }
+    trie.SetFinal(node, StdArc::Weight::One());
+    ends[i] = node;
+  }
+  ArcSort(&trie, ILabelCompare<StdArc>());
+
+  VectorFst<StdArc> phone2word_fst;
+  TableCompose(*lex_fst_, trie, &phone2word_fst, &lex_cache_);
+  RecordStage(-1, Stats::kLexCompose, &timer, &phone2word_fst);
+  VectorFst<StdArc> ctx2word_fst;
+  ComposeContextFst(*cfst, phone2word_fst, &ctx2word_fst);
+  RecordStage(-1, Stats::kContextCompose, &timer, &ctx2word_fst);
+  assert(ctx2word_fst.Start() != kNoStateId);
+
+  // Find the trie node of each state of the composition. It only changes
+  // along the arcs with words on the output, since the words come from the
+  // trie, which is deterministic.
+  StateId num_states = ctx2word_fst.NumStates();
+  std::vector<int32> node_of(num_states, -1);
+  std::vector<std::vector<StateId> > states_of(trie.NumStates());
+  std::vector<StateId> queue;
+  node_of[ctx2word_fst.Start()] = 0;
+  queue.push_back(ctx2word_fst.Start());
+  while (!queue.empty()) {
+    StateId s = queue.back();
+    queue.pop_back();
+    states_of[node_of[s]].push_back(s);
+    for (ArcIterator<VectorFst<StdArc> > aiter(ctx2word_fst, s);
+         !aiter.Done(); aiter.Next()) {
+      const StdArc &arc = aiter.Value();
+      if (node_of[arc.nextstate] != -1) continue;
+      if (arc.olabel == 0) {
+        node_of[arc.nextstate] = node_of[s];
+      } else {
+        std::map<std::pair<int32, int32>, int32>::const_iterator it =
+            children.find(std::make_pair(node_of[s], arc.olabel));
+        KALDI_ASSERT(it != children.end());
+        node_of[arc.nextstate] = it->second;
+      }
+      queue.push_back(arc.nextstate);
+    }
+  }
+  num_shared_states_ += num_states;
+
+  // Split out the graph of each transcript: the states on the trie path of
+  // the transcript, the arcs between them, and final weights only at the end
+  // of the path.
+  std::vector<int32> pos_of_node(trie.NumStates(), -1);
+  std::vector<StateId> state_map(num_states, kNoStateId);
+  int64 num_split = 0;
+  ctx_fsts->resize(transcripts.size(), NULL);
+  for (size_t i = 0; i < transcripts.size(); i++) {
+    timer.Reset();
+    std::vector<int32> path(1, 0);
+    for (size_t j = 0; j < transcripts[i].size(); j++)
+      path.push_back(children[std::make_pair(path.back(), transcripts[i][j])]);
+    for (size_t j = 0; j < path.size(); j++)
+      pos_of_node[path[j]] = j;
+
+    VectorFst<StdArc> *graph = new VectorFst<StdArc>();
+    for (size_t j = 0; j < path.size(); j++) {
+      const std::vector<StateId> &states = states_of[path[j]];
+      for (size_t k = 0; k < states.size(); k++)
+        state_map[states[k]] = graph->AddState();
+    }
+    for (size_t j = 0; j < path.size(); j++) {
+      const std::vector<StateId> &states = states_of[path[j]];
+      for (size_t k = 0; k < states.size(); k++) {
+        StateId s = states[k];
+        if (path[j] == ends[i])
+          graph->SetFinal(state_map[s], ctx2word_fst.Final(s));
+        for (ArcIterator<VectorFst<StdArc> > aiter(ctx2word_fst, s);
+             !aiter.Done(); aiter.Next()) {
+          StdArc arc = aiter.Value();
+          if (pos_of_node[node_of[arc.nextstate]] < 0)
+            continue;  // leaves the path
+          arc.nextstate = state_map[arc.nextstate];
+          graph->AddArc(state_map[s], arc);
+        }
+      }
+    }
+    graph->SetStart(state_map[ctx2word_fst.Start()]);
+    Connect(graph);
+    num_split += graph->NumStates();
+
+    for (size_t j = 0; j < path.size(); j++) {
+      const std::vector<StateId> &states = states_of[path[j]];
+      for (size_t k = 0; k < states.size(); k++)
+        state_map[states[k]] = kNoStateId;
+      pos_of_node[path[j]] = -1;
+    }
+    (*ctx_fsts)[i] = graph;
+    RecordStage(i, Stats::kPrefixSplit, &timer, graph);
+  }
+  num_split_states_ += num_split;
+  KALDI_VLOG(1) << "Prefix sharing: " << transcripts.size() << " transcripts, "
+                << trie.NumStates() << " trie nodes; composed " << num_states
+                << " states instead of " << num_split;
 }
 
 bool TrainingGraphCompilerVis::CompileGraphFromText(
@@ -79,9 +635,12 @@ bool TrainingGraphCompilerVis::CompileGraph(const fst::VectorFst<fst::StdArc> &w
   assert(lex_fst_ !=NULL);
   assert(out_fst != NULL);
 
+  typedef TrainingGraphCompilerVisStats Stats;
+  Timer timer;
+
   VectorFst<StdArc> &phone2word_fst = *lg_fst;
-  // TableCompose more efficient than compose.
-  TableCompose(*lex_fst_, word_fst, &phone2word_fst, &lex_cache_);
+  ComposeLexicon(word_fst, &phone2word_fst);
+  RecordStage(0, Stats::kLexCompose, &timer, &phone2word_fst);
 
   assert(phone2word_fst.Start() != kNoStateId);
 
@@ -103,6 +662,7 @@ bool TrainingGraphCompilerVis::CompileGraph(const fst::VectorFst<fst::StdArc> &w
   ComposeContextFst(*cfst, phone2word_fst, &ctx2word_fst);
   // ComposeContextFst is like Compose but faster for this particular Fst type.
   // [and doesn't expand too many arcs in the ContextFst.]
+  RecordStage(0, Stats::kContextCompose, &timer, &ctx2word_fst);
 
   assert(ctx2word_fst.Start() != kNoStateId);
 
@@ -116,28 +676,31 @@ bool TrainingGraphCompilerVis::CompileGraph(const fst::VectorFst<fst::StdArc> &w
                                         trans_model_,
                                         h_cfg,
                                         &disambig_syms_h);
+  RecordStage(0, Stats::kHTransducer, &timer, H);
 
   VectorFst<StdArc> &trans2word_fst = *out_fst;  // transition-id to word.
   TableCompose(*H, ctx2word_fst, &trans2word_fst);
+  RecordStage(0, Stats::kHCompose, &timer, &trans2word_fst);
   
   assert(trans2word_fst.Start() != kNoStateId);
 
   *hclg_noloop_fst = *out_fst;
+  timer.Reset();
 
-  // Epsilon-removal and determinization combined. This will fail if not determinizable.
-  DeterminizeStarInLog(&trans2word_fst);
-
-  if (!disambig_syms_h.empty()) {
-    RemoveSomeInputSymbols(disambig_syms_h, &trans2word_fst);
-    // we elect not to remove epsilons after this phase, as it is
-    // a little slow.
-    if (opts_.rm_eps)
-      RemoveEpsLocal(&trans2word_fst);
+  bool determinized;
+  if (!DeterminizeGuarded(disambig_syms_h, &trans2word_fst, &determinized)) {
+    delete H;
+    delete cfst;
+    return false;
   }
+  RecordStage(0, Stats::kDeterminize, &timer, &trans2word_fst);
 
   
-  // Encoded minimization.
-  MinimizeEncoded(&trans2word_fst);
+  // Encoded minimization(only valid for deterministic graphs).
+  if (determinized) {
+    MinimizeEncoded(&trans2word_fst);
+    RecordStage(0, Stats::kMinimize, &timer, &trans2word_fst);
+  }
 
   //*hclg_noloop_fst = *out_fst;
 
@@ -147,6 +710,7 @@ bool TrainingGraphCompilerVis::CompileGraph(const fst::VectorFst<fst::StdArc> &w
                opts_.self_loop_scale,
                opts_.reorder,
                &trans2word_fst);
+  RecordStage(0, Stats::kSelfLoops, &timer, &trans2word_fst);
 
   delete H;
   delete cfst;
@@ -180,6 +744,9 @@ bool TrainingGraphCompilerVis::CompileGraphs(
   out_fsts->resize(word_fsts.size(), NULL);
   if (word_fsts.empty()) return true;
 
+  typedef TrainingGraphCompilerVisStats Stats;
+  Timer timer;
+
   ContextFst<StdArc> *cfst = NULL;
   {  // make cfst [ it's expanded on the fly ]
     const std::vector<int32> &phone_syms = trans_model_.GetPhones();  // needed to create context fst.
@@ -194,60 +761,88 @@ bool TrainingGraphCompilerVis::CompileGraphs(
                                   ctx_dep_.CentralPosition());
   }
 
-  for (size_t i = 0; i < word_fsts.size(); i++) {
+  // Prefix sharing works only with linear, unweighted word FSTs(as produced
+  // by CompileGraphsFromText)
+  std::vector<std::vector<int32> > transcripts;
+  bool share_prefixes = opts_.share_prefixes;
+  for (size_t i = 0; share_prefixes && i < word_fsts.size(); i++) {
+    std::vector<int32> ilabels, olabels;
+    StdArc::Weight weight;
+    if (!GetLinearSymbolSequence(*(word_fsts[i]), &ilabels, &olabels, &weight)
+        || ilabels != olabels || weight != StdArc::Weight::One())
+      share_prefixes = false;
+    transcripts.push_back(olabels);
+  }
+  if (share_prefixes)
+    ComposeSharedPrefixes(transcripts, cfst, out_fsts);
+
+  // The C*L*G graphs are composed directly into the output vector; each
+  // L*G graph is freed as soon as C has been composed with it.
+  for (size_t i = 0; !share_prefixes && i < word_fsts.size(); i++) {
+    timer.Reset();
     VectorFst<StdArc> phone2word_fst;
-    // TableCompose more efficient than compose.
-    TableCompose(*lex_fst_, *(word_fsts[i]), &phone2word_fst, &lex_cache_);
+    ComposeLexicon(*(word_fsts[i]), &phone2word_fst);
+    RecordStage(i, Stats::kLexCompose, &timer, &phone2word_fst);
 
     assert(phone2word_fst.Start() != kNoStateId);
 
-    VectorFst<StdArc> ctx2word_fst;
-    ComposeContextFst(*cfst, phone2word_fst, &ctx2word_fst);
+    // For now the output contains the FST with symbols representing
+    // phones-in-context.
+    VectorFst<StdArc> *ctx2word_fst = new VectorFst<StdArc>();
+    (*out_fsts)[i] = ctx2word_fst;
+    ComposeContextFst(*cfst, phone2word_fst, ctx2word_fst);
     // ComposeContextFst is like Compose but faster for this particular Fst type.
     // [and doesn't expand too many arcs in the ContextFst.]
+    RecordStage(i, Stats::kContextCompose, &timer, ctx2word_fst);
 
-    assert(ctx2word_fst.Start() != kNoStateId);
-
-    (*out_fsts)[i] = ctx2word_fst.Copy();  // For now this contains the FST with symbols
-    // representing phones-in-context.
+    assert(ctx2word_fst->Start() != kNoStateId);
   }
 
   HTransducerConfig h_cfg;
   h_cfg.transition_scale = opts_.transition_scale;
 
   std::vector<int32> disambig_syms_h;
+  timer.Reset();
   VectorFst<StdArc> *H = GetHTransducer(cfst->ILabelInfo(),
                                         ctx_dep_,
                                         trans_model_,
                                         h_cfg,
                                         &disambig_syms_h);
+  RecordStage(-1, Stats::kHTransducer, &timer, H);
 
   for (size_t i = 0; i < out_fsts->size(); i++) {
-    VectorFst<StdArc> &ctx2word_fst = *((*out_fsts)[i]);
-    VectorFst<StdArc> trans2word_fst;
-    TableCompose(*H, ctx2word_fst, &trans2word_fst);
-
-    DeterminizeStarInLog(&trans2word_fst);
-
-    if (!disambig_syms_h.empty()) {
-      RemoveSomeInputSymbols(disambig_syms_h, &trans2word_fst);
-      if (opts_.rm_eps)
-        RemoveEpsLocal(&trans2word_fst);
+    timer.Reset();
+    // The C*L*G graph is freed as soon as it is composed with H, and the
+    // resulting graph is handed over to the output without copying.
+    VectorFst<StdArc> *trans2word_fst = new VectorFst<StdArc>();
+    TableCompose(*H, *((*out_fsts)[i]), trans2word_fst);
+    delete (*out_fsts)[i];
+    (*out_fsts)[i] = trans2word_fst;
+    RecordStage(i, Stats::kHCompose, &timer, trans2word_fst);
+
+    bool determinized;
+    if (!DeterminizeGuarded(disambig_syms_h, trans2word_fst, &determinized)) {
+      // skipped: an empty FST marks the failure and the batch goes on
+      trans2word_fst->DeleteStates();
+      continue;
     }
+    RecordStage(i, Stats::kDeterminize, &timer, trans2word_fst);
     
-    // Encoded minimization.
-    MinimizeEncoded(&trans2word_fst);
+    // Encoded minimization(only valid for deterministic graphs).
+    if (determinized) {
+      MinimizeEncoded(trans2word_fst);
+      RecordStage(i, Stats::kMinimize, &timer, trans2word_fst);
+    }
 
     std::vector<int32> disambig;
     AddSelfLoops(trans_model_,
                  disambig,
                  opts_.self_loop_scale,
                  opts_.reorder,
-                 &trans2word_fst);
-
-    assert(trans2word_fst.Start() != kNoStateId);
+                 trans2word_fst);
+    RecordStage(i, Stats::kSelfLoops, &timer, trans2word_fst);
 
-    *((*out_fsts)[i]) = trans2word_fst;
+    assert(trans2word_fst->Start() != kNoStateId);
   }
 
   delete H;
@@ -17,10 +17,15 @@
 #ifndef KALDI_DECODER_TRAINING_GRAPH_COMPILER_H_
 #define KALDI_DECODER_TRAINING_GRAPH_COMPILER_H_
 
+#include <map>
+#include <utility>
+
 #include "base/kaldi-common.h"
+#include "base/timer.h"
 #include "hmm/transition-model.h"
 #include "fst/fstlib.h"
 #include "fstext/fstext-lib.h"
+#include "util/trace-events.h"
 
 
 namespace kaldi {
@@ -31,6 +36,11 @@ struct TrainingGraphCompilerVisOptions {
   BaseFloat self_loop_scale;
   bool rm_eps;
   bool reorder;  // (Dan-style graphs)
+  int32 max_det_states;  // -1 means no limit
+  int32 max_det_mem_mb;  // -1 means no limit
+  std::string det_fallback;  // "skip" or "rmeps"
+  bool share_prefixes;  // compose L and C with a prefix tree of the batch
+  bool word_fragments;  // assemble L*G from per-word lexicon fragments
 
   explicit TrainingGraphCompilerVisOptions(BaseFloat transition_scale = 1.0,
                                         BaseFloat self_loop_scale = 1.0,
@@ -38,7 +48,12 @@ struct TrainingGraphCompilerVisOptions {
       transition_scale(transition_scale),
       self_loop_scale(self_loop_scale),
       rm_eps(false),
-      reorder(b) { }
+      reorder(b),
+      max_det_states(-1),
+      max_det_mem_mb(-1),
+      det_fallback("skip"),
+      share_prefixes(false),
+      word_fragments(false) { }
 
   void Register(ParseOptions *po) {
     po->Register("transition-scale", &transition_scale, "Scale of transition "
@@ -48,10 +63,178 @@ struct TrainingGraphCompilerVisOptions {
     po->Register("reorder", &reorder, "Reorder transition ids for greater decoding efficiency.");
     po->Register("rm-eps", &rm_eps,  "Remove [most] epsilons before minimization (only applicable "
                  "if disambig symbols present)");
+    po->Register("max-det-states", &max_det_states, "Abort the determinization "
+                 "of an utterance's graph if it produces more than this many "
+                 "states (-1 means no limit)");
+    po->Register("max-mem-mb", &max_det_mem_mb, "Abort the determinization "
+                 "of an utterance's graph when its output would take about "
+                 "this many megabytes(estimated from the fan-out of the "
+                 "input; it lowers --max-det-states accordingly, -1 means "
+                 "no limit)");
+    po->Register("det-fallback", &det_fallback, "What to do if the "
+                 "determinization is aborted or runs out of memory: \"skip\" "
+                 "the utterance, or \"rmeps\" to keep the non-deterministic "
+                 "graph with the epsilons removed");
+    po->Register("share-prefixes", &share_prefixes, "In batch mode, compose "
+                 "the lexicon and the context FST once with a prefix tree of "
+                 "all transcripts in the batch, and split the result into the "
+                 "per-utterance graphs");
+    po->Register("word-fragments", &word_fragments, "Assemble L*G for linear "
+                 "transcripts from precomputed per-word pieces of the lexicon "
+                 "instead of composing");
   }
 };
 
 
+/// Histogram with power-of-two bucket boundaries: bucket 0 counts the
+/// values below 1, and bucket i the values in [2^(i-1), 2^i).
+class Log2Histogram {
+ public:
+  Log2Histogram(): counts_(1, 0) {}
+
+  void Add(double value);
+
+  /// Writes the non-empty buckets on a single line
+  void Write(std::ostream &os) const;
+
+ private:
+  std::vector<int64> counts_;
+};
+
+/// Collects the wall time, the size of the resulting FST and the memory use
+/// after each stage of the training graph compilation, for each utterance.
+/// The per-utterance records can be streamed out as they are produced, and
+/// per-stage totals and histograms are written at the end of the run.
+class TrainingGraphCompilerVisStats {
+ public:
+  enum Stage {
+    kLexCompose = 0,   // TableCompose(L, G)
+    kContextCompose,   // ComposeContextFst(C, LG)
+    kPrefixSplit,      // splitting the shared C*L*prefix-tree (--share-prefixes)
+    kHTransducer,      // GetHTransducer (once per batch in CompileGraphs)
+    kHCompose,         // TableCompose(H, CLG)
+    kDeterminize,      // DeterminizeStarInLog (+ disambiguation symbol removal)
+    kMinimize,         // MinimizeEncoded
+    kSelfLoops,        // AddSelfLoops
+    kNumStages
+  };
+
+  static const char *StageName(int32 stage);
+
+  /// If "records_os" is not NULL, a line is written to it for each
+  /// recorded stage: <utt-key> <stage> <seconds> <#states> <#arcs> <rss-kb>
+  /// (the resident set size of the process after the stage). If
+  /// "collect_sizes" is false the FSTs are not inspected and only the times
+  /// are collected(the sizes are written as 0).
+  explicit TrainingGraphCompilerVisStats(std::ostream *records_os = NULL,
+                                         bool collect_sizes = true);
+
+  /// Sets the keys of the utterances that will be compiled next. The "utt"
+  /// arguments of Record() are indexes in this vector.
+  void StartBatch(const std::vector<std::string> &keys);
+
+  /// Records a finished stage. "utt" < 0 means a stage done once for the whole
+  /// batch(i.e. building H). "fst" is the output of the stage and may be NULL.
+  /// The caller takes the time before calling it, as counting the arcs takes
+  /// time proportional to the size of the FST.
+  void Record(int32 utt, Stage stage, double seconds,
+              const fst::Fst<fst::StdArc> *fst);
+
+  /// Writes the per-stage totals, maxima and histograms
+  void WriteSummary(std::ostream &os) const;
+
+  /// The number of times a stage was recorded and its total time
+  int64 StageCount(int32 stage) const { return stages_[stage].count; }
+  double StageTime(int32 stage) const { return stages_[stage].total_time; }
+
+ private:
+  struct StageStats {
+    int64 count;
+    double total_time;
+    double max_time;
+    std::string max_time_key;
+    int64 max_states;
+    std::string max_states_key;
+    Log2Histogram time_ms_hist;
+    Log2Histogram states_hist;
+    StageStats(): count(0), total_time(0), max_time(0), max_states(0) {}
+  };
+
+  std::string UttKey(int32 utt) const;
+
+  /// The resident set size of the process, or -1 if it is not available
+  static int64 CurrentRssKb();
+
+  std::ostream *records_os_;
+  bool collect_sizes_;
+  std::vector<std::string> keys_;
+  int64 batch_offset_; // the number of utterances in the previous batches
+  std::vector<StageStats> stages_;
+};
+
+
+/// The pieces of a lexicon FST from which L*W can be assembled, for a linear
+/// word acceptor W, without running the composition. The states of L*W at
+/// position j of W are the closure, over the arcs of L with no word on the
+/// output, of the states entered by the arcs for the j-th word. These
+/// closures("fragments") depend only on the entry states(i.e. in practice
+/// on the word), so each is computed once and kept for the next transcripts.
+/// The result is the same as TableCompose(L, W) followed by Connect, up to
+/// the numbering of the states.
+class LexiconFragments {
+ public:
+  typedef fst::StdArc::StateId StateId;
+
+  /// Keeps a reference to "lex_fst", which should not be modified afterwards
+  explicit LexiconFragments(const fst::VectorFst<fst::StdArc> &lex_fst);
+
+  void Compose(const std::vector<int32> &transcript,
+               fst::VectorFst<fst::StdArc> *ofst);
+
+  size_t NumFragments() const { return fragments_.size(); }
+
+ private:
+  struct Fragment {
+    std::vector<StateId> states;  // states of L; the entry states come first
+    std::vector<std::pair<int32, fst::StdArc> > arcs;  // source index, arc
+    // whose "nextstate" is also an index in "states"
+    std::map<StateId, int32> index;  // state of L -> index in "states"
+  };
+
+  /// "entries" must be sorted and unique
+  const Fragment &GetFragment(const std::vector<StateId> &entries);
+
+  const fst::VectorFst<fst::StdArc> &lex_fst_;
+  // the arcs of L with a word on the output, by word: (source state, arc)
+  std::map<int32, std::vector<std::pair<StateId, fst::StdArc> > > word_arcs_;
+  std::map<std::vector<StateId>, Fragment> fragments_;
+};
+
+
+/// A training graph whose H*C*L*G composition is expanded only as far as it
+/// is visited(e.g. by the decoder of an aligner), keeping at most about
+/// "cache_bytes" of expanded states. C*L*G is built in full, as it is small;
+/// H includes the self-loops, so the graph needs no further processing. It is
+/// not determinized or minimized, which doesn't change the best path, and it
+/// corresponds to graphs compiled with --reorder=false.
+class LazyTrainingGraph {
+ public:
+  explicit LazyTrainingGraph(size_t cache_bytes = 32 * 1024 * 1024):
+      cache_bytes_(cache_bytes), hclg_(NULL) {}
+  ~LazyTrainingGraph() { delete hclg_; }
+
+  /// Only valid after a successful TrainingGraphCompilerVis::CompileLazyGraph
+  const fst::Fst<fst::StdArc> &Graph() const { return *hclg_; }
+
+ private:
+  friend class TrainingGraphCompilerVis;
+  size_t cache_bytes_;
+  fst::ComposeFst<fst::StdArc> *hclg_;
+
+  KALDI_DISALLOW_COPY_AND_ASSIGN(LazyTrainingGraph);
+};
+
+
 class TrainingGraphCompilerVis {
  public:
   TrainingGraphCompilerVis(const TransitionModel &trans_model,  // Maintains reference to this object.
@@ -91,10 +274,74 @@ class TrainingGraphCompilerVis {
   bool CompileGraphsFromText(
       const std::vector<std::vector<int32> >  &word_grammar,
       std::vector<fst::VectorFst<fst::StdArc> *> *out_fsts);
+
+  /// Prepares a lazily expanded training graph for the transcript(see
+  /// LazyTrainingGraph). The transition probabilities are scaled by
+  /// opts.transition_scale, the self-loops included.
+  bool CompileLazyGraph(const std::vector<int32> &transcript,
+                        LazyTrainingGraph *graph);
   
   
-  ~TrainingGraphCompilerVis() { delete lex_fst_; }
+  /// Attaches a statistics collector(not owned; NULL disables the collection)
+  void SetStats(TrainingGraphCompilerVisStats *stats) { stats_ = stats; }
+  
+  /// The number of graphs for which the determinization was aborted
+  int32 NumDetFailures() const { return num_det_failures_; }
+
+  /// With --share-prefixes: the number of states of the shared compositions,
+  /// and the total number of states of the per-utterance graphs split from
+  /// them(roughly what composing each utterance separately would build).
+  int64 NumSharedStates() const { return num_shared_states_; }
+  int64 NumSplitStates() const { return num_split_states_; }
+  
+  ~TrainingGraphCompilerVis();
  private:
+  /// Determinizes "fst" and removes the disambiguation symbols, obeying
+  /// opts_.max_det_states and opts_.max_det_mem_mb. If the determinization
+  /// fails "fst" is replaced according to opts_.det_fallback: the function
+  /// returns false if the utterance is to be skipped, and sets
+  /// "*determinized" to false if "fst" holds the epsilon-removed but
+  /// non-deterministic graph.
+  bool DeterminizeGuarded(const std::vector<int32> &disambig_syms_h,
+                          fst::VectorFst<fst::StdArc> *fst,
+                          bool *determinized);
+
+  /// Computes L*G for a single word FST, using fragments_ if it is set and
+  /// the FST is linear
+  void ComposeLexicon(const fst::VectorFst<fst::StdArc> &word_fst,
+                      fst::VectorFst<fst::StdArc> *phone2word_fst);
+
+  /// Adds to lazy_h_ the HMMs for the new input labels of lazy_cfst_
+  void ExtendLazyH();
+
+  /// Composes the lexicon and the context FST with a prefix tree(trie) of
+  /// the transcripts, and splits the result into a C*L*G graph for each
+  /// transcript, which are put in "ctx_fsts".
+  void ComposeSharedPrefixes(
+      const std::vector<std::vector<int32> > &transcripts,
+      fst::ContextFst<fst::StdArc> *cfst,
+      std::vector<fst::VectorFst<fst::StdArc>* > *ctx_fsts);
+
+  /// Records the stage in stats_(if set) and as a trace event(if tracing
+  /// is on), and restarts the timer. The recording itself is not part of
+  /// the time of this stage or of the next one.
+  void RecordStage(int32 utt, TrainingGraphCompilerVisStats::Stage stage,
+                   Timer *timer, const fst::Fst<fst::StdArc> *fst) {
+    bool trace = TraceRecorder::Default().Enabled();
+    if (stats_ == NULL && !trace) return;
+    double seconds = timer->Elapsed();
+    if (trace) {
+      int64 now = TraceRecorder::Now();
+      TraceRecorder::Default().AddComplete(
+          TrainingGraphCompilerVisStats::StageName(stage),
+          now - static_cast<int64>(seconds * 1.0e6), now);
+    }
+    if (stats_ != NULL)
+      stats_->Record(utt, stage, seconds, fst);
+    timer->Reset();
+  }
+
+
   const TransitionModel &trans_model_;
   const ContextDependency &ctx_dep_;
   fst::VectorFst<fst::StdArc> *lex_fst_; // lexicon FST (an input; we take
@@ -105,6 +352,18 @@ class TrainingGraphCompilerVis {
   // this is one of Dan's extensions.
 
   TrainingGraphCompilerVisOptions opts_;
+  TrainingGraphCompilerVisStats *stats_;
+  int32 num_det_failures_;
+  int64 num_shared_states_;
+  int64 num_split_states_;
+  LexiconFragments *fragments_;  // NULL unless opts_.word_fragments
+
+  // Used by CompileLazyGraph: the context FST and the H transducer(with
+  // self-loops) are kept between the utterances, and H is extended when C
+  // gets new input labels.
+  fst::ContextFst<fst::StdArc> *lazy_cfst_;
+  fst::VectorFst<fst::StdArc> *lazy_h_;
+  size_t lazy_h_ilabels_;  // the number of C's input labels covered by H
 };
 
 
@@ -0,0 +1,140 @@
+// decoder/transcript-index.cc
+
+// Copyright 2012  Vassil Panayotov <vd.panayotov@gmail.com>
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#include <sys/stat.h>
+#include <algorithm>
+
+#include "util/common-utils.h"
+#include "decoder/transcript-index.h"
+
+namespace kaldi {
+
+void TranscriptIndex::Open(const std::string &archive_rspecifier,
+                           const std::string &index_filename) {
+  RspecifierOptions opts;
+  RspecifierType type = ClassifyRspecifier(archive_rspecifier, &archive_,
+                                           &opts);
+  if (type != kArchiveRspecifier || ClassifyRxfilename(archive_) != kFileInput)
+    KALDI_ERR << "Only transcript archives in regular files can be indexed, "
+              << "not " << archive_rspecifier;
+  keys_.clear();
+  offsets_.clear();
+  key_index_.clear();
+  is_.close();
+  is_.clear();
+  is_.open(archive_.c_str(), std::ios::in | std::ios::binary);
+  if (!is_.is_open())
+    KALDI_ERR << "Could not open transcript archive " << archive_;
+
+  if (index_filename != "" && ReadIndex(index_filename)) {
+    KALDI_VLOG(1) << "Read the index of " << keys_.size() << " transcripts "
+                  << "from " << index_filename;
+    return;
+  }
+  Scan();
+  if (index_filename != "")
+    WriteIndex(index_filename);
+}
+
+void TranscriptIndex::AddKey(const std::string &key, int64 offset) {
+  if (!key_index_.insert(std::make_pair(key, keys_.size())).second)
+    KALDI_ERR << "Duplicate key " << key << " in " << archive_;
+  keys_.push_back(key);
+  offsets_.push_back(offset);
+}
+
+void TranscriptIndex::Scan() {
+  std::string line;
+  int64 pos = 0;
+  while (std::getline(is_, line)) {
+    int64 line_pos = pos;
+    pos += line.size() + 1;
+    size_t key_end = line.find_first_of(" \t\r");
+    if (key_end == 0)
+      KALDI_ERR << "Invalid line in transcript archive " << archive_ << ": "
+                << line;
+    if (line.empty())
+      continue;
+    if (key_end == std::string::npos)
+      key_end = line.size();  // an empty transcript
+    // the value starts after the single space that follows the key
+    size_t value = std::min(key_end + 1, line.size());
+    if (line.compare(value, 2, std::string("\0B", 2)) == 0)
+      KALDI_ERR << "Binary transcript archives can not be indexed: "
+                << archive_;
+    AddKey(line.substr(0, key_end), line_pos + value);
+  }
+  is_.clear();  // the EOF
+}
+
+bool TranscriptIndex::ReadIndex(const std::string &index_filename) {
+  struct stat archive_stat, index_stat;
+  if (stat(index_filename.c_str(), &index_stat) != 0 ||
+      stat(archive_.c_str(), &archive_stat) != 0 ||
+      index_stat.st_mtime <= archive_stat.st_mtime)
+    return false;  // no index, or the archive may have changed since
+  std::vector<std::pair<std::string, std::string> > entries;
+  if (!ReadScriptFile(index_filename, true, &entries))
+    return false;
+  for (size_t i = 0; i < entries.size(); i++) {
+    const std::string &location = entries[i].second;
+    size_t colon = location.rfind(':');
+    int64 offset;
+    if (colon == std::string::npos || location.substr(0, colon) != archive_ ||
+        !ConvertStringToInteger(location.substr(colon + 1), &offset)) {
+      KALDI_WARN << "Index " << index_filename << " is not an index of "
+                 << archive_ << "; rebuilding it";
+      keys_.clear();
+      offsets_.clear();
+      key_index_.clear();
+      return false;
+    }
+    AddKey(entries[i].first, offset);
+  }
+  return true;
+}
+
+void TranscriptIndex::WriteIndex(const std::string &index_filename) const {
+  Output ko(index_filename, false);
+  for (size_t i = 0; i < keys_.size(); i++)
+    ko.Stream() << keys_[i] << ' ' << archive_ << ':' << offsets_[i] << '\n';
+  ko.Close();
+}
+
+bool TranscriptIndex::Read(const std::string &key,
+                           std::vector<int32> *transcript) {
+  std::tr1::unordered_map<std::string, size_t>::const_iterator it =
+      key_index_.find(key);
+  if (it == key_index_.end())
+    return false;
+  std::string line;
+  is_.clear();
+  is_.seekg(offsets_[it->second]);
+  if (!std::getline(is_, line))
+    KALDI_ERR << "Error reading the transcript of " << key << " from "
+              << archive_ << "(has the archive changed?)";
+  std::vector<std::string> words;
+  SplitStringToVector(line, " \t\r", true, &words);
+  transcript->resize(words.size());
+  for (size_t i = 0; i < words.size(); i++)
+    if (!ConvertStringToInteger(words[i], &(*transcript)[i]))
+      KALDI_ERR << "Invalid transcript of " << key << " in " << archive_
+                << ": " << line;
+  return true;
+}
+
+}  // end namespace kaldi
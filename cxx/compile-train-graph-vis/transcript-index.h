@@ -0,0 +1,76 @@
+// decoder/transcript-index.h
+
+// Copyright 2012  Vassil Panayotov <vd.panayotov@gmail.com>
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef KALDI_DECODER_TRANSCRIPT_INDEX_H_
+#define KALDI_DECODER_TRANSCRIPT_INDEX_H_
+
+#include <fstream>
+#include <string>
+#include <vector>
+#include <tr1/unordered_map>
+
+#include "base/kaldi-common.h"
+
+namespace kaldi {
+
+// An index of a text transcript archive(e.g. data/train.tra): the byte offset
+// of each utterance's transcript, so that the transcripts of a few utterances
+// can be read without parsing the rest of the archive.
+//
+// The index is stored as a script file, one "<key> <archive>:<offset>" line
+// per utterance, with the offsets pointing just after the keys; so it is also
+// a valid "scp:" rspecifier for the other tools.
+class TranscriptIndex {
+ public:
+  TranscriptIndex() {}
+
+  /// "archive_rspecifier" has to be a text archive in a regular file. The
+  /// index is read from "index_filename" if that is newer than the archive;
+  /// otherwise the archive is scanned once, and the index written to
+  /// "index_filename"(unless it is empty) for the next runs.
+  void Open(const std::string &archive_rspecifier,
+            const std::string &index_filename);
+
+  /// The keys, in the order of the archive
+  size_t NumKeys() const { return keys_.size(); }
+  const std::string &Key(size_t i) const { return keys_[i]; }
+
+  bool HasKey(const std::string &key) const {
+    return key_index_.find(key) != key_index_.end();
+  }
+
+  /// Reads the transcript of "key"; returns false if there is no such key
+  bool Read(const std::string &key, std::vector<int32> *transcript);
+
+ private:
+  void AddKey(const std::string &key, int64 offset);
+  void Scan();
+  bool ReadIndex(const std::string &index_filename);
+  void WriteIndex(const std::string &index_filename) const;
+
+  std::string archive_;  // the archive's file name
+  std::ifstream is_;
+  std::vector<std::string> keys_;
+  std::vector<int64> offsets_;  // of the transcripts, parallel to keys_
+  std::tr1::unordered_map<std::string, size_t> key_index_;
+
+  KALDI_DISALLOW_COPY_AND_ASSIGN(TranscriptIndex);
+};
+
+}  // end namespace kaldi
+
+#endif  // KALDI_DECODER_TRANSCRIPT_INDEX_H_
@@ -0,0 +1,687 @@
+// decoder/alignment-drawer.h
+
+// Copyright 2012  Vassil Panayotov <vd.panayotov@gmail.com>
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef KALDI_DECODER_ALIGNMENT_DRAWER_H_
+#define KALDI_DECODER_ALIGNMENT_DRAWER_H_
+
+#include "base/kaldi-common.h"
+#include "hmm/transition-model.h"
+#include "fst/fstlib.h"
+#include "decoder/trace-svg-writer.h"
+#include "decoder/graph-export-writer.h"
+#include "util/trace-events.h"
+
+#include <cstdio>
+#include <deque>
+#include <tr1/unordered_set>
+#include <tr1/unordered_map>
+
+namespace kaldi {
+
+template<class F> class AlignmentDrawer
+{
+public:
+    typedef F Fst;
+    typedef typename Fst::Arc Arc;
+    typedef typename Arc::StateId StateId;
+    typedef typename Arc::Label Label;
+    typedef typename Arc::Weight Weight;
+    typedef typename fst::ArcIterator<Fst> ArcIterator;
+    typedef std::vector<kaldi::int32> Alignment;
+    typedef std::pair<StateId, size_t> FstTracePoint;
+    typedef std::vector<FstTracePoint> FstTrace;
+    // Which of the alignments pass through an arc, and how many times
+    struct ArcUse {
+        ArcUse(): mask(0) {}
+        uint64 mask; // bit i is set for alignment i
+        std::vector<int> counts;
+    };
+    typedef std::tr1::unordered_map<size_t, ArcUse> TraceArcs;
+    typedef std::tr1::unordered_map<StateId, TraceArcs> TraceMap;
+    typedef std::tr1::unordered_map<StateId, int> Neighbourhood;
+
+    static const std::string kAliColor;
+    static const std::string kNonAliColor;
+    static const char *const kOverlayColors[];
+    static const int kNumOverlayColors = 8;
+    static const int kEpsLabel = 0;
+    static const int kMaxAlignments = 64;
+
+    AlignmentDrawer(const Fst &fst, const TransitionModel &tmodel,
+                    const std::vector<kaldi::int32> &ali,
+                    const fst::SymbolTable &phone_syms,
+                    const fst::SymbolTable &word_syms,
+                    const char *sep, bool show_tids, bool ali_only,
+                    int radius = -1, std::ostream &os = std::cout):
+        alis_(1, &ali), traced_mask_(0), fst_(fst), tmodel_(tmodel),
+        phone_syms_(phone_syms), word_syms_(word_syms), sep_(sep),
+        show_tids_(show_tids), ali_only_(ali_only), diff_only_(false),
+        svg_(false), export_format_(kGraphExportNone), radius_(radius), os_(os) {}
+
+    /// Overlays several alignments of the same utterance(e.g. from different
+    /// training iterations) on the FST. The arcs shared by all alignments(of
+    /// those for which a path is found) are drawn in kAliColor and the rest in
+    /// one color per alignment.
+    AlignmentDrawer(const Fst &fst, const TransitionModel &tmodel,
+                    const std::vector<const Alignment*> &alis,
+                    const fst::SymbolTable &phone_syms,
+                    const fst::SymbolTable &word_syms,
+                    const char *sep, bool show_tids, bool ali_only,
+                    int radius = -1, std::ostream &os = std::cout):
+        alis_(alis), traced_mask_(0), fst_(fst), tmodel_(tmodel),
+        phone_syms_(phone_syms), word_syms_(word_syms), sep_(sep),
+        show_tids_(show_tids), ali_only_(ali_only), diff_only_(false),
+        svg_(false), export_format_(kGraphExportNone), radius_(radius), os_(os)
+    {
+        KALDI_ASSERT(!alis.empty());
+        int max_alis = kMaxAlignments; // the mask of ArcUse has 64 bits
+        if (alis.size() > static_cast<size_t>(max_alis))
+            KALDI_ERR << "At most " << max_alis << " alignments can be drawn";
+    }
+
+    /// The names of the alignments shown in the legend(by default 1, 2...)
+    void SetLabels(const std::vector<std::string> &labels) { labels_ = labels; }
+
+    /// Draw only the traced arcs not shared by all the traced alignments
+    void SetDiffOnly(bool diff_only) { diff_only_ = diff_only; }
+
+    /// Write SVG, laid out by TraceSvgWriter, instead of DOT
+    void SetSvg(bool svg) { svg_ = svg; }
+
+    /// Write the states and arcs for interactive viewers(see
+    /// GraphExportWriter) instead of DOT; kGraphExportNone switches back
+    void SetExport(GraphExportFormat format) { export_format_ = format; }
+
+    void Draw()
+    {
+        using namespace std;
+        TraceScope trace_scope("FindTrace");
+        bool found = FindTraces();
+        trace_scope.End();
+        if (!found) {
+            KALDI_WARN << "No alignment has been found!";
+            return;
+        }
+
+        TraceScope draw_scope(export_format_ != kGraphExportNone ? "Export" :
+                              svg_ ? "WriteSvg" : "WriteDot");
+        if (export_format_ != kGraphExportNone) {
+            export_writer_.Begin(os_, export_format_);
+        } else if (svg_) {
+            svg_writer_.Clear();
+            svg_writer_.SetLegend(MakeSvgLegend());
+        } else {
+            // DOT header
+            os_ << "digraph FST {\n"
+                    "rankdir = LR;\n"
+                    "size = \"8.5,11\";\n"
+                    "label = \"" << MakeLegend() << "\";\n"
+                    "center = 1;\n"
+                    "orientation = Portrait;\n"
+                    "ranksep = \"0.4\";\n"
+                    "nodesep = \"0.25\";\n";
+        }
+
+        DrawTrace();
+        if (!ali_only_ && !diff_only_) {
+            if (radius_ < 0)
+                DrawRest();
+            else
+                DrawNeighbourhood();
+        }
+
+        if (export_format_ != kGraphExportNone) {
+            export_writer_.End();
+        } else if (svg_) {
+            SetTraceFrames();
+            svg_writer_.Write(os_);
+        } else {
+            // DOT footer
+            os_ << "}\n";
+        }
+    }
+
+    /// Searches for the paths through the FST, that match the alignments.
+    /// Returns false if there is no path for any of them.
+    bool Trace() { return FindTraces(); }
+
+    /// The color in which the arcs of alignment "i" alone are drawn: one of
+    /// kOverlayColors or, if there are more alignments than these, one of
+    /// evenly spaced hues(leaving out those close to kAliColor, red)
+    std::string OverlayColor(size_t i) const
+    {
+        if (alis_.size() <= static_cast<size_t>(kNumOverlayColors))
+            return kOverlayColors[i];
+        double hue = 30.0 + 300.0 * i / alis_.size(); // in degrees
+        return HsvColor(hue, 1.0, 0.8);
+    }
+
+private:
+
+    void DrawRest() {
+        fst::StateIterator<Fst> sti(fst_);
+        for (; !sti.Done(); sti.Next()) {
+            StateId state = sti.Value();
+            typename TraceMap::iterator tmi = trace_map_.find(state);
+            bool state_traced = (tmi != trace_map_.end());
+            if (!state_traced)
+                DrawState(state, kNonAliColor);
+            ArcIterator ai(fst_, state);
+            for (; !ai.Done(); ai.Next()) {
+                if (!state_traced)
+                    DrawArc(state, ai.Value(), 1, kNonAliColor);
+                else if (tmi->second.find(ai.Position()) == tmi->second.end())
+                    DrawArc(state, ai.Value(), 1, kNonAliColor);
+            }
+        }
+    }
+
+    /// Finds the states that are at most radius_ arcs away from the trace,
+    /// using a breadth-first search seeded with all traced states.
+    /// Only the out-arcs of the visited states are examined, so the cost
+    /// depends on the size of the neighbourhood and not on the size of the FST
+    void FindNeighbourhood(Neighbourhood *hood) {
+        std::deque<StateId> queue;
+        typename TraceMap::const_iterator tmi = trace_map_.begin();
+        for (; tmi != trace_map_.end(); ++tmi) {
+            hood->insert(std::make_pair(tmi->first, 0));
+            queue.push_back(tmi->first);
+        }
+        for (size_t i = 0; i < trace_ends_.size(); i++) {
+            if (hood->find(trace_ends_[i]) != hood->end())
+                continue;
+            hood->insert(std::make_pair(trace_ends_[i], 0));
+            queue.push_back(trace_ends_[i]);
+        }
+
+        while (!queue.empty()) {
+            StateId state = queue.front();
+            queue.pop_front();
+            int dist = (*hood)[state];
+            if (dist >= radius_)
+                continue;
+            ArcIterator ai(fst_, state);
+            for (; !ai.Done(); ai.Next()) {
+                StateId next = ai.Value().nextstate;
+                if (hood->find(next) != hood->end())
+                    continue;
+                hood->insert(std::make_pair(next, dist + 1));
+                queue.push_back(next);
+            }
+        }
+    }
+
+    /// Draws the non-traced states and arcs within radius_ arcs of the trace.
+    /// Arcs leading out of the neighbourhood are omitted.
+    void DrawNeighbourhood() {
+        Neighbourhood hood;
+        FindNeighbourhood(&hood);
+
+        typename Neighbourhood::const_iterator ni = hood.begin();
+        for (; ni != hood.end(); ++ni) {
+            StateId state = ni->first;
+            typename TraceMap::iterator tmi = trace_map_.find(state);
+            bool state_traced = (tmi != trace_map_.end());
+            if (!state_traced)
+                DrawState(state, kNonAliColor);
+            ArcIterator ai(fst_, state);
+            for (; !ai.Done(); ai.Next()) {
+                const Arc &arc = ai.Value();
+                if (hood.find(arc.nextstate) == hood.end())
+                    continue;
+                if (!state_traced ||
+                    tmi->second.find(ai.Position()) == tmi->second.end())
+                    DrawArc(state, arc, 1, kNonAliColor);
+            }
+        }
+        KALDI_VLOG(1) << "Neighbourhood of radius " << radius_ << " contains "
+                      << hood.size() << " states";
+    }
+
+    /// Creates a map: state -> all out arcs which belong to an alignment
+    /// trace. Returns true if the arc wasn't traced before.
+    bool UpdateTraceMap(const StateId &state, size_t arc,
+                        size_t ali_index, int count) {
+        ArcUse &use = trace_map_[state][arc];
+        bool first = (use.mask == 0);
+        use.mask |= (static_cast<uint64>(1) << ali_index);
+        use.counts.resize(alis_.size(), 0);
+        use.counts[ali_index] += count;
+        return first;
+    }
+
+    void DrawState(StateId state, const std::string &color) {
+        using namespace std;
+
+        string node_style = "solid";
+        string node_shape = "circle";
+        if (state == fst_.Start())
+            node_style = "bold";
+        if (fst_.Final(state) != Weight::Zero())
+            node_shape = "doublecircle";
+        ostringstream label;
+        label << state;
+        if (fst_.Final(state) != Weight::Zero())
+            label << " / " << fst_.Final(state);
+
+        if (export_format_ != kGraphExportNone) {
+            int32 flags = (color != kNonAliColor ? kGraphExportTraced : 0);
+            if (state == fst_.Start())
+                flags |= kGraphExportStart;
+            // the id is exported as a number; only the final weight, if
+            // any, goes to the string table
+            ostringstream weight;
+            if (fst_.Final(state) != Weight::Zero()) {
+                flags |= kGraphExportFinal;
+                weight << fst_.Final(state);
+            }
+            export_writer_.AddNode(state, weight.str(), color, flags);
+            return;
+        }
+        if (svg_) {
+            svg_writer_.AddNode(state, label.str(), color, state == fst_.Start(),
+                                fst_.Final(state) != Weight::Zero());
+            return;
+        }
+        os_ << state << " [label = \"" << label.str() << "\", shape = " << node_shape;
+        os_ << ", style = " << node_style << ", color = \"" << color << "\"];\n";
+    }
+
+    std::string MakeLabel(const Arc &arc, const std::string &count)
+    {
+        std::ostringstream oss;
+
+        oss << count;
+
+        kaldi::int32 tid = arc.ilabel;
+        kaldi::int32 phnid = 0;
+        if (tid != 0) {
+            phnid = tmodel_.TransitionIdToPhone(tid);
+            oss << phone_syms_.Find(static_cast<kaldi::int64>(phnid));
+            oss << sep_ << tmodel_.TransitionIdToHmmState(tid);
+            oss << sep_ << tmodel_.TransitionIdToPdf(tid);
+            oss << sep_ << tmodel_.TransitionIdToTransitionIndex(tid);
+        }
+        else {
+            // the input symbol is <eps>
+            oss << phone_syms_.Find(static_cast<kaldi::int64>(phnid));
+        }
+        if (show_tids_)
+            oss << '[' << tid << ']';
+        oss << ':' << word_syms_.Find(static_cast<kaldi::int64>(arc.olabel));
+        if (arc.weight != Weight::One())
+            oss << '/' << arc.weight;
+
+        return oss.str();
+    }
+
+    void DrawArc(const StateId &state, const Arc &arc,
+                 const int count, const std::string &color) {
+        std::ostringstream oss;
+        if (count > 1)
+            oss << '(' << count << "x)";
+        DrawArc(state, arc, oss.str(), color, color);
+    }
+
+    void DrawArc(const StateId &state, const Arc &arc,
+                 const std::string &count, const std::string &color,
+                 const std::string &font_color) {
+        using namespace std;
+
+        if (export_format_ != kGraphExportNone) {
+            export_writer_.AddArc(state, arc.nextstate, MakeLabel(arc, count),
+                                  color, color != kNonAliColor ?
+                                  kGraphExportTraced : 0);
+            return;
+        }
+        if (svg_) {
+            svg_writer_.AddEdge(state, arc.nextstate, MakeLabel(arc, count),
+                                color, font_color, color != kNonAliColor);
+            return;
+        }
+        os_ << "\t" << state << " -> " << arc.nextstate;
+        os_ << " [ label = \"" << MakeLabel(arc, count) << "\", ";
+        os_ << "color = \"" << color << "\", fontcolor = \"" << font_color;
+        os_ << "\"];\n";
+    }
+
+    std::string AliLabel(size_t i) const
+    {
+        if (i < labels_.size())
+            return labels_[i];
+        std::ostringstream oss;
+        oss << (i + 1);
+        return oss.str();
+    }
+
+    /// Lists the colors of the alignments, if there are several
+    std::string MakeLegend() const
+    {
+        if (alis_.size() < 2)
+            return "";
+        std::ostringstream oss;
+        for (size_t i = 0; i < alis_.size(); i++) {
+            if ((traced_mask_ >> i) & 1)
+                oss << AliLabel(i) << ": " << OverlayColor(i) << ", ";
+            else
+                oss << AliLabel(i) << ": no path, ";
+        }
+        oss << "all: " << kAliColor;
+        return oss.str();
+    }
+
+    /// The color of a traced arc: kAliColor if all the traced alignments pass
+    /// through it, otherwise a list of the alignments' colors(drawn side by side)
+    std::string TraceColor(const ArcUse &use) const
+    {
+        if (use.mask == traced_mask_)
+            return kAliColor;
+        std::string color;
+        for (size_t i = 0; i < alis_.size(); i++) {
+            if (!((use.mask >> i) & 1))
+                continue;
+            if (!color.empty())
+                color += ':';
+            color += OverlayColor(i);
+        }
+        return color;
+    }
+
+    /// "(3x)" if all alignments pass through the arc the same number of
+    /// times, otherwise the counts of the individual alignments
+    std::string TraceCount(const ArcUse &use) const
+    {
+        std::ostringstream oss;
+        int count = -1;
+        bool same = true;
+        for (size_t i = 0; i < alis_.size(); i++) {
+            if (!((use.mask >> i) & 1))
+                continue;
+            if (count >= 0 && use.counts[i] != count)
+                same = false;
+            count = use.counts[i];
+        }
+        if (same) {
+            if (count > 1)
+                oss << '(' << count << "x)";
+            return oss.str();
+        }
+        oss << '(';
+        for (size_t i = 0; i < alis_.size(); i++) {
+            if (!((use.mask >> i) & 1))
+                continue;
+            oss << (oss.str().size() > 1 ? " " : "") << AliLabel(i) << ':'
+                << use.counts[i] << 'x';
+        }
+        oss << ')';
+        return oss.str();
+    }
+
+    /// The alignments' colors, for the SVG output
+    TraceSvgWriter::Legend MakeSvgLegend() const
+    {
+        TraceSvgWriter::Legend legend;
+        if (alis_.size() < 2)
+            return legend;
+        for (size_t i = 0; i < alis_.size(); i++) {
+            if ((traced_mask_ >> i) & 1)
+                legend.push_back(std::make_pair(AliLabel(i), OverlayColor(i)));
+        }
+        legend.push_back(std::make_pair(std::string("all"), kAliColor));
+        return legend;
+    }
+
+    /// Gives the SVG writer the first frame at which each traced state is
+    /// entered, which places the state on the time axis
+    void SetTraceFrames()
+    {
+        for (size_t i = 0; i < fst_traces_.size(); i++) {
+            const FstTrace &trace = fst_traces_[i];
+            int32 frame = 0;
+            for (size_t t = 0; t < trace.size(); t++) {
+                svg_writer_.SetFrame(trace[t].first, frame);
+                ArcIterator ait(fst_, trace[t].first);
+                ait.Seek(trace[t].second);
+                if (ait.Value().ilabel != kEpsLabel)
+                    frame++;
+                if (t + 1 == trace.size())
+                    svg_writer_.SetFrame(ait.Value().nextstate, frame);
+            }
+        }
+    }
+
+    /// "#rrggbb" for a hue in degrees and a saturation and value in [0, 1]
+    static std::string HsvColor(double hue, double saturation, double value)
+    {
+        int sector = static_cast<int>(hue / 60.0) % 6;
+        double f = hue / 60.0 - static_cast<int>(hue / 60.0);
+        double p = value * (1 - saturation), q = value * (1 - f * saturation),
+                t = value * (1 - (1 - f) * saturation);
+        double rgb[6][3] = { { value, t, p }, { q, value, p }, { p, value, t },
+                             { p, q, value }, { t, p, value }, { value, p, q } };
+        char buf[8];
+        snprintf(buf, sizeof(buf), "#%02x%02x%02x",
+                 static_cast<int>(rgb[sector][0] * 255 + 0.5),
+                 static_cast<int>(rgb[sector][1] * 255 + 0.5),
+                 static_cast<int>(rgb[sector][2] * 255 + 0.5));
+        return buf;
+    }
+
+    /// Draws the traced arcs, in the order in which the traces pass them
+    void DrawTrace() {
+        std::vector<FstTracePoint> arcs; // the distinct traced arcs, in order
+        trace_map_.clear();
+        trace_ends_.clear();
+        for (size_t i = 0; i < fst_traces_.size(); i++) {
+            const FstTrace &trace = fst_traces_[i];
+            for (size_t t = 0; t < trace.size();) {
+                FstTracePoint point = trace[t];
+                int count = 1;
+                while (++t < trace.size() && trace[t] == point)
+                    ++ count;
+                if (UpdateTraceMap(point.first, point.second, i, count))
+                    arcs.push_back(point);
+            }
+            if (!trace.empty()) {
+                ArcIterator ait(fst_, trace.back().first);
+                ait.Seek(trace.back().second);
+                trace_ends_.push_back(ait.Value().nextstate);
+            }
+        }
+
+        std::tr1::unordered_set<StateId> drawn;
+        for (size_t a = 0; a < arcs.size(); a++) {
+            StateId state = arcs[a].first;
+            const ArcUse &use = trace_map_[state][arcs[a].second];
+            if (diff_only_ && use.mask == traced_mask_)
+                continue;
+            ArcIterator ait(fst_, state);
+            ait.Seek(arcs[a].second);
+            const Arc &arc = ait.Value();
+            std::string color = TraceColor(use);
+            std::string font_color = color.substr(0, color.find(':'));
+            if (drawn.insert(state).second)
+                // This is the first time we reach this state - draw it
+                DrawState(state, font_color);
+            if (diff_only_ && drawn.insert(arc.nextstate).second)
+                DrawState(arc.nextstate, font_color);
+            DrawArc(state, arc, TraceCount(use), color, font_color);
+        }
+        // The states where the traces end have no traced arcs of their own,
+        // and without DrawRest()/DrawNeighbourhood() nothing else draws them
+        if (ali_only_ && !diff_only_) {
+            for (size_t i = 0; i < trace_ends_.size(); i++) {
+                if (drawn.insert(trace_ends_[i]).second)
+                    DrawState(trace_ends_[i], kNonAliColor);
+            }
+        }
+    }
+
+    // Describes a particular state of the alignment-matching process
+    struct AliHypothesys {
+        AliHypothesys(StateId state, size_t arc,
+                      size_t ali_idx, size_t fst_ali_len):
+            state(state), arc(arc),
+            ali_idx(ali_idx), fst_ali_len(fst_ali_len) {}
+
+        StateId state; // state ID
+        size_t arc;  // the index of an outgoing arc of "state"
+        size_t ali_idx; // points to the trans-id to be matched by state/arc
+        size_t fst_ali_len; // the length of the fst state/arc sequence that agrees with
+                            // state-id subsequence from 0 to ali_idx inclusive
+    };
+
+    template <typename S>
+    struct VisitedHash {
+        size_t operator() (const std::pair<S, size_t> &entry) const {
+            return (entry.first << 16) + entry.second;
+        }
+    };
+
+    template <typename S>
+    struct VisitedEqual {
+        bool operator() (const std::pair<S, size_t> &a,
+                         const std::pair<S, size_t> &b) const {
+            return (a.first == b.first && a.second == b.second);
+        }
+    };
+
+    /// Traces all the alignments. Returns false if none of them was found.
+    bool FindTraces()
+    {
+        fst_traces_.assign(alis_.size(), FstTrace());
+        traced_mask_ = 0;
+        for (size_t i = 0; i < alis_.size(); i++) {
+            if (FindTrace(*alis_[i], &fst_traces_[i]))
+                traced_mask_ |= (static_cast<uint64>(1) << i);
+            else if (alis_.size() > 1)
+                KALDI_WARN << "No path has been found for alignment " << AliLabel(i);
+        }
+        return traced_mask_ != 0;
+    }
+
+    bool FindTrace(const Alignment &ali, FstTrace *fst_trace)
+    {
+        fst_trace->clear();
+        std::vector<AliHypothesys> hypotheses;
+
+        // <state, alignment_prefix> to avoid e.g. <eps> loops
+        std::tr1::unordered_set<
+                std::pair<StateId, size_t>,
+                VisitedHash<StateId>, VisitedEqual<StateId> > visited;
+
+        StateId start = fst_.Start();
+        if (start == fst::kNoStateId || ali.empty())
+            return false;
+
+        // Init the hypotheses queue
+        size_t ali_idx = 0;
+        size_t fst_ali_len = 0;
+        for (ArcIterator aiter(fst_, start); !aiter.Done(); aiter.Next()) {
+            const Arc &arc = aiter.Value();
+            if (arc.ilabel == kEpsLabel || arc.ilabel == ali[ali_idx]) {
+                hypotheses.push_back(
+                            AliHypothesys(start, aiter.Position(),
+                                          ali_idx, fst_ali_len));
+            }
+        }
+        visited.insert(std::make_pair(start, ali_idx));
+
+        // Test and extend/backtrack alignments as needed
+        while (!hypotheses.empty()) {
+            AliHypothesys hyp = hypotheses.back();
+            hypotheses.pop_back();
+
+            ali_idx = hyp.ali_idx;
+            ArcIterator ait(fst_, hyp.state);
+            ait.Seek(hyp.arc);
+            const Arc &arc = ait.Value();
+            KALDI_ASSERT(arc.ilabel == kEpsLabel ||
+                         arc.ilabel == ali[ali_idx]);
+            if (arc.ilabel != kEpsLabel)
+                ++ ali_idx;
+
+            if (hyp.fst_ali_len < fst_trace->size()) {
+                //backtrack
+                typename FstTrace::iterator ftit = fst_trace->begin() + hyp.fst_ali_len;
+                fst_trace->erase(ftit, fst_trace->end());
+            }
+            fst_trace->push_back(std::make_pair(hyp.state, hyp.arc));
+
+            StateId nextstate = arc.nextstate;
+            if (ali_idx == ali.size() && fst_.Final(nextstate) != Weight::Zero())
+                return true;
+
+            if (visited.find(std::make_pair(nextstate, ali_idx))
+                    != visited.end())
+                continue; // this state/alignment pair was already considered
+
+            // Extend the current hypothesis
+            visited.insert(std::make_pair(nextstate, ali_idx));
+            ArcIterator nait(fst_, nextstate);
+            for (; !nait.Done(); nait.Next()) {
+                const Arc &narc = nait.Value();
+                if (narc.ilabel == kEpsLabel ||
+                    (ali_idx < ali.size() && narc.ilabel == ali[ali_idx]))
+                    hypotheses.push_back(AliHypothesys(nextstate, nait.Position(),
+                                                       ali_idx, fst_trace->size()));
+            }
+        }
+
+        fst_trace->clear();
+        return false; // no alignment has been found
+    }
+
+    std::vector<const Alignment*> alis_;
+    std::vector<std::string> labels_;
+    std::vector<FstTrace> fst_traces_; // one per alignment(empty if not found)
+    // Bit i is set if alignment i has been traced. The arcs all of these pass
+    // through are drawn in kAliColor(the other alignments are left out)
+    uint64 traced_mask_;
+
+    // A map from a state that belongs to an alignment trace
+    // to its output arcs that belong to a trace
+    TraceMap trace_map_;
+
+    // The destination states of the last arcs in the traces
+    std::vector<StateId> trace_ends_;
+
+    const Fst &fst_;
+    const TransitionModel &tmodel_;
+    const fst::SymbolTable &phone_syms_;
+    const fst::SymbolTable &word_syms_;
+    const std::string sep_;
+    const bool show_tids_;
+    const bool ali_only_;
+    bool diff_only_; // draw only the arcs not shared by all alignments
+    bool svg_; // write SVG instead of DOT
+    TraceSvgWriter svg_writer_; // collects the states and arcs drawn, for SVG
+    GraphExportFormat export_format_; // kGraphExportNone unless exporting
+    GraphExportWriter export_writer_; // writes the states and arcs as they are drawn
+    const int radius_; // draw only the states this close to the trace(-1 means all)
+    std::ostream &os_; // the DOT(SVG, exported graph) output goes here
+};
+
+template<typename F> const std::string AlignmentDrawer<F>::kAliColor = "red";
+template<typename F> const std::string AlignmentDrawer<F>::kNonAliColor = "black";
+template<typename F> const char *const AlignmentDrawer<F>::kOverlayColors[] = {
+    "blue", "green4", "orange", "purple", "cyan3", "brown", "magenta", "gold3"
+};
+
+} // namespace kaldi
+
+#endif // KALDI_DECODER_ALIGNMENT_DRAWER_H_
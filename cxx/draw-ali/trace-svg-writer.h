@@ -0,0 +1,426 @@
+// decoder/trace-svg-writer.h
+
+// Copyright 2012  Vassil Panayotov <vd.panayotov@gmail.com>
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef KALDI_DECODER_TRACE_SVG_WRITER_H_
+#define KALDI_DECODER_TRACE_SVG_WRITER_H_
+
+#include <cmath>
+#include <deque>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+#include <tr1/unordered_map>
+
+#include "base/kaldi-common.h"
+
+namespace kaldi {
+
+/// Lays out an alignment trace and the states around it, and writes it as
+/// SVG, without GraphViz. The layout is made for traces, which are almost
+/// linear in time:
+///  - the traced states form the top row, left to right in the order of the
+///    first frame at which a trace enters them
+///  - every other state is put in the column of the first traced state(in
+///    time order) from which it can be reached, below the states already in
+///    that column
+///  - the states reachable from no traced state are put in extra columns on
+///    the right
+/// Each step is linear in the number of states and arcs, so large graphs are
+/// written in about the time it takes to format their labels.
+class TraceSvgWriter
+{
+public:
+    typedef std::vector<std::pair<std::string, std::string> > Legend;
+
+    TraceSvgWriter() {}
+
+    void Clear()
+    {
+        nodes_.clear();
+        node_index_.clear();
+        edges_.clear();
+        frames_.clear();
+        legend_.clear();
+    }
+
+    /// "color" is a GraphViz color name(see SvgColor())
+    void AddNode(int64 id, const std::string &label, const std::string &color,
+                 bool start, bool final)
+    {
+        Node &node = nodes_[GetNode(id)];
+        node.label = label;
+        node.color = color;
+        node.start = start;
+        node.final = final;
+    }
+
+    /// "colors" is a ':' separated list; an arc with several colors is drawn
+    /// as parallel lines. The traced arcs are drawn thicker.
+    void AddEdge(int64 from, int64 to, const std::string &label,
+                 const std::string &colors, const std::string &font_color,
+                 bool traced)
+    {
+        Edge edge;
+        edge.from = GetNode(from);
+        edge.to = GetNode(to);
+        edge.label = label;
+        edge.font_color = font_color;
+        size_t pos = 0;
+        while (true) {
+            size_t next = colors.find(':', pos);
+            edge.colors.push_back(colors.substr(pos, next - pos));
+            if (next == std::string::npos)
+                break;
+            pos = next + 1;
+        }
+        edge.traced = traced;
+        edges_.push_back(edge);
+    }
+
+    /// Marks a state as traced at "frame"; the smallest frame is kept. The
+    /// states that are not added as nodes or edge ends are ignored.
+    void SetFrame(int64 id, int32 frame)
+    {
+        std::tr1::unordered_map<int64, int32>::iterator it = frames_.find(id);
+        if (it == frames_.end())
+            frames_.insert(std::make_pair(id, frame));
+        else if (frame < it->second)
+            it->second = frame;
+    }
+
+    void SetLegend(const Legend &legend) { legend_ = legend; }
+
+    void Write(std::ostream &os)
+    {
+        Layout();
+        WriteSvg(os);
+    }
+
+    /// Maps the GraphViz(X11) color names used by the drawers to SVG colors
+    static std::string SvgColor(const std::string &color)
+    {
+        static const char *const kX11Colors[][2] = {
+            { "green4", "#008b00" }, { "cyan3", "#00cdcd" },
+            { "gold3", "#cdad00" }, { "purple", "#a020f0" },
+            { "brown", "#a52a2a" }, { "orange", "#ffa500" }
+        };
+        for (size_t i = 0; i < sizeof(kX11Colors) / sizeof(kX11Colors[0]); i++)
+            if (color == kX11Colors[i][0])
+                return kX11Colors[i][1];
+        return color;
+    }
+
+private:
+    struct Node {
+        Node(): color("black"), start(false), final(false),
+                frame(-1), col(-1), row(0) {}
+        int64 id;
+        std::string label;
+        std::string color;
+        bool start;
+        bool final;
+        int32 frame; // the first frame on a trace, or -1
+        int32 col;
+        int32 row;
+    };
+
+    struct Edge {
+        int32 from;
+        int32 to;
+        std::string label;
+        std::vector<std::string> colors;
+        std::string font_color;
+        bool traced;
+    };
+
+    static const int kRadius = 18;
+    static const int kRowPitch = 80;
+    static const int kMargin = 40;
+    static const int kTopMargin = 90; // room for the self-loops of the top row
+
+    int32 GetNode(int64 id)
+    {
+        std::tr1::unordered_map<int64, int32>::iterator it = node_index_.find(id);
+        if (it != node_index_.end())
+            return it->second;
+        int32 index = nodes_.size();
+        node_index_.insert(std::make_pair(id, index));
+        nodes_.push_back(Node());
+        nodes_.back().id = id;
+        std::ostringstream label;
+        label << id;
+        nodes_.back().label = label.str();
+        return index;
+    }
+
+    void Layout()
+    {
+        num_cols_ = 0;
+        max_row_ = 0;
+        int32 num_nodes = nodes_.size();
+
+        // The traced states, bucketed by their first frame(in the order in
+        // which they were added within a frame)
+        std::vector<std::vector<int32> > by_frame;
+        std::tr1::unordered_map<int64, int32>::const_iterator fi;
+        std::vector<int32> traced;
+        for (int32 n = 0; n < num_nodes; n++) {
+            fi = frames_.find(nodes_[n].id);
+            if (fi == frames_.end())
+                continue;
+            nodes_[n].frame = fi->second;
+            if (static_cast<size_t>(fi->second) >= by_frame.size())
+                by_frame.resize(fi->second + 1);
+            by_frame[fi->second].push_back(n);
+        }
+        std::vector<int32> col_rows; // the number of rows in each column
+        for (size_t f = 0; f < by_frame.size(); f++) {
+            for (size_t i = 0; i < by_frame[f].size(); i++) {
+                Node &node = nodes_[by_frame[f][i]];
+                node.col = num_cols_++;
+                node.row = 0;
+                col_rows.push_back(1);
+                traced.push_back(by_frame[f][i]);
+            }
+        }
+
+        // The out-arcs of each state, as offsets into "targets"
+        std::vector<int32> first(num_nodes + 1, 0), targets(edges_.size());
+        for (size_t e = 0; e < edges_.size(); e++)
+            first[edges_[e].from + 1]++;
+        for (int32 n = 0; n < num_nodes; n++)
+            first[n + 1] += first[n];
+        std::vector<int32> next(first.begin(), first.end() - 1);
+        for (size_t e = 0; e < edges_.size(); e++)
+            targets[next[edges_[e].from]++] = edges_[e].to;
+
+        // Breadth-first from the traced states, in time order
+        std::deque<int32> queue(traced.begin(), traced.end());
+        int32 unplaced = 0;
+        while (true) {
+            while (!queue.empty()) {
+                int32 n = queue.front();
+                queue.pop_front();
+                for (int32 a = first[n]; a < first[n + 1]; a++) {
+                    Node &target = nodes_[targets[a]];
+                    if (target.col >= 0)
+                        continue;
+                    target.col = nodes_[n].col;
+                    target.row = col_rows[target.col]++;
+                    max_row_ = std::max(max_row_, target.row);
+                    queue.push_back(targets[a]);
+                }
+            }
+            // A state not reached yet starts a new column
+            for (; unplaced < num_nodes && nodes_[unplaced].col >= 0; unplaced++) {}
+            if (unplaced == num_nodes)
+                break;
+            nodes_[unplaced].col = num_cols_++;
+            nodes_[unplaced].row = 0;
+            col_rows.push_back(1);
+            queue.push_back(unplaced);
+        }
+
+        // The columns are wide enough for the labels of the arcs between
+        // neighbouring columns
+        size_t max_label = 0;
+        for (size_t e = 0; e < edges_.size(); e++)
+            if (edges_[e].from != edges_[e].to)
+                max_label = std::max(max_label, edges_[e].label.size());
+        col_pitch_ = std::min(400, std::max(110, static_cast<int>(max_label) * 6 +
+                                            2 * kRadius + 20));
+    }
+
+    double X(const Node &node) const { return kMargin + kRadius + node.col * col_pitch_; }
+
+    double Y(const Node &node) const { return kTopMargin + node.row * kRowPitch; }
+
+    static std::string XmlEscape(const std::string &text)
+    {
+        std::string ans;
+        for (size_t i = 0; i < text.size(); i++) {
+            switch (text[i]) {
+            case '<': ans += "&lt;"; break;
+            case '>': ans += "&gt;"; break;
+            case '&': ans += "&amp;"; break;
+            case '"': ans += "&quot;"; break;
+            default: ans += text[i];
+            }
+        }
+        return ans;
+    }
+
+    /// The id of the arrow marker of a color
+    std::string Marker(const std::string &color)
+    {
+        std::tr1::unordered_map<std::string, int32>::iterator it = markers_.find(color);
+        int32 index;
+        if (it == markers_.end()) {
+            index = markers_.size();
+            markers_.insert(std::make_pair(color, index));
+        } else {
+            index = it->second;
+        }
+        std::ostringstream oss;
+        oss << "arrow" << index;
+        return oss.str();
+    }
+
+    void WriteEdge(const Edge &edge, int32 parallel, std::ostream &os)
+    {
+        const Node &from = nodes_[edge.from], &to = nodes_[edge.to];
+        double x0 = X(from), y0 = Y(from);
+        double width = (edge.traced ? 2.0 : 1.0);
+        if (edge.from == edge.to) {
+            // a loop above the state(stacked, if there are several)
+            double h = 35 + 18 * parallel;
+            for (size_t c = 0; c < edge.colors.size(); c++) {
+                double d = (c - (edge.colors.size() - 1) / 2.0) * 2.5;
+                std::string color = SvgColor(edge.colors[c]);
+                os << "<path d=\"M" << (x0 - 8 + d) << ',' << (y0 - kRadius + 3)
+                   << " C" << (x0 - 25 + d) << ',' << (y0 - kRadius - h) << ' '
+                   << (x0 + 25 + d) << ',' << (y0 - kRadius - h) << ' '
+                   << (x0 + 8 + d) << ',' << (y0 - kRadius + 3)
+                   << "\" fill=\"none\" stroke=\"" << color << "\" stroke-width=\""
+                   << width << "\" marker-end=\"url(#" << Marker(color) << ")\"/>\n";
+            }
+            os << "<text x=\"" << x0 << "\" y=\"" << (y0 - kRadius - h * 0.75 - 4)
+               << "\" fill=\"" << SvgColor(edge.font_color) << "\">"
+               << XmlEscape(edge.label) << "</text>\n";
+            return;
+        }
+
+        double x1 = X(to), y1 = Y(to);
+        double dx = x1 - x0, dy = y1 - y0;
+        double len = std::sqrt(dx * dx + dy * dy);
+        double nx = dy / len, ny = -dx / len; // bends up for forward arcs
+        // Arcs that would cross other states, and the parallel arcs, bend
+        int32 steps = std::max(std::abs(to.col - from.col), std::abs(to.row - from.row));
+        double bend = (steps <= 1 ? 0.0 : 20.0 + 8.0 * std::min(steps, 10)) +
+                      14.0 * parallel;
+        double cx = (x0 + x1) / 2 + nx * bend, cy = (y0 + y1) / 2 + ny * bend;
+        // start and end on the circles, in the direction of the curve
+        double sx = cx - x0, sy = cy - y0, slen = std::sqrt(sx * sx + sy * sy);
+        double ex = x1 - cx, ey = y1 - cy, elen = std::sqrt(ex * ex + ey * ey);
+        double px0 = x0 + sx / slen * kRadius, py0 = y0 + sy / slen * kRadius;
+        double px1 = x1 - ex / elen * (kRadius + 1), py1 = y1 - ey / elen * (kRadius + 1);
+        for (size_t c = 0; c < edge.colors.size(); c++) {
+            double d = (c - (edge.colors.size() - 1) / 2.0) * 2.5;
+            std::string color = SvgColor(edge.colors[c]);
+            os << "<path d=\"M" << (px0 + nx * d) << ',' << (py0 + ny * d)
+               << " Q" << (cx + nx * d) << ',' << (cy + ny * d) << ' '
+               << (px1 + nx * d) << ',' << (py1 + ny * d)
+               << "\" fill=\"none\" stroke=\"" << color << "\" stroke-width=\""
+               << width << "\" marker-end=\"url(#" << Marker(color) << ")\"/>\n";
+        }
+        // the label goes above the middle of the curve(to its right, if the
+        // curve goes down to a lower row)
+        double mx = 0.25 * px0 + 0.5 * cx + 0.25 * px1;
+        double my = 0.25 * py0 + 0.5 * cy + 0.25 * py1;
+        bool vertical = std::abs(dy) > std::abs(dx);
+        os << "<text x=\"" << (vertical ? mx + 4 : mx) << "\" y=\""
+           << (vertical ? my + 4 : my - 4) << "\" fill=\""
+           << SvgColor(edge.font_color) << "\""
+           << (vertical ? " text-anchor=\"start\"" : "") << ">"
+           << XmlEscape(edge.label) << "</text>\n";
+    }
+
+    void WriteNode(const Node &node, std::ostream &os)
+    {
+        double x = X(node), y = Y(node);
+        std::string color = SvgColor(node.color);
+        os << "<circle cx=\"" << x << "\" cy=\"" << y << "\" r=\"" << kRadius
+           << "\" fill=\"white\" stroke=\"" << color << "\" stroke-width=\""
+           << (node.start ? 3 : 1) << "\"/>\n";
+        if (node.final)
+            os << "<circle cx=\"" << x << "\" cy=\"" << y << "\" r=\""
+               << (kRadius - 4) << "\" fill=\"none\" stroke=\"" << color << "\"/>\n";
+        os << "<text x=\"" << x << "\" y=\"" << (y + 4) << "\" fill=\"" << color
+           << "\">" << XmlEscape(node.label) << "</text>\n";
+        if (node.frame >= 0)
+            os << "<text x=\"" << (x - kRadius) << "\" y=\"" << (y + kRadius + 6)
+               << "\" fill=\"gray\" font-size=\"9\" text-anchor=\"end\">t="
+               << node.frame << "</text>\n";
+    }
+
+    void WriteSvg(std::ostream &os)
+    {
+        int width = 2 * kMargin + 2 * kRadius + std::max(num_cols_ - 1, 0) * col_pitch_;
+        int legend_height = (legend_.empty() ? 0 : 30);
+        int height = kTopMargin + max_row_ * kRowPitch + kRadius + kMargin +
+                     legend_height;
+        std::ostringstream body;
+        markers_.clear();
+
+        // The parallel arcs(and the loops) of a pair of states are counted
+        // so that they are drawn apart
+        std::tr1::unordered_map<uint64, int32> parallel;
+        for (size_t e = 0; e < edges_.size(); e++) {
+            uint32 a = std::min(edges_[e].from, edges_[e].to);
+            uint32 b = std::max(edges_[e].from, edges_[e].to);
+            int32 &count = parallel[(static_cast<uint64>(a) << 32) | b];
+            WriteEdge(edges_[e], count++, body);
+        }
+        for (size_t n = 0; n < nodes_.size(); n++)
+            WriteNode(nodes_[n], body);
+
+        if (!legend_.empty()) {
+            double x = kMargin, y = height - kMargin / 2 - 5;
+            for (size_t i = 0; i < legend_.size(); i++) {
+                std::string color = SvgColor(legend_[i].second);
+                body << "<line x1=\"" << x << "\" y1=\"" << (y - 4) << "\" x2=\""
+                     << (x + 20) << "\" y2=\"" << (y - 4) << "\" stroke=\"" << color
+                     << "\" stroke-width=\"2\"/>\n<text x=\"" << (x + 24) << "\" y=\""
+                     << y << "\" text-anchor=\"start\">"
+                     << XmlEscape(legend_[i].first) << "</text>\n";
+                x += 40 + 7 * legend_[i].first.size();
+            }
+            width = std::max(width, static_cast<int>(x) + kMargin);
+        }
+
+        os << "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+           << "<svg xmlns=\"http://www.w3.org/2000/svg\" width=\"" << width
+           << "\" height=\"" << height << "\" viewBox=\"0 0 " << width << ' '
+           << height << "\" font-family=\"Helvetica,Arial,sans-serif\" "
+           << "font-size=\"11\" text-anchor=\"middle\">\n<defs>\n";
+        std::tr1::unordered_map<std::string, int32>::const_iterator mi;
+        for (mi = markers_.begin(); mi != markers_.end(); ++mi)
+            os << "<marker id=\"arrow" << mi->second << "\" viewBox=\"0 0 10 8\" "
+               << "refX=\"10\" refY=\"4\" markerWidth=\"8\" markerHeight=\"6\" "
+               << "orient=\"auto\"><path d=\"M0,0 L10,4 L0,8 z\" fill=\""
+               << mi->first << "\"/></marker>\n";
+        os << "</defs>\n<rect width=\"100%\" height=\"100%\" fill=\"white\"/>\n"
+           << body.str() << "</svg>\n";
+    }
+
+    std::vector<Node> nodes_;
+    std::tr1::unordered_map<int64, int32> node_index_;
+    std::vector<Edge> edges_;
+    std::tr1::unordered_map<int64, int32> frames_;
+    Legend legend_;
+
+    // set by Layout()
+    int32 num_cols_;
+    int32 max_row_;
+    int col_pitch_;
+    std::tr1::unordered_map<std::string, int32> markers_; // color -> marker index
+};
+
+} // namespace kaldi
+
+#endif // KALDI_DECODER_TRACE_SVG_WRITER_H_
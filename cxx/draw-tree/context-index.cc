@@ -0,0 +1,292 @@
+// decoder/context-index.cc
+
+// Copyright 2012  Vassil Panayotov <vd.panayotov@gmail.com>
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#include <pthread.h>
+#include <algorithm>
+
+#include "decoder/context-index.h"
+#include "decoder/flat-event-map.h"
+
+namespace kaldi {
+
+bool SparseBitset::Contains(int64 bit) const
+{
+    uint32 index = static_cast<uint32>(bit >> 6);
+    std::vector<uint32>::const_iterator it =
+            std::lower_bound(index_.begin(), index_.end(), index);
+    if (it == index_.end() || *it != index)
+        return false;
+    return (words_[it - index_.begin()] >> (bit & 63)) & 1;
+}
+
+void SparseBitset::Merge(const SparseBitset &other)
+{
+    if (other.index_.empty())
+        return;
+    if (index_.empty() || other.index_.front() > index_.back()) {
+        // the usual case: "other" holds the next part of the range
+        index_.insert(index_.end(), other.index_.begin(), other.index_.end());
+        words_.insert(words_.end(), other.words_.begin(), other.words_.end());
+        return;
+    }
+    std::vector<uint32> index;
+    std::vector<uint64> words;
+    size_t i = 0, j = 0;
+    while (i < index_.size() || j < other.index_.size()) {
+        if (j == other.index_.size() ||
+            (i < index_.size() && index_[i] < other.index_[j])) {
+            index.push_back(index_[i]);
+            words.push_back(words_[i++]);
+        } else if (i == index_.size() || other.index_[j] < index_[i]) {
+            index.push_back(other.index_[j]);
+            words.push_back(other.words_[j++]);
+        } else {
+            index.push_back(index_[i]);
+            words.push_back(words_[i++] | other.words_[j++]);
+        }
+    }
+    index_.swap(index);
+    words_.swap(words);
+}
+
+int64 SparseBitset::Count() const
+{
+    int64 count = 0;
+    for (size_t i = 0; i < words_.size(); i++) {
+        uint64 word = words_[i];
+        for (; word != 0; word &= word - 1)
+            count++;
+    }
+    return count;
+}
+
+void SparseBitset::GetBits(std::vector<int64> *bits) const
+{
+    for (size_t i = 0; i < words_.size(); i++) {
+        int64 base = static_cast<int64>(index_[i]) << 6;
+        for (int32 b = 0; b < 64; b++)
+            if ((words_[i] >> b) & 1)
+                bits->push_back(base + b);
+    }
+}
+
+void SparseBitset::Write(std::ostream &os, bool binary) const
+{
+    WriteIntegerVector(os, binary, index_);
+    WriteIntegerVector(os, binary, words_);
+}
+
+void SparseBitset::Read(std::istream &is, bool binary)
+{
+    ReadIntegerVector(is, binary, &index_);
+    ReadIntegerVector(is, binary, &words_);
+    if (index_.size() != words_.size())
+        KALDI_ERR << "Corrupted context index";
+}
+
+
+/// Maps a part of the contexts on a separate thread. The contexts are taken
+/// in blocks of the same HMM state and central phone; each worker maps a
+/// range of consecutive blocks, so that its bitsets can simply be appended
+/// to these of the previous worker.
+class ContextIndexWorker
+{
+public:
+    ContextIndexWorker(const ContextIndex &index, const FlatEventMap &map,
+                       int64 begin_block, int64 end_block) :
+        index_(index), map_(map), begin_block_(begin_block),
+        end_block_(end_block) {}
+
+    static void *Run(void *arg)
+    {
+        static_cast<ContextIndexWorker*>(arg)->Map();
+        return NULL;
+    }
+
+    void Map()
+    {
+        int64 V = index_.NumValues();
+        int64 block_size = 1; // the contexts in a block: V^(N-1)
+        for (int32 k = 1; k < index_.N_; k++)
+            block_size *= V;
+
+        // The contexts of a block are mapped at once
+        int32 stride = map_.Stride();
+        std::vector<EventValueType> events(block_size * stride);
+        std::vector<EventAnswerType> answers(block_size);
+        EventType event;
+        for (int64 block = begin_block_; block < end_block_; block++) {
+            int32 pdf_class = block / V, central = block % V;
+            if (pdf_class >= index_.num_pdf_classes_[central])
+                continue;
+            for (int64 i = 0; i < block_size; i++) {
+                index_.GetEvent(block * block_size + i, &event);
+                for (int32 k = 0; k < stride; k++)
+                    events[i * stride + k] = event[k].second;
+            }
+            map_.MapMany(&events[0], block_size, &answers[0]);
+            for (int64 i = 0; i < block_size; i++) {
+                int64 context = block * block_size + i;
+                EventAnswerType pdf = answers[i];
+                if (pdf < 0) {
+                    unmapped.Set(context);
+                    continue;
+                }
+                if (pdf >= static_cast<EventAnswerType>(pdfs.size()))
+                    pdfs.resize(pdf + 1);
+                pdfs[pdf].Set(context);
+            }
+        }
+    }
+
+    std::vector<SparseBitset> pdfs;
+    SparseBitset unmapped;
+
+private:
+    const ContextIndex &index_;
+    const FlatEventMap &map_;
+    int64 begin_block_;
+    int64 end_block_;
+};
+
+
+void ContextIndex::Build(const EventMap &map, int32 N, int32 P,
+                         const std::vector<int32> &phones,
+                         const std::vector<int32> &num_pdf_classes,
+                         int32 num_threads)
+{
+    KALDI_ASSERT(phones.size() == num_pdf_classes.size() && num_threads > 0);
+    KALDI_ASSERT(P >= 0 && P < N);
+    N_ = N;
+    P_ = P;
+    values_.assign(1, 0);
+    values_.insert(values_.end(), phones.begin(), phones.end());
+    std::sort(values_.begin(), values_.end());
+    if (std::adjacent_find(values_.begin(), values_.end()) != values_.end())
+        KALDI_ERR << "The phones must be unique and non-zero";
+    num_pdf_classes_.assign(values_.size(), 0);
+    max_pdf_classes_ = 0;
+    for (size_t i = 0; i < phones.size(); i++) {
+        size_t v = std::lower_bound(values_.begin(), values_.end(), phones[i]) -
+                   values_.begin();
+        num_pdf_classes_[v] = num_pdf_classes[i];
+        max_pdf_classes_ = std::max(max_pdf_classes_, num_pdf_classes[i]);
+    }
+
+    // The threads share a flat copy of the tree, which is read-only and maps
+    // many contexts at a time. (Accept() is not const, but doesn't modify
+    // the tree.)
+    FlatEventMap flat_map(const_cast<EventMap&>(map), N);
+    int64 num_blocks = max_pdf_classes_ * NumValues();
+    std::vector<ContextIndexWorker*> workers;
+    std::vector<pthread_t> threads(num_threads);
+    for (int32 t = 0; t < num_threads; t++)
+        workers.push_back(new ContextIndexWorker(
+                *this, flat_map, num_blocks * t / num_threads,
+                num_blocks * (t + 1) / num_threads));
+    std::vector<bool> started(num_threads, false);
+    for (int32 t = 1; t < num_threads; t++)
+        started[t] = (pthread_create(&threads[t], NULL, &ContextIndexWorker::Run,
+                                     workers[t]) == 0);
+    for (int32 t = 0; t < num_threads; t++) {
+        if (started[t]) {
+            pthread_join(threads[t], NULL);
+        } else {
+            if (t > 0)
+                KALDI_WARN << "Could not create a thread; mapping on the main one";
+            workers[t]->Map();
+        }
+    }
+
+    pdfs_.clear();
+    unmapped_ = SparseBitset();
+    for (int32 t = 0; t < num_threads; t++) {
+        ContextIndexWorker *worker = workers[t];
+        if (worker->pdfs.size() > pdfs_.size())
+            pdfs_.resize(worker->pdfs.size());
+        for (size_t p = 0; p < worker->pdfs.size(); p++)
+            pdfs_[p].Merge(worker->pdfs[p]);
+        unmapped_.Merge(worker->unmapped);
+        delete worker;
+    }
+}
+
+void ContextIndex::GetEvent(int64 context, EventType *event) const
+{
+    int64 V = NumValues();
+    event->resize(N_ + 1);
+    for (int32 k = N_ - 1; k >= 0; k--) {
+        if (k == P_)
+            continue;
+        (*event)[k + 1] = std::make_pair(static_cast<EventKeyType>(k),
+                                         values_[context % V]);
+        context /= V;
+    }
+    (*event)[P_ + 1] = std::make_pair(static_cast<EventKeyType>(P_),
+                                      values_[context % V]);
+    (*event)[0] = std::make_pair(static_cast<EventKeyType>(kPdfClass),
+                                 static_cast<EventValueType>(context / V));
+}
+
+void ContextIndex::GetContexts(int32 pdf, std::vector<EventType> *contexts) const
+{
+    contexts->clear();
+    if (pdf < 0 || pdf >= NumPdfs())
+        return;
+    std::vector<int64> bits;
+    pdfs_[pdf].GetBits(&bits);
+    contexts->resize(bits.size());
+    for (size_t i = 0; i < bits.size(); i++)
+        GetEvent(bits[i], &(*contexts)[i]);
+}
+
+void ContextIndex::Write(std::ostream &os, bool binary) const
+{
+    WriteToken(os, binary, "<ContextIndex>");
+    WriteBasicType(os, binary, N_);
+    WriteBasicType(os, binary, P_);
+    WriteIntegerVector(os, binary, values_);
+    WriteIntegerVector(os, binary, num_pdf_classes_);
+    WriteBasicType(os, binary, static_cast<int32>(pdfs_.size()));
+    for (size_t p = 0; p < pdfs_.size(); p++)
+        pdfs_[p].Write(os, binary);
+    unmapped_.Write(os, binary);
+    WriteToken(os, binary, "</ContextIndex>");
+}
+
+void ContextIndex::Read(std::istream &is, bool binary)
+{
+    ExpectToken(is, binary, "<ContextIndex>");
+    ReadBasicType(is, binary, &N_);
+    ReadBasicType(is, binary, &P_);
+    ReadIntegerVector(is, binary, &values_);
+    ReadIntegerVector(is, binary, &num_pdf_classes_);
+    if (N_ <= 0 || P_ < 0 || P_ >= N_ || values_.empty() ||
+        num_pdf_classes_.size() != values_.size())
+        KALDI_ERR << "Corrupted context index";
+    max_pdf_classes_ = *std::max_element(num_pdf_classes_.begin(),
+                                         num_pdf_classes_.end());
+    int32 num_pdfs;
+    ReadBasicType(is, binary, &num_pdfs);
+    pdfs_.resize(num_pdfs);
+    for (int32 p = 0; p < num_pdfs; p++)
+        pdfs_[p].Read(is, binary);
+    unmapped_.Read(is, binary);
+    ExpectToken(is, binary, "</ContextIndex>");
+}
+
+} // namespace kaldi
@@ -0,0 +1,121 @@
+// decoder/context-index.h
+
+// Copyright 2012  Vassil Panayotov <vd.panayotov@gmail.com>
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef KALDI_DECODER_CONTEXT_INDEX_H_
+#define KALDI_DECODER_CONTEXT_INDEX_H_
+
+#include <vector>
+
+#include "base/kaldi-common.h"
+#include "tree/event-map.h"
+
+namespace kaldi {
+
+/// A set of integers stored as a bitmap, of which only the non-zero 64-bit
+/// words are kept. The bits have to be set in increasing order.
+class SparseBitset
+{
+public:
+    SparseBitset() {}
+
+    void Set(int64 bit)
+    {
+        uint32 index = static_cast<uint32>(bit >> 6);
+        KALDI_ASSERT(index_.empty() || index >= index_.back());
+        if (index_.empty() || index_.back() != index) {
+            index_.push_back(index);
+            words_.push_back(0);
+        }
+        words_.back() |= (static_cast<uint64>(1) << (bit & 63));
+    }
+
+    bool Contains(int64 bit) const;
+
+    /// Sets all the bits set in "other"
+    void Merge(const SparseBitset &other);
+
+    int64 Count() const;
+
+    /// Appends the set bits to "bits", in increasing order
+    void GetBits(std::vector<int64> *bits) const;
+
+    void Write(std::ostream &os, bool binary) const;
+    void Read(std::istream &is, bool binary);
+
+private:
+    std::vector<uint32> index_; // the indices of the non-zero words, sorted
+    std::vector<uint64> words_;
+};
+
+
+/// An inverted index from pdf-ids to the contexts(HMM state and phones in
+/// the context window) mapped to them by a tree. All the contexts of the
+/// phone set are enumerated and mapped on several threads(through a
+/// FlatEventMap).
+/// The contexts are numbered densely: with V context values(the phones and
+/// 0, the utterance boundary), the triphone context (s, lc, c, rc) is
+/// ((s * V + c) * V + lc) * V + rc, so the contexts of a pdf, which usually
+/// share the central phone, are close to each other.
+class ContextIndex
+{
+public:
+    ContextIndex(): N_(0), P_(0), max_pdf_classes_(0) {}
+
+    /// Enumerates the contexts. "num_pdf_classes[i]" is the number of HMM
+    /// states of "phones[i]"; the context phones are all of "phones", plus 0.
+    void Build(const EventMap &map, int32 N, int32 P,
+               const std::vector<int32> &phones,
+               const std::vector<int32> &num_pdf_classes,
+               int32 num_threads);
+
+    int32 NumPdfs() const { return pdfs_.size(); }
+
+    /// The number of contexts mapped to "pdf"
+    int64 NumContexts(int32 pdf) const
+    {
+        return (pdf >= 0 && pdf < NumPdfs()) ? pdfs_[pdf].Count() : 0;
+    }
+
+    /// The number of contexts which the tree has no pdf for
+    int64 NumUnmapped() const { return unmapped_.Count(); }
+
+    /// Returns the contexts mapped to "pdf", as events(pdf-class first)
+    void GetContexts(int32 pdf, std::vector<EventType> *contexts) const;
+
+    void Write(std::ostream &os, bool binary) const;
+    void Read(std::istream &is, bool binary);
+
+private:
+    int64 NumValues() const { return values_.size(); }
+
+    /// Decodes a context number to an event
+    void GetEvent(int64 context, EventType *event) const;
+
+    friend class ContextIndexWorker;
+
+    int32 N_; // context width
+    int32 P_; // central position
+    std::vector<int32> values_; // 0 and the phones, sorted
+    std::vector<int32> num_pdf_classes_; // for each value(0 for 0)
+    int32 max_pdf_classes_;
+    std::vector<SparseBitset> pdfs_;
+    SparseBitset unmapped_;
+};
+
+} // namespace kaldi
+
+#endif // KALDI_DECODER_CONTEXT_INDEX_H_
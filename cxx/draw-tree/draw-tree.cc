@@ -19,247 +19,14 @@
 #include "util/common-utils.h"
 #include "hmm/transition-model.h"
 #include "fst/fstlib.h"
-
-namespace kaldi {
-
-/// Traverses the event map tree depth-first and spits out its GraphViz description
-class TreeRenderer: public EventMapVisitor
-{
-public:
-    TreeRenderer(EventMap &root, const fst::SymbolTable *phone_syms,
-                 kaldi::int32 N, kaldi::int32 P) :
-        kColor_("black"), kTraceColor_("red"), kPen_(1), kTracePen_(3),
-        root_(root), N(N), P(P), phone_syms_(phone_syms),
-        next_id_(0), parent_id_(0)
-    {
-        KALDI_ASSERT(((N == 3 && P == 1) || (N == 1 && P == 0)) &&
-                     "Unsupported context window!");
-    }
-
-    void Render(const EventType *event = 0) {
-        event_ = event;
-        if (event != 0)
-            path_active_ = true;
-        else
-            path_active_ = false;
-
-        std::cout << "digraph EventMap {" << std::endl;
-        root_.Accept(*this);
-        std::cout << '}' << std::endl;
-    }
-
-    virtual void VisitSplit(EventKeyType &key,
-                            ConstIntegerSet<EventValueType> &yes_set,
-                            EventMap *yes_map,
-                            EventMap *no_map)
-    {
-        kaldi::int32 my_id = next_id_ ++;
-
-        // Draw this node and the input edge from its parent
-        DrawThisNode(my_id, key);
-
-        // Descend into this node's children
-        std::string yes_color(kColor_), no_color(kColor_);
-        kaldi::int32 yes_pen = kPen_, no_pen = kPen_;
-        bool yes_active = false;
-        bool active = path_active_;
-        if (event_ != 0 && path_active_) {
-            EventValueType value;
-            EventMap::Lookup(*event_, key, &value);
-            if (yes_set.count(value)) {
-                yes_color = kTraceColor_;
-                yes_active = true;
-                yes_pen = kTracePen_;
-            } else {
-                no_color = kTraceColor_;
-                no_pen = kTracePen_;
-            }
-        }
-
-        // "Yes" child
-        std::string yes_tooltip = MakeYesTooltip(key, yes_set);
-        path_active_ = (active && yes_active);
-        parent_id_ = my_id;
-        std::ostringstream oss_yes;
-        oss_yes << "[color=" << yes_color
-                << ", label=\"" << yes_tooltip << '\"'
-                << ", penwidth=" << yes_pen
-                << "];";
-        edge_attr_ = oss_yes.str();
-        yes_map->Accept(*this);
-
-        // "No" child
-        path_active_ = (active && !yes_active);
-        parent_id_ = my_id;
-        std::ostringstream oss_no;
-        oss_no << "[color=" << no_color
-               << ", penwidth=" << no_pen << "];";
-        edge_attr_ = oss_no.str();
-        no_map->Accept(*this);
-    }
-
-    virtual void VisitConst(const EventAnswerType &answer)
-    {
-        std::ostringstream oss;
-
-        kaldi::int32 id = next_id_++;
-
-        // Draw the edge from parent
-        if (parent_id_ >= 0 && id > 0)
-            oss << '\t' << parent_id_ << " -> " << id <<
-                   edge_attr_ << std::endl;
-
-        std::string color = kColor_;
-        kaldi::int32 pen = kPen_;
-        if (path_active_) {
-            pen = kTracePen_;
-            color = kTraceColor_;
-        }
-
-        // Draw a leaf node
-        oss << id << "[shape=\"doublecircle\", label=" << answer
-            << ",color=" << color << ", penwidth=" << pen << "];";
-        std::cout << oss.str() << std::endl;
-    }
-
-    virtual void VisitTable(const EventKeyType &key, std::vector<EventMap*> &table)
-    {
-        kaldi::int32 my_id = next_id_ ++;
-
-        // Draw the node and the input edge from its parent
-        DrawThisNode(my_id, key);
-
-        // Descend into the event maps stored in table's entries
-        bool active = path_active_;
-        EventValueType value = -1;
-        if (event_)
-            EventMap::Lookup(*event_, key, &value);
-        for (int i = 0; i < table.size(); i++) {
-            if (table[i] == NULL)
-                continue;
-
-            std::ostringstream label;
-            if (key == kPdfClass) {
-                label << i;
-            }
-            else if (key < N) {
-                std::string phone = phone_syms_->Find(
-                            static_cast<kaldi::int64>(i));
-                if (phone.empty()) {
-                    KALDI_ERR << "Invalid phone key!";
-                }
-                label << phone;
-            }
-            else {
-                KALDI_ERR << "Invalid event key!";
-            }
-
-            path_active_ = false;
-            parent_id_ = my_id;
-            std::string color(kColor_);
-            kaldi::int32 pen = kPen_;
-            if (i == value && active) {
-                color = kTraceColor_;
-                path_active_ = true;
-                pen = kTracePen_;
-            }
-            std::ostringstream oss;
-            oss << "[color=" << color
-                << ", label=" << label.str()
-                << ", penwidth=" << pen << "];";
-            edge_attr_ = oss.str();
-            table[i]->Accept(*this);
-        }
-    }
-
-private:
-
-    void DrawThisNode(kaldi::int32 my_id, const EventKeyType &key)
-    {
-        std::ostringstream out;
-        std::string color = kColor_;
-        kaldi::int32 pen = kPen_;
-        if (path_active_ && event_) {
-            color = kTraceColor_;
-            pen = kTracePen_;
-        }
-
-        // Draw the incomming edge from this node's parent
-        if (my_id > 0) // don't draw self-loop at the root
-            out << '\t' <<  parent_id_ << " -> " << my_id << edge_attr_ << std::endl;
-
-        // Draw the node itself
-        std::string label;
-        if (key == kPdfClass) {
-            label = "\"HMM state = ?\"";
-        }
-        else if (key == 0) {
-            if (N == 1)
-                label = "\"Phone = ?\"";
-            else
-                label = "\"LContext = ?\"";
-        }
-        else if (key == 1 && key < N) {
-            label = "\"Center = ?\"";
-        }
-        else if (key == 2 && key < N) {
-            label = "\"RContext = ?\"";
-        }
-        else {
-            KALDI_ERR << "Unexpected key: " << key;
-        }
-        out << my_id << " [label=" << label
-            << ", color=" << color
-            << ", penwidth=" << pen << "];";
-        std::cout << out.str() << std::endl;
-    }
-
-    std::string MakeYesTooltip(EventKeyType key,
-                               const ConstIntegerSet<EventValueType> &yes_set)
-    {
-        std::ostringstream oss;
-        //oss << '\"';
-        ConstIntegerSet<EventValueType>::iterator child = yes_set.begin();
-        for (; child != yes_set.end(); child ++) {
-            if (child != yes_set.begin())
-                oss << ", ";
-            if (key != kPdfClass) {
-                std::string phone =
-                        phone_syms_->Find(static_cast<kaldi::int64>(*child));
-                if (phone.empty())
-                    KALDI_ERR << "No phone found for Phone ID " << *child;
-                oss << phone;
-            }
-            else {
-                oss << *child;
-            }
-        }
-        //oss << '\"';
-        return oss.str();
-    }
-
-    const std::string kColor_;
-    const std::string kTraceColor_;
-    const kaldi::int32 kPen_;
-    const kaldi::int32 kTracePen_; // GraphViz pen width for the "traced" path
-
-    EventMap &root_; // the root of the tree
-    const kaldi::int32 N; // context length
-    const kaldi::int32 P; // central phone
-    const EventType *event_; // the 'event' to be traced (0 means "don't trace")
-    const fst::SymbolTable *phone_syms_;
-
-    kaldi::int32 next_id_; // The next node id to be assigned
-    kaldi::int32 parent_id_; // The id of the current node's parent
-    std::string edge_attr_; // The attributes of the edge to current node from its parent
-    bool path_active_; // True if the current node is traversed when tracing an event through the tree
-}; // TreeRenderer
-
-} // namespace kaldi
+#include "decoder/tree-renderer.h"
+#include "decoder/vis-model-cache.h"
+#include "decoder/vis-server.h"
+#include "util/trace-events.h"
 
 kaldi::EventType* MakeEvent(std::string &query,
                             kaldi::int32 N,
-                            fst::SymbolTable *phone_syms,
+                            const fst::SymbolTable *phone_syms,
                             kaldi::ParseOptions &po)
 {
     using namespace kaldi;
@@ -306,64 +73,125 @@ kaldi::EventType* MakeEvent(std::string &query,
     return query_event;
 }
 
-int main(int argc, char **argv)
+/// Renders a tree as specified by the command line arguments and writes
+/// the result to "os". If "server_opts" is not NULL the server options are
+/// also accepted, and returned through it.
+int DrawTree(int argc, const char *const *argv, std::ostream &os,
+             VisServerOptions *server_opts)
 {
     using namespace kaldi;
-    try {
-        const char *usage =
-                "Draws a phonetic states-tying tree using GraphViz\n"
-                "The output is meant to be rendered in SVG (to see the tooltips)\n"
-                "Usage: draw-tree [options] <phones-syms> <tree>\n\n";
-
-        std::string query;
-        ParseOptions po(usage);
-        po.Register("query", &query, "Traces a mono/tri phone state through the tree(format: state/lc/c/rc)");
-        po.Read(argc, argv);
 
-        if (po.NumArgs() != 2) {
+    const char *usage =
+            "Draws a phonetic states-tying tree using GraphViz\n"
+            "The output is meant to be rendered in SVG (to see the tooltips)\n"
+            "Usage: draw-tree [options] <phones-syms> <tree>\n"
+            "   or: draw-tree --serve=<socket>|-\n\n"
+            "In server mode each request is a single line containing the options and\n"
+            "arguments that would be passed on the command line, and the response\n"
+            "is the rendered tree. The trees and symbol tables stay loaded between\n"
+            "the requests(they are reloaded if the files change). With --serve=-\n"
+            "the requests are read from stdin and each response is preceded by a\n"
+            "line holding its length in bytes.\n"
+            "--dag draws each distinct subtree once; the nodes it hangs from all\n"
+            "point to it, so large trees give far smaller graphs.\n"
+            "--trace-out writes the time spent in each step as trace events(JSON,\n"
+            "for chrome://tracing); in server mode it can be given per request.\n\n";
+
+    std::string query;
+    kaldi::int32 subtree = 0;
+    std::string format = "dot";
+    bool dag = false;
+    std::string trace_wxfilename;
+    ParseOptions po(usage);
+    po.Register("query", &query, "Traces a mono/tri phone state through the tree(format: state/lc/c/rc)");
+    po.Register("subtree", &subtree, "Draw only the subtree rooted at the node with this id");
+    po.Register("format", &format, "Output format: \"dot\"(GraphViz), or \"ndjson\" "
+                "or \"bin\" for interactive viewers(see graph-export-writer.h)");
+    po.Register("dag", &dag, "Draw the identical subtrees only once, as shared "
+                "nodes of a DAG(much smaller output for large trees)");
+    po.Register("trace-out", &trace_wxfilename, "Write the time spent in the "
+                "loading and rendering as Chrome trace events(JSON)");
+    if (server_opts != NULL)
+        server_opts->Register(&po);
+    po.Read(argc, argv);
+
+    if (server_opts != NULL && server_opts->Enabled()) {
+        if (po.NumArgs() != 0) {
             po.PrintUsage();
             return 1;
         }
+        return 0;
+    }
+
+    if (po.NumArgs() != 2) {
+        po.PrintUsage();
+        return 1;
+    }
+    GraphExportFormat export_format = kGraphExportNone;
+    if (format != "dot" &&
+        !GraphExportWriter::ParseFormat(format, &export_format)) {
+        KALDI_WARN << "Unknown output format \"" << format << '"';
+        return 1;
+    }
 
-        std::string phnfile = po.GetArg(1);
-        std::string treefile = po.GetArg(2);
+    TraceSession trace_session(trace_wxfilename, "draw-tree");
+    std::string phnfile = po.GetArg(1);
+    std::string treefile = po.GetArg(2);
 
-        fst::SymbolTable *phones_symtab = NULL;
-        {
-            std::ifstream is(phnfile.c_str());
-            phones_symtab = ::fst::SymbolTable::ReadText(is, phnfile);
-            if (!phones_symtab)
-                KALDI_ERR << "Could not read phones symbol table file "<< phnfile;
-        }
+    TraceScope load_scope("LoadTree");
+    VisModelCache &cache = VisModelCache::Default();
+    const fst::SymbolTable &phones_symtab = cache.GetSymbolTable(phnfile);
+    const ContextDependency &ctx_dep = cache.GetContextDependency(treefile);
+    load_scope.End();
 
-        ContextDependency ctx_dep;  // the tree.
-        {
-          bool binary;
-          Input ki(treefile, &binary);
-          ctx_dep.Read(ki.Stream(), binary);
-        }
-        EventMap &root = const_cast<EventMap&>(ctx_dep.ToPdfMap());
-        const kaldi::int32 P = ctx_dep.CentralPosition();
-        const kaldi::int32 N = ctx_dep.ContextWidth();
+    EventMap &root = const_cast<EventMap&>(ctx_dep.ToPdfMap());
+    const kaldi::int32 P = ctx_dep.CentralPosition();
+    const kaldi::int32 N = ctx_dep.ContextWidth();
+
+    if (!((N == 3 && P == 1) || (N == 1 && P == 0))) {
+        std::cerr << "Only monophone and triphone trees are supported\n";
+        po.PrintUsage();
+        return 1;
+    }
 
-        if (!((N == 3 && P == 1) || (N == 1 && P == 0))) {
-            std::cerr << "Only monophone and triphone trees are supported\n";
+    EventType *query_event = 0;
+    if (!query.empty()) {
+        query_event = MakeEvent(query, N, &phones_symtab, po);
+        if (query_event == 0) {
             po.PrintUsage();
-            return 1;
+            return 2;
         }
+    }
 
-        EventType *query_event = 0;
-        if (!query.empty()) {
-            query_event = MakeEvent(query, N, phones_symtab, po);
-            if (query_event == 0) {
-                po.PrintUsage();
-                return 2;
-            }
-        }
+    TraceScope render_scope(export_format != kGraphExportNone ? "Export" :
+                            "WriteDot");
+    TreeRenderer renderer(root, &phones_symtab, N, P, os, subtree);
+    renderer.SetExport(export_format);
+    renderer.SetDag(dag);
+    renderer.Render(query_event);
+    render_scope.End();
+    delete query_event;
 
-        TreeRenderer renderer(root, phones_symtab, N, P);
-        renderer.Render(query_event);
+    return 0;
+}
+
+/// Answers a single server request
+int DrawTreeRequest(int argc, const char *const *argv, std::ostream &os)
+{
+    return DrawTree(argc, argv, os, NULL);
+}
+
+int main(int argc, char **argv)
+{
+    using namespace kaldi;
+    try {
+        VisServerOptions server_opts;
+        int ret = DrawTree(argc, argv, std::cout, &server_opts);
+        if (ret != 0 || !server_opts.Enabled())
+            return ret;
 
+        VisToolRequestHandler handler("draw-tree", &DrawTreeRequest);
+        RunVisServer(server_opts, &handler);
         return 0;
     }
     catch (std::exception& e) {
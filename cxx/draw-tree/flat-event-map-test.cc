@@ -0,0 +1,114 @@
+// decoder/flat-event-map-test.cc
+
+// Copyright 2012  Vassil Panayotov <vd.panayotov@gmail.com>
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#include <algorithm>
+#include <cstdlib>
+#include <utility>
+#include <vector>
+
+#include "decoder/flat-event-map.h"
+
+namespace kaldi {
+
+/// A random tree over the keys kPdfClass..N-1, with values in
+/// [0, max_value). The tables have NULL entries, which EventMap::Map()
+/// treats as undefined.
+static EventMap *RandomTree(int32 N, EventValueType max_value, int32 depth)
+{
+    if (depth == 0 || rand() % 4 == 0)
+        return new ConstantEventMap(rand() % 1000);
+    EventKeyType key = rand() % (N + 1) - 1;
+    if (rand() % 3 != 0) {
+        std::vector<EventValueType> yes_set;
+        for (EventValueType v = 0; v < max_value; v++)
+            if (rand() % 2 == 0)
+                yes_set.push_back(v);
+        if (yes_set.empty())
+            yes_set.push_back(rand() % max_value);
+        return new SplitEventMap(key, yes_set,
+                                 RandomTree(N, max_value, depth - 1),
+                                 RandomTree(N, max_value, depth - 1));
+    }
+    std::vector<EventMap*> table(1 + rand() % std::min(max_value, 6), NULL);
+    for (size_t i = 0; i < table.size(); i++)
+        if (rand() % 4 != 0)
+            table[i] = RandomTree(N, max_value, depth - 1);
+    return new TableEventMap(key, table);
+}
+
+/// Stores "num_events" random events in the layout of FlatEventMap, with
+/// some of the values negative or larger than any value in the tree
+static void RandomEvents(int32 N, EventValueType max_value, int64 num_events,
+                         std::vector<EventValueType> *events)
+{
+    events->resize(num_events * (N + 1));
+    for (size_t i = 0; i < events->size(); i++)
+        (*events)[i] = rand() % (max_value + 10) - 3;
+}
+
+static EventAnswerType TreeAnswer(const EventMap &tree, int32 N,
+                                  const EventValueType *event)
+{
+    EventType e;
+    for (int32 i = 0; i <= N; i++)
+        e.push_back(std::make_pair(static_cast<EventKeyType>(i - 1), event[i]));
+    EventAnswerType answer;
+    if (!tree.Map(e, &answer))
+        return -1;
+    return answer;
+}
+
+void UnitTestFlatEventMap()
+{
+    int32 N = 1 + rand() % 3;
+    // above 64 the yes-sets take more than one word
+    EventValueType max_value = 1 + rand() % (rand() % 2 == 0 ? 10 : 150);
+    EventMap *tree = RandomTree(N, max_value, 1 + rand() % 6);
+    FlatEventMap flat(*tree, N);
+    KALDI_ASSERT(flat.Stride() == N + 1);
+
+    // The batches of MapMany() are 64 events; check partial batches too
+    int64 sizes[] = { 0, 1, 63, 64, 65, 129, rand() % 1000 };
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        int64 num_events = sizes[s];
+        std::vector<EventValueType> events;
+        RandomEvents(N, max_value, num_events, &events);
+        // sentinel after the answers, which MapMany() must not touch
+        std::vector<EventAnswerType> answers(num_events + 1, -2);
+        flat.MapMany(num_events == 0 ? NULL : &events[0], num_events,
+                     &answers[0]);
+        for (int64 i = 0; i < num_events; i++) {
+            const EventValueType *event = &events[i * flat.Stride()];
+            EventAnswerType expected = TreeAnswer(*tree, N, event);
+            KALDI_ASSERT(flat.Map(event) == expected);
+            KALDI_ASSERT(answers[i] == expected);
+        }
+        KALDI_ASSERT(answers[num_events] == -2);
+    }
+    delete tree;
+}
+
+} // namespace kaldi
+
+int main()
+{
+    using namespace kaldi;
+    for (int32 i = 0; i < 200; i++)
+        UnitTestFlatEventMap();
+    std::cout << "Test OK.\n";
+    return 0;
+}
@@ -0,0 +1,180 @@
+// decoder/flat-event-map.cc
+
+// Copyright 2012  Vassil Panayotov <vd.panayotov@gmail.com>
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#include <algorithm>
+
+#include "decoder/flat-event-map.h"
+
+namespace kaldi {
+
+/// Copies the nodes of a tree into a FlatEventMap, depth-first
+class FlatEventMapBuilder: public EventMapVisitor
+{
+public:
+    explicit FlatEventMapBuilder(FlatEventMap *flat) :
+        flat_(flat), last_(0), depth_(0), max_depth_(0)
+    {
+        // The "undefined" leaf
+        NewNode(0, -1);
+        flat_->next_.push_back(0);
+    }
+
+    /// Copies the tree and returns its root
+    int32 Build(EventMap &map)
+    {
+        map.Accept(*this);
+        int32 root = last_;
+        FillYesBits();
+        return root;
+    }
+
+    virtual void VisitConst(const EventAnswerType &answer)
+    {
+        int32 id = NewNode(0, answer);
+        flat_->next_.push_back(id);
+        last_ = id;
+    }
+
+    virtual void VisitSplit(EventKeyType &key,
+                            ConstIntegerSet<EventValueType> &yes_set,
+                            EventMap *yes_map,
+                            EventMap *no_map)
+    {
+        int32 id = NewNode(key, -1);
+        flat_->is_split_[id] = 1;
+        yes_sets_[id].assign(yes_set.begin(), yes_set.end());
+
+        int32 yes = Descend(yes_map), no = Descend(no_map);
+        flat_->first_[id] = flat_->next_.size();
+        flat_->next_.push_back(yes);
+        flat_->next_.push_back(no);
+        last_ = id;
+    }
+
+    virtual void VisitTable(const EventKeyType &key, std::vector<EventMap*> &table)
+    {
+        int32 id = NewNode(key, -1);
+        flat_->table_size_[id] = table.size();
+
+        std::vector<int32> entries(1, 0); // the values out of the table
+        for (size_t i = 0; i < table.size(); i++)
+            entries.push_back(table[i] == NULL ? 0 : Descend(table[i]));
+        flat_->first_[id] = flat_->next_.size();
+        flat_->next_.insert(flat_->next_.end(), entries.begin(), entries.end());
+        last_ = id;
+    }
+
+    int32 Depth() const { return max_depth_; }
+
+private:
+    int32 NewNode(EventKeyType key, EventAnswerType answer)
+    {
+        if (key + 1 < 0 || key + 1 >= flat_->stride_)
+            KALDI_ERR << "Unexpected key " << key << " in the tree";
+        int32 id = flat_->first_.size();
+        flat_->column_.push_back(key + 1);
+        flat_->first_.push_back(flat_->next_.size());
+        flat_->bits_.push_back(0);
+        flat_->table_size_.push_back(0);
+        flat_->is_split_.push_back(0);
+        flat_->answer_.push_back(answer);
+        yes_sets_.resize(id + 1);
+        return id;
+    }
+
+    int32 Descend(EventMap *map)
+    {
+        max_depth_ = std::max(max_depth_, ++depth_);
+        map->Accept(*this);
+        depth_--;
+        return last_;
+    }
+
+    void FillYesBits()
+    {
+        EventValueType max_value = 0;
+        for (size_t i = 0; i < yes_sets_.size(); i++) {
+            if (yes_sets_[i].empty())
+                continue;
+            if (yes_sets_[i].front() < 0)
+                KALDI_ERR << "Negative values are not supported";
+            max_value = std::max(max_value, yes_sets_[i].back());
+        }
+        int32 num_words = max_value / 64 + 1;
+        flat_->num_value_bits_ = num_words * 64;
+        flat_->yes_bits_.assign(num_words, 0);
+        for (size_t i = 0; i < yes_sets_.size(); i++) {
+            if (!flat_->is_split_[i])
+                continue;
+            size_t offset = flat_->yes_bits_.size();
+            flat_->bits_[i] = static_cast<int32>(offset);
+            flat_->yes_bits_.resize(offset + num_words, 0);
+            for (size_t j = 0; j < yes_sets_[i].size(); j++) {
+                EventValueType v = yes_sets_[i][j];
+                flat_->yes_bits_[offset + v / 64] |= (static_cast<uint64>(1) << (v % 64));
+            }
+        }
+    }
+
+    FlatEventMap *flat_;
+    int32 last_; // the node created by the last Accept()
+    int32 depth_; // the depth of the node being visited
+    int32 max_depth_;
+    std::vector<std::vector<EventValueType> > yes_sets_;
+};
+
+
+FlatEventMap::FlatEventMap(EventMap &map, int32 N) :
+    stride_(N + 1), root_(0), depth_(0), num_value_bits_(0)
+{
+    FlatEventMapBuilder builder(this);
+    root_ = builder.Build(map);
+    depth_ = builder.Depth();
+}
+
+void FlatEventMap::MapMany(const EventValueType *events, int64 num_events,
+                           EventAnswerType *pdfs) const
+{
+    // The events are stepped in batches small enough to keep the current
+    // nodes in the L1 cache. All the events of a batch take a step before any
+    // takes the next one, so that the independent lookups can overlap.
+    const int32 kBatchSize = 64;
+    int32 nodes[kBatchSize];
+    for (int64 start = 0; start < num_events; start += kBatchSize) {
+        int32 n = static_cast<int32>(std::min<int64>(kBatchSize,
+                                                     num_events - start));
+        const EventValueType *batch = events + start * stride_;
+        for (int32 i = 0; i < n; i++)
+            nodes[i] = root_;
+        // The leaves lead to themselves, so a step that changes no node means
+        // that all the events are done.
+        for (int32 d = 0; d < depth_; d++) {
+            int32 changed = 0;
+            for (int32 i = 0; i < n; i++) {
+                int32 next = Step(nodes[i], batch + i * stride_);
+                changed |= (next ^ nodes[i]);
+                nodes[i] = next;
+            }
+            if (changed == 0)
+                break;
+        }
+        for (int32 i = 0; i < n; i++)
+            pdfs[start + i] = answer_[nodes[i]];
+    }
+}
+
+} // namespace kaldi
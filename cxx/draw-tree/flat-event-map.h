@@ -0,0 +1,104 @@
+// decoder/flat-event-map.h
+
+// Copyright 2012  Vassil Panayotov <vd.panayotov@gmail.com>
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef KALDI_DECODER_FLAT_EVENT_MAP_H_
+#define KALDI_DECODER_FLAT_EVENT_MAP_H_
+
+#include <vector>
+
+#include "base/kaldi-common.h"
+#include "tree/event-map.h"
+
+namespace kaldi {
+
+/// A read-only copy of a tree(made of constant, split and table event maps)
+/// stored as flat arrays, which maps many events at a time.
+///
+/// The events are given as rows of N + 1 values: the pdf class, then the
+/// phones at positions 0..N-1 of the context window. Every node is stepped
+/// through in the same way, without branching on the node type: the value
+/// the node asks about selects one of the node's successors in next_:
+///   split  - 0 if the value is in the yes-set, else 1. The yes-sets are
+///            bitmaps of the same width, so the test is a single lookup.
+///   table  - value + 1 if the value is in the table, else 0(which leads to
+///            the "undefined" leaf)
+///   leaf   - 0, which leads back to the leaf itself
+/// MapMany() steps a batch of events through the tree in lock-step until
+/// they have all reached leaves. Its inner loop has no data dependent
+/// branches and touches only a few small arrays, so it is much faster than
+/// calling EventMap::Map() for each event.
+class FlatEventMap
+{
+public:
+    /// Copies the tree; N is the context width.
+    FlatEventMap(EventMap &map, int32 N);
+
+    /// Maps a single event; returns -1 if the tree has no answer for it
+    EventAnswerType Map(const EventValueType *event) const
+    {
+        int32 node = root_;
+        for (int32 d = 0; d < depth_; d++)
+            node = Step(node, event);
+        return answer_[node];
+    }
+
+    /// Maps "num_events" events, stored one after another(see above), and
+    /// writes the answers(or -1) to "pdfs"
+    void MapMany(const EventValueType *events, int64 num_events,
+                 EventAnswerType *pdfs) const;
+
+    int32 NumNodes() const { return first_.size(); }
+
+    /// The number of values per event
+    int32 Stride() const { return stride_; }
+
+private:
+    friend class FlatEventMapBuilder;
+
+    int32 Step(int32 node, const EventValueType *event) const
+    {
+        uint32 value = static_cast<uint32>(event[column_[node]]);
+        uint32 in_set_range = (value < num_value_bits_);
+        uint64 word = yes_bits_[bits_[node] + (value >> 6) * in_set_range];
+        uint32 no = 1 - (in_set_range & static_cast<uint32>(word >> (value & 63)));
+        uint32 entry = (value < table_size_[node]) * (value + 1);
+        uint32 split = is_split_[node];
+        return next_[first_[node] + split * no + (1 - split) * entry];
+    }
+
+    int32 stride_; // N + 1
+    int32 root_;
+    int32 depth_; // the number of steps from the root to the deepest leaf
+
+    // The nodes' data, indexed by node. Node 0 is the "undefined" leaf.
+    std::vector<int32> column_; // the index of the value the node asks about
+    std::vector<int32> first_; // the offset of the node's successors in next_
+    std::vector<int32> bits_; // the offset of the yes-set in yes_bits_
+    std::vector<uint32> table_size_; // 0 for splits and leaves
+    std::vector<uint32> is_split_;
+    std::vector<EventAnswerType> answer_; // -1 for inner nodes
+
+    std::vector<int32> next_;
+    // The yes-sets of the splits, num_value_bits_ / 64 words each. The first
+    // set is empty and is used by the nodes that are not splits.
+    std::vector<uint64> yes_bits_;
+    uint32 num_value_bits_;
+};
+
+} // namespace kaldi
+
+#endif // KALDI_DECODER_FLAT_EVENT_MAP_H_
@@ -0,0 +1,125 @@
+// bin/tree-context-index.cc
+
+// Copyright 2012  Vassil Panayotov <vd.panayotov@gmail.com>
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#include "base/kaldi-common.h"
+#include "base/timer.h"
+#include "util/common-utils.h"
+#include "hmm/transition-model.h"
+#include "fst/fstlib.h"
+#include "decoder/context-index.h"
+#include "decoder/vis-model-cache.h"
+
+/// Writes a context in the format of draw-tree's --query(state/lc/c/rc)
+void WriteContext(const kaldi::EventType &event,
+                  const fst::SymbolTable &phone_syms,
+                  std::ostream &os)
+{
+    os << event[0].second;
+    for (size_t k = 1; k < event.size(); k++) {
+        std::string phone = phone_syms.Find(static_cast<kaldi::int64>(event[k].second));
+        os << '/' << (phone.empty() ? "<eps>" : phone);
+    }
+    os << std::endl;
+}
+
+int main(int argc, char **argv)
+{
+    using namespace kaldi;
+    try {
+        const char *usage =
+                "Maps all the contexts(HMM state and phones) through a tree and writes an\n"
+                "index from each pdf-id to the contexts mapped to it, or lists the contexts\n"
+                "of a pdf-id using such an index\n"
+                "Usage: tree-context-index [options] <phones-syms> <tree> <index-out>\n"
+                "   or: tree-context-index --pdf=<pdf-id> <phones-syms> <index-in>\n"
+                "e.g.: tree-context-index --model=exp/tri1/final.mdl --num-threads=8 "
+                "data/phones.txt exp/tri1/tree exp/tri1/tree.ctx\n"
+                "      tree-context-index --pdf=1234 data/phones.txt exp/tri1/tree.ctx\n";
+
+        std::string model_file;
+        kaldi::int32 num_pdf_classes = 3;
+        kaldi::int32 num_threads = 1;
+        kaldi::int32 pdf = -1;
+        bool binary = true;
+        ParseOptions po(usage);
+        po.Register("model", &model_file, "Transition model, used to get the phones "
+                    "and their numbers of HMM states(otherwise all the phones in "
+                    "<phones-syms> are used, with --num-pdf-classes states each)");
+        po.Register("num-pdf-classes", &num_pdf_classes, "Number of HMM states per "
+                    "phone, if no --model is given");
+        po.Register("num-threads", &num_threads, "Number of threads mapping the contexts");
+        po.Register("pdf", &pdf, "List the contexts mapped to this pdf-id");
+        po.Register("binary", &binary, "Write the index in binary mode");
+        po.Read(argc, argv);
+
+        if (po.NumArgs() != (pdf >= 0 ? 2 : 3) || num_threads < 1) {
+            po.PrintUsage();
+            return 1;
+        }
+
+        VisModelCache &cache = VisModelCache::Default();
+        const fst::SymbolTable &phones_symtab = cache.GetSymbolTable(po.GetArg(1));
+        ContextIndex index;
+
+        if (pdf >= 0) {
+            bool binary_in;
+            Input ki(po.GetArg(2), &binary_in);
+            index.Read(ki.Stream(), binary_in);
+            std::vector<EventType> contexts;
+            index.GetContexts(pdf, &contexts);
+            for (size_t i = 0; i < contexts.size(); i++)
+                WriteContext(contexts[i], phones_symtab, std::cout);
+            KALDI_LOG << contexts.size() << " contexts are mapped to pdf " << pdf;
+            return 0;
+        }
+
+        const ContextDependency &ctx_dep = cache.GetContextDependency(po.GetArg(2));
+        std::vector<int32> phones, phone_pdf_classes;
+        cache.GetContextPhones(model_file, phones_symtab, num_pdf_classes,
+                               &phones, &phone_pdf_classes);
+
+        Timer timer;
+        index.Build(ctx_dep.ToPdfMap(), ctx_dep.ContextWidth(),
+                    ctx_dep.CentralPosition(), phones, phone_pdf_classes,
+                    num_threads);
+        double elapsed = timer.Elapsed();
+
+        int64 num_contexts = 0, max_contexts = 0;
+        int32 num_used = 0;
+        for (int32 p = 0; p < index.NumPdfs(); p++) {
+            int64 n = index.NumContexts(p);
+            num_contexts += n;
+            max_contexts = std::max(max_contexts, n);
+            if (n > 0)
+                num_used++;
+        }
+        KALDI_LOG << "Mapped " << num_contexts << " contexts to " << num_used
+                  << " pdfs in " << elapsed << " seconds(" << num_threads
+                  << " threads); at most " << max_contexts << " contexts per pdf, "
+                  << (num_used == 0 ? 0.0 : static_cast<double>(num_contexts) / num_used)
+                  << " on average, " << index.NumUnmapped() << " contexts not mapped";
+
+        Output ko(po.GetArg(3), binary);
+        index.Write(ko.Stream(), binary);
+
+        return 0;
+    }
+    catch (const std::exception& e) {
+        std::cerr << e.what();
+        return -1;
+    }
+}
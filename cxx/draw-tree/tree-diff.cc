@@ -0,0 +1,112 @@
+// bin/tree-diff.cc
+
+// Copyright 2012  Vassil Panayotov <vd.panayotov@gmail.com>
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#include "base/kaldi-common.h"
+#include "base/timer.h"
+#include "util/common-utils.h"
+#include "hmm/transition-model.h"
+#include "fst/fstlib.h"
+#include "decoder/tree-differ.h"
+#include "decoder/vis-model-cache.h"
+
+int main(int argc, char **argv)
+{
+    using namespace kaldi;
+    try {
+        const char *usage =
+                "Compares two phonetic states-tying trees(e.g. from consecutive training\n"
+                "passes): reports the questions that differ, the leaves that were split or\n"
+                "merged and the fraction of the contexts whose leaf changed\n"
+                "Usage: tree-diff [options] <phones-syms> <old-tree> <new-tree>\n"
+                "e.g.: tree-diff --model=exp/tri2/final.mdl data/phones.txt "
+                "exp/tri1/tree exp/tri2/tree\n";
+
+        std::string model_file;
+        std::string dot_wxfilename;
+        kaldi::int32 num_pdf_classes = 3;
+        kaldi::int32 max_items = 20;
+        bool enumerate = true;
+        ParseOptions po(usage);
+        po.Register("model", &model_file, "Transition model, used to get the phones "
+                    "and their numbers of HMM states(otherwise all the phones in "
+                    "<phones-syms> are used, with --num-pdf-classes states each)");
+        po.Register("num-pdf-classes", &num_pdf_classes, "Number of HMM states per "
+                    "phone, if no --model is given");
+        po.Register("dot-out", &dot_wxfilename, "Write the new tree in GraphViz "
+                    "format, with the changes highlighted");
+        po.Register("max-items", &max_items, "Maximum number of differences, split "
+                    "and merged leaves to list");
+        po.Register("enumerate", &enumerate, "Map all the contexts through both trees "
+                    "to find the split and merged leaves");
+        po.Read(argc, argv);
+
+        if (po.NumArgs() != 3) {
+            po.PrintUsage();
+            return 1;
+        }
+
+        std::string phnfile = po.GetArg(1);
+        std::string old_treefile = po.GetArg(2);
+        std::string new_treefile = po.GetArg(3);
+
+        VisModelCache &cache = VisModelCache::Default();
+        const fst::SymbolTable &phones_symtab = cache.GetSymbolTable(phnfile);
+        const ContextDependency &old_ctx_dep = cache.GetContextDependency(old_treefile);
+        const ContextDependency &new_ctx_dep = cache.GetContextDependency(new_treefile);
+
+        const kaldi::int32 P = new_ctx_dep.CentralPosition();
+        const kaldi::int32 N = new_ctx_dep.ContextWidth();
+        if (!((N == 3 && P == 1) || (N == 1 && P == 0))) {
+            std::cerr << "Only monophone and triphone trees are supported\n";
+            po.PrintUsage();
+            return 1;
+        }
+        if (old_ctx_dep.ContextWidth() != N || old_ctx_dep.CentralPosition() != P)
+            KALDI_ERR << "The trees have different context windows";
+
+        TreeDiffer differ(const_cast<EventMap&>(old_ctx_dep.ToPdfMap()),
+                          const_cast<EventMap&>(new_ctx_dep.ToPdfMap()),
+                          &phones_symtab, N, P);
+
+        Timer timer;
+        if (enumerate) {
+            // the central phones, grouped by their numbers of pdf classes
+            std::vector<int32> phones, phone_pdf_classes;
+            VisModelCache::Default().GetContextPhones(model_file, phones_symtab,
+                                                      num_pdf_classes, &phones,
+                                                      &phone_pdf_classes);
+            std::map<int32, std::vector<int32> > pdf_classes;
+            for (size_t i = 0; i < phones.size(); i++)
+                pdf_classes[phone_pdf_classes[i]].push_back(phones[i]);
+            differ.EnumerateContexts(pdf_classes);
+        }
+        if (dot_wxfilename.empty()) {
+            differ.CompareStructure();
+        } else {
+            Output ko(dot_wxfilename, false);
+            differ.CompareStructure(&ko.Stream());
+        }
+        differ.Report(std::cout, max_items);
+        KALDI_LOG << "Compared the trees in " << timer.Elapsed() << " seconds";
+
+        return 0;
+    }
+    catch (const std::exception& e) {
+        std::cerr << e.what();
+        return -1;
+    }
+}
@@ -0,0 +1,462 @@
+// decoder/tree-differ.h
+
+// Copyright 2012  Vassil Panayotov <vd.panayotov@gmail.com>
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef KALDI_DECODER_TREE_DIFFER_H_
+#define KALDI_DECODER_TREE_DIFFER_H_
+
+#include <algorithm>
+#include <map>
+#include <set>
+#include <utility>
+#include <vector>
+
+#include "base/kaldi-common.h"
+#include "tree/event-map.h"
+#include "fst/fstlib.h"
+
+namespace kaldi {
+
+/// Captures the contents of a single event map node without descending into
+/// its children. The visitor interface only lets us walk one tree at a time,
+/// so the nodes of the two trees are captured one by one and compared.
+struct EventMapNode: public EventMapVisitor
+{
+    enum Type { kConst, kSplit, kTable, kNull };
+
+    explicit EventMapNode(EventMap *map) :
+        type(kNull), key(0), answer(-1), yes_set(0), yes_map(0), no_map(0),
+        table(0)
+    {
+        if (map != 0)
+            map->Accept(*this);
+    }
+
+    virtual void VisitConst(const EventAnswerType &answer)
+    {
+        type = kConst;
+        this->answer = answer;
+    }
+
+    virtual void VisitSplit(EventKeyType &key,
+                            ConstIntegerSet<EventValueType> &yes_set,
+                            EventMap *yes_map,
+                            EventMap *no_map)
+    {
+        type = kSplit;
+        this->key = key;
+        this->yes_set = &yes_set;
+        this->yes_map = yes_map;
+        this->no_map = no_map;
+    }
+
+    virtual void VisitTable(const EventKeyType &key, std::vector<EventMap*> &table)
+    {
+        type = kTable;
+        this->key = key;
+        this->table = &table;
+    }
+
+    bool IsLeaf() const { return type == kConst || type == kNull; }
+
+    /// True if both nodes ask the same question(or are both leaves)
+    bool SameQuestion(const EventMapNode &other) const
+    {
+        if (type != other.type)
+            return IsLeaf() && other.IsLeaf();
+        if (type == kSplit)
+            return key == other.key &&
+                   yes_set->size() == other.yes_set->size() &&
+                   std::equal(yes_set->begin(), yes_set->end(),
+                              other.yes_set->begin());
+        if (type == kTable)
+            return key == other.key && table->size() == other.table->size();
+        return true;
+    }
+
+    Type type;
+    EventKeyType key;
+    EventAnswerType answer; // -1 for the NULL entries of the tables
+    const ConstIntegerSet<EventValueType> *yes_set;
+    EventMap *yes_map;
+    EventMap *no_map;
+    const std::vector<EventMap*> *table;
+};
+
+
+/// Compares two trees built over the same phone set(e.g. the trees of two
+/// consecutive training passes). The trees are walked in parallel: the nodes
+/// found at the same path in both trees are compared, and the first
+/// difference on each path is reported.
+/// As the pdf-ids of a retrained tree are numbered anew, the leaves are
+/// matched by the contexts they cover instead: all the (HMM state, left,
+/// central, right phone) contexts are enumerated and each is mapped through
+/// both trees. The enumeration is not done context by context, but on sets
+/// of contexts: the set is partitioned by the questions of the two trees, so
+/// the cost is proportional to the number of overlapping pairs of leaves,
+/// rather than to the cube of the number of phones.
+class TreeDiffer
+{
+public:
+    /// A question(or leaf) differing between the trees
+    struct Difference {
+        std::string path; // e.g. "Center=aa/yes/no"
+        std::string old_node;
+        std::string new_node;
+    };
+
+    TreeDiffer(EventMap &old_root, EventMap &new_root,
+               const fst::SymbolTable *phone_syms,
+               kaldi::int32 N, kaldi::int32 P) :
+        old_root_(old_root), new_root_(new_root), N(N), P(P),
+        phone_syms_(phone_syms), num_same_nodes_(0), num_new_nodes_(0),
+        num_contexts_(0), num_unchanged_(0)
+    {
+        KALDI_ASSERT(((N == 3 && P == 1) || (N == 1 && P == 0)) &&
+                     "Unsupported context window!");
+    }
+
+    /// Walks the trees in parallel and collects the differing questions.
+    /// If "dot" is not NULL the new tree is written to it in GraphViz format,
+    /// with the changes highlighted: the nodes whose question differs from
+    /// the old tree's in red, the nodes with no counterpart in the old tree
+    /// in blue and the leaves whose contexts changed filled in orange(the
+    /// latter only if EnumerateContexts() was called first).
+    void CompareStructure(std::ostream *dot = 0)
+    {
+        differences_.clear();
+        num_same_nodes_ = num_new_nodes_ = 0;
+        dot_ = dot;
+        next_id_ = 0;
+        if (dot_)
+            *dot_ << "digraph EventMapDiff {" << std::endl;
+        Walk(&old_root_, &new_root_, true, "", -1, "");
+        if (dot_)
+            *dot_ << '}' << std::endl;
+    }
+
+    /// Maps all contexts through both trees. "pdf_classes" gives for each
+    /// number of HMM states the central phones having it; the context phones
+    /// are all of these, plus 0(the utterance boundary).
+    void EnumerateContexts(
+            const std::map<kaldi::int32, std::vector<kaldi::int32> > &pdf_classes)
+    {
+        pair_counts_.clear();
+        std::vector<EventValueType> context(1, 0);
+        std::map<kaldi::int32, std::vector<kaldi::int32> >::const_iterator it;
+        for (it = pdf_classes.begin(); it != pdf_classes.end(); ++it)
+            context.insert(context.end(), it->second.begin(), it->second.end());
+        std::sort(context.begin(), context.end());
+        context.erase(std::unique(context.begin(), context.end()), context.end());
+
+        for (it = pdf_classes.begin(); it != pdf_classes.end(); ++it) {
+            Region region(N + 1); // indexed by key + 1; kPdfClass is -1
+            for (kaldi::int32 i = 0; i < it->first; i++)
+                region[0].push_back(i);
+            for (kaldi::int32 k = 0; k < N; k++)
+                region[k + 1] = (k == P ? std::vector<EventValueType>(
+                                     it->second.begin(), it->second.end())
+                                 : context);
+            std::sort(region[P + 1].begin(), region[P + 1].end());
+            Enumerate(&old_root_, &new_root_, &region);
+        }
+        Summarize();
+    }
+
+    /// Writes a summary of the differences found. At most "max_items"
+    /// entries are listed from each category.
+    void Report(std::ostream &os, kaldi::int32 max_items) const
+    {
+        os << "Nodes in the new tree: " << num_same_nodes_ << " same as in the old tree, "
+           << differences_.size() << " with a different question, "
+           << num_new_nodes_ << " below these" << std::endl;
+        for (size_t i = 0; i < differences_.size() &&
+                 static_cast<kaldi::int32>(i) < max_items; i++)
+            os << "  " << (differences_[i].path.empty() ? "<root>"
+                                                        : differences_[i].path)
+               << ": " << differences_[i].old_node << " -> "
+               << differences_[i].new_node << std::endl;
+        if (pair_counts_.empty())
+            return;
+
+        os << "Contexts: " << num_contexts_ << ", in a split or merged leaf: "
+           << (num_contexts_ - num_unchanged_) << " ("
+           << Percent(num_contexts_ - num_unchanged_) << "%)" << std::endl;
+        ReportLeaves(os, "Split leaves(old pdf -> new pdfs): ", old_to_new_,
+                     max_items);
+        ReportLeaves(os, "Merged leaves(new pdf <- old pdfs): ", new_to_old_,
+                     max_items);
+    }
+
+    const std::vector<Difference> &Differences() const { return differences_; }
+
+    kaldi::int64 NumContexts() const { return num_contexts_; }
+
+    /// The number of contexts whose leaf covers the same contexts in both trees
+    kaldi::int64 NumUnchangedContexts() const { return num_unchanged_; }
+
+private:
+    typedef std::vector<std::vector<EventValueType> > Region;
+    typedef std::map<EventAnswerType, std::set<EventAnswerType> > LeafMap;
+
+    /// Maps each context in "region" through both trees, one question at a
+    /// time: the old tree is descended first, then the new one.
+    void Enumerate(EventMap *old_map, EventMap *new_map, Region *region)
+    {
+        EventMapNode old_node(old_map);
+        bool old_side = !old_node.IsLeaf();
+        EventMapNode new_node(old_side ? 0 : new_map);
+        if (!old_side && new_node.IsLeaf()) {
+            kaldi::int64 count = 1;
+            for (size_t k = 0; k < region->size(); k++)
+                count *= (*region)[k].size();
+            pair_counts_[std::make_pair(old_node.answer, new_node.answer)] += count;
+            return;
+        }
+
+        const EventMapNode &node = old_side ? old_node : new_node;
+        if (node.key < kPdfClass || node.key >= N)
+            KALDI_ERR << "Unexpected key: " << node.key;
+        std::vector<EventValueType> &values = (*region)[node.key + 1];
+        std::vector<EventValueType> all;
+        all.swap(values);
+
+        // Groups the values by the child they lead to
+        std::map<EventMap*, std::vector<EventValueType> > parts;
+        for (size_t i = 0; i < all.size(); i++) {
+            EventMap *child = 0;
+            if (node.type == EventMapNode::kSplit)
+                child = node.yes_set->count(all[i]) ? node.yes_map : node.no_map;
+            else if (all[i] >= 0 &&
+                     static_cast<size_t>(all[i]) < node.table->size())
+                child = (*node.table)[all[i]];
+            parts[child].push_back(all[i]);
+        }
+        std::map<EventMap*, std::vector<EventValueType> >::iterator it;
+        for (it = parts.begin(); it != parts.end(); ++it) {
+            values.swap(it->second);
+            if (old_side)
+                Enumerate(it->first, new_map, region);
+            else
+                Enumerate(old_map, it->first, region);
+            values.swap(it->second);
+        }
+        values.swap(all);
+    }
+
+    /// Matches the leaves of the two trees by the contexts they share
+    void Summarize()
+    {
+        old_to_new_.clear();
+        new_to_old_.clear();
+        num_contexts_ = num_unchanged_ = 0;
+        std::map<std::pair<EventAnswerType, EventAnswerType>, kaldi::int64>::const_iterator it;
+        for (it = pair_counts_.begin(); it != pair_counts_.end(); ++it) {
+            old_to_new_[it->first.first].insert(it->first.second);
+            new_to_old_[it->first.second].insert(it->first.first);
+        }
+        for (it = pair_counts_.begin(); it != pair_counts_.end(); ++it) {
+            num_contexts_ += it->second;
+            if (LeafUnchanged(it->first.second))
+                num_unchanged_ += it->second;
+        }
+    }
+
+    /// True if the new leaf covers exactly the contexts of some old leaf
+    bool LeafUnchanged(EventAnswerType new_pdf) const
+    {
+        LeafMap::const_iterator it = new_to_old_.find(new_pdf);
+        if (it == new_to_old_.end() || it->second.size() != 1)
+            return false;
+        return old_to_new_.find(*it->second.begin())->second.size() == 1;
+    }
+
+    /// Describes the question asked at a node
+    std::string Describe(const EventMapNode &node) const
+    {
+        std::ostringstream oss;
+        if (node.type == EventMapNode::kNull)
+            return "none";
+        if (node.type == EventMapNode::kConst) {
+            oss << "leaf " << node.answer;
+            return oss.str();
+        }
+        oss << KeyName(node.key);
+        if (node.type == EventMapNode::kTable) {
+            oss << " = ?(table of " << node.table->size() << ')';
+            return oss.str();
+        }
+        oss << " in {";
+        ConstIntegerSet<EventValueType>::iterator it = node.yes_set->begin();
+        for (; it != node.yes_set->end(); ++it) {
+            if (it != node.yes_set->begin())
+                oss << ", ";
+            oss << ValueName(node.key, *it);
+        }
+        oss << '}';
+        return oss.str();
+    }
+
+    std::string KeyName(EventKeyType key) const
+    {
+        if (key == kPdfClass)
+            return "HMM state";
+        if (N == 1)
+            return "Phone";
+        if (key == 0)
+            return "LContext";
+        if (key == 1)
+            return "Center";
+        return "RContext";
+    }
+
+    std::string ValueName(EventKeyType key, EventValueType value) const
+    {
+        std::ostringstream oss;
+        if (key == kPdfClass || phone_syms_ == 0 ||
+            phone_syms_->Find(static_cast<kaldi::int64>(value)).empty())
+            oss << value;
+        else
+            oss << phone_syms_->Find(static_cast<kaldi::int64>(value));
+        return oss.str();
+    }
+
+    /// Compares the nodes at the same path in both trees. Below a difference
+    /// ("compare" is false) the new tree has no counterpart to compare with.
+    void Walk(EventMap *old_map, EventMap *new_map, bool compare,
+              const std::string &path, kaldi::int32 parent_id,
+              const std::string &edge_label)
+    {
+        EventMapNode old_node(old_map), new_node(new_map);
+        if (new_node.type == EventMapNode::kNull)
+            return;
+        const char *color = "black";
+        if (!compare) {
+            num_new_nodes_++;
+            color = "blue";
+        } else if (new_node.SameQuestion(old_node)) {
+            num_same_nodes_++;
+        } else {
+            Difference diff;
+            diff.path = path;
+            diff.old_node = Describe(old_node);
+            diff.new_node = Describe(new_node);
+            differences_.push_back(diff);
+            color = "red";
+            compare = false;
+        }
+
+        kaldi::int32 my_id = next_id_++;
+        if (dot_) {
+            if (parent_id >= 0)
+                *dot_ << '\t' << parent_id << " -> " << my_id
+                      << " [label=\"" << edge_label << "\"];" << std::endl;
+            *dot_ << my_id;
+            if (new_node.type == EventMapNode::kConst) {
+                bool changed = !pair_counts_.empty() &&
+                               !LeafUnchanged(new_node.answer);
+                *dot_ << " [shape=\"doublecircle\", label=" << new_node.answer
+                      << ", color=" << color;
+                if (changed)
+                    *dot_ << ", style=filled, fillcolor=orange, tooltip=\"was "
+                          << LeafList(new_to_old_, new_node.answer) << '\"';
+                *dot_ << "];" << std::endl;
+            } else {
+                *dot_ << " [label=\"" << KeyName(new_node.key) << " = ?\""
+                      << ", color=" << color
+                      << (compare ? "" : ", penwidth=3") << "];" << std::endl;
+            }
+        }
+
+        std::string prefix = path.empty() ? "" : path + "/";
+        if (new_node.type == EventMapNode::kSplit) {
+            std::ostringstream yes_label;
+            ConstIntegerSet<EventValueType>::iterator it = new_node.yes_set->begin();
+            for (; it != new_node.yes_set->end(); ++it)
+                yes_label << (it == new_node.yes_set->begin() ? "" : ", ")
+                          << ValueName(new_node.key, *it);
+            Walk(old_node.yes_map, new_node.yes_map, compare,
+                 prefix + "yes", my_id, yes_label.str());
+            Walk(old_node.no_map, new_node.no_map, compare,
+                 prefix + "no", my_id, "");
+        } else if (new_node.type == EventMapNode::kTable) {
+            for (size_t i = 0; i < new_node.table->size(); i++) {
+                std::string value = ValueName(new_node.key,
+                                              static_cast<EventValueType>(i));
+                Walk(compare ? (*old_node.table)[i] : 0, (*new_node.table)[i],
+                     compare, prefix + KeyName(new_node.key) + "=" + value,
+                     my_id, value);
+            }
+        }
+    }
+
+    std::string LeafList(const LeafMap &leaves, EventAnswerType pdf) const
+    {
+        std::ostringstream oss;
+        LeafMap::const_iterator it = leaves.find(pdf);
+        if (it == leaves.end())
+            return oss.str();
+        std::set<EventAnswerType>::const_iterator child = it->second.begin();
+        for (; child != it->second.end(); ++child)
+            oss << (child == it->second.begin() ? "" : " ") << *child;
+        return oss.str();
+    }
+
+    void ReportLeaves(std::ostream &os, const char *title, const LeafMap &leaves,
+                      kaldi::int32 max_items) const
+    {
+        kaldi::int32 count = 0;
+        std::ostringstream list;
+        LeafMap::const_iterator it;
+        for (it = leaves.begin(); it != leaves.end(); ++it) {
+            if (it->first == -1 || it->second.size() < 2)
+                continue; // contexts undefined in one of the trees
+            if (count++ < max_items)
+                list << "  " << it->first << ": "
+                     << LeafList(leaves, it->first) << std::endl;
+        }
+        os << title << count << std::endl << list.str();
+    }
+
+    double Percent(kaldi::int64 count) const
+    {
+        return num_contexts_ == 0 ? 0.0 : 100.0 * count / num_contexts_;
+    }
+
+    EventMap &old_root_;
+    EventMap &new_root_;
+    const kaldi::int32 N; // context length
+    const kaldi::int32 P; // central phone
+    const fst::SymbolTable *phone_syms_;
+
+    std::vector<Difference> differences_;
+    kaldi::int32 num_same_nodes_; // nodes asking the same question as in the old tree
+    kaldi::int32 num_new_nodes_; // nodes below a difference
+    std::ostream *dot_; // the DOT overlay goes here(if not NULL)
+    kaldi::int32 next_id_; // The next DOT node id to be assigned
+
+    // The number of contexts mapped to each (old pdf, new pdf) pair; the
+    // contexts undefined in a tree(NULL table entries) are mapped to -1.
+    std::map<std::pair<EventAnswerType, EventAnswerType>, kaldi::int64> pair_counts_;
+    LeafMap old_to_new_;
+    LeafMap new_to_old_;
+    kaldi::int64 num_contexts_;
+    kaldi::int64 num_unchanged_;
+}; // TreeDiffer
+
+} // namespace kaldi
+
+#endif // KALDI_DECODER_TREE_DIFFER_H_
@@ -0,0 +1,655 @@
+// decoder/tree-renderer.h
+
+// Copyright 2012  Vassil Panayotov <vd.panayotov@gmail.com>
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef KALDI_DECODER_TREE_RENDERER_H_
+#define KALDI_DECODER_TREE_RENDERER_H_
+
+#include <map>
+#include <set>
+#include <utility>
+#include <vector>
+
+#include "base/kaldi-common.h"
+#include "tree/event-map.h"
+#include "fst/fstlib.h"
+#include "decoder/graph-export-writer.h"
+
+namespace kaldi {
+
+/// Traverses the event map tree depth-first and spits out its GraphViz description.
+/// With SetDag(true) the structurally identical subtrees(same questions, same
+/// leaves) are drawn only once, so the output is a DAG instead of a tree.
+class TreeRenderer: public EventMapVisitor
+{
+public:
+    TreeRenderer(EventMap &root, const fst::SymbolTable *phone_syms,
+                 kaldi::int32 N, kaldi::int32 P,
+                 std::ostream &os = std::cout, kaldi::int32 subtree = 0) :
+        kColor_("black"), kTraceColor_("red"), kPen_(1), kTracePen_(3),
+        root_(root), N(N), P(P), phone_syms_(phone_syms), os_(os),
+        subtree_(subtree), next_id_(0), parent_id_(0),
+        export_format_(kGraphExportNone), dag_(false), dag_last_(-1),
+        dag_root_(-1)
+    {
+        KALDI_ASSERT(((N == 3 && P == 1) || (N == 1 && P == 0)) &&
+                     "Unsupported context window!");
+    }
+
+    /// Write the nodes and edges for interactive viewers(see
+    /// GraphExportWriter) instead of DOT; kGraphExportNone switches back
+    void SetExport(GraphExportFormat format) { export_format_ = format; }
+
+    /// Draw each distinct subtree once, with an edge from each of the nodes
+    /// it hangs from. The nodes are numbered in the order they are completed
+    /// (so the ids differ from those of the tree); --subtree still takes the
+    /// id in the tree.
+    void SetDag(bool dag) { dag_ = dag; }
+
+    void Render(const EventType *event = 0) {
+        event_ = event;
+        if (event != 0)
+            path_active_ = true;
+        else
+            path_active_ = false;
+        next_id_ = 0;
+        parent_id_ = 0;
+        in_subtree_ = (subtree_ == 0);
+
+        if (dag_) {
+            RenderDag();
+            return;
+        }
+        if (export_format_ != kGraphExportNone) {
+            export_writer_.Begin(os_, export_format_);
+            root_.Accept(*this);
+            export_writer_.End();
+        } else {
+            os_ << "digraph EventMap {" << std::endl;
+            root_.Accept(*this);
+            os_ << '}' << std::endl;
+        }
+        // the nodes are numbered 0 .. next_id_ - 1 in the order visited
+        if (subtree_ < 0 || subtree_ >= next_id_)
+            KALDI_WARN << "No node with id " << subtree_;
+    }
+
+    virtual void VisitSplit(EventKeyType &key,
+                            ConstIntegerSet<EventValueType> &yes_set,
+                            EventMap *yes_map,
+                            EventMap *no_map)
+    {
+        if (dag_) {
+            DagSplit(key, yes_set, yes_map, no_map);
+            return;
+        }
+        kaldi::int32 my_id = next_id_ ++;
+        bool entered = EnterSubtree(my_id);
+
+        // Draw this node and the input edge from its parent
+        DrawThisNode(my_id, key);
+
+        // Descend into this node's children
+        std::string yes_color(kColor_), no_color(kColor_);
+        kaldi::int32 yes_pen = kPen_, no_pen = kPen_;
+        bool yes_active = false;
+        bool active = path_active_;
+        if (event_ != 0 && path_active_) {
+            EventValueType value;
+            EventMap::Lookup(*event_, key, &value);
+            if (yes_set.count(value)) {
+                yes_color = kTraceColor_;
+                yes_active = true;
+                yes_pen = kTracePen_;
+            } else {
+                no_color = kTraceColor_;
+                no_pen = kTracePen_;
+            }
+        }
+
+        // "Yes" child
+        std::string yes_tooltip;
+        if (in_subtree_)
+            yes_tooltip = labels_[Question(key, yes_set)];
+        path_active_ = (active && yes_active);
+        parent_id_ = my_id;
+        std::ostringstream oss_yes;
+        oss_yes << "[color=" << yes_color
+                << ", label=\"" << yes_tooltip << '\"'
+                << ", penwidth=" << yes_pen
+                << "];";
+        edge_attr_ = oss_yes.str();
+        SetEdge(yes_tooltip, yes_color);
+        yes_map->Accept(*this);
+
+        // "No" child
+        path_active_ = (active && !yes_active);
+        parent_id_ = my_id;
+        std::ostringstream oss_no;
+        oss_no << "[color=" << no_color
+               << ", penwidth=" << no_pen << "];";
+        edge_attr_ = oss_no.str();
+        SetEdge("", no_color);
+        no_map->Accept(*this);
+
+        if (entered)
+            in_subtree_ = false;
+    }
+
+    virtual void VisitConst(const EventAnswerType &answer)
+    {
+        if (dag_) {
+            DagConst(answer);
+            return;
+        }
+        std::ostringstream oss;
+
+        kaldi::int32 id = next_id_++;
+        bool entered = EnterSubtree(id);
+        if (!in_subtree_)
+            return;
+        if (entered)
+            in_subtree_ = false;
+
+        std::string color = kColor_;
+        kaldi::int32 pen = kPen_;
+        if (path_active_) {
+            pen = kTracePen_;
+            color = kTraceColor_;
+        }
+
+        if (export_format_ != kGraphExportNone) {
+            if (parent_id_ >= 0 && id > subtree_)
+                ExportEdge(id);
+            std::ostringstream label;
+            label << answer;
+            int32 flags = kGraphExportFinal;
+            if (path_active_)
+                flags |= kGraphExportTraced;
+            if (id == subtree_)
+                flags |= kGraphExportStart;
+            export_writer_.AddNode(id, label.str(), color, flags);
+            return;
+        }
+
+        // Draw the edge from parent
+        if (parent_id_ >= 0 && id > subtree_)
+            oss << '\t' << parent_id_ << " -> " << id <<
+                   edge_attr_ << std::endl;
+
+        // Draw a leaf node
+        oss << id << "[shape=\"doublecircle\", label=" << answer
+            << ",color=" << color << ", penwidth=" << pen << "];";
+        os_ << oss.str() << std::endl;
+    }
+
+    virtual void VisitTable(const EventKeyType &key, std::vector<EventMap*> &table)
+    {
+        if (dag_) {
+            DagTable(key, table);
+            return;
+        }
+        kaldi::int32 my_id = next_id_ ++;
+        bool entered = EnterSubtree(my_id);
+
+        // Draw the node and the input edge from its parent
+        DrawThisNode(my_id, key);
+
+        // Descend into the event maps stored in table's entries
+        bool active = path_active_;
+        EventValueType value = -1;
+        if (event_)
+            EventMap::Lookup(*event_, key, &value);
+        for (int i = 0; i < table.size(); i++) {
+            if (table[i] == NULL)
+                continue;
+
+            std::string label = TableLabel(key, i);
+
+            path_active_ = false;
+            parent_id_ = my_id;
+            std::string color(kColor_);
+            kaldi::int32 pen = kPen_;
+            if (i == value && active) {
+                color = kTraceColor_;
+                path_active_ = true;
+                pen = kTracePen_;
+            }
+            std::ostringstream oss;
+            oss << "[color=" << color
+                << ", label=" << label
+                << ", penwidth=" << pen << "];";
+            edge_attr_ = oss.str();
+            SetEdge(label, color);
+            table[i]->Accept(*this);
+        }
+
+        if (entered)
+            in_subtree_ = false;
+    }
+
+private:
+
+    /// Marks the start of the subtree to be drawn(if "id" is its root).
+    /// Returns true if the subtree starts at this node.
+    bool EnterSubtree(kaldi::int32 id)
+    {
+        if (in_subtree_ || id != subtree_)
+            return false;
+        in_subtree_ = true;
+        return true;
+    }
+
+    void DrawThisNode(kaldi::int32 my_id, const EventKeyType &key)
+    {
+        if (!in_subtree_)
+            return;
+        std::ostringstream out;
+        std::string color = kColor_;
+        kaldi::int32 pen = kPen_;
+        if (path_active_ && event_) {
+            color = kTraceColor_;
+            pen = kTracePen_;
+        }
+
+        // Draw the incomming edge from this node's parent
+        if (my_id > subtree_ && export_format_ != kGraphExportNone)
+            ExportEdge(my_id);
+        else if (my_id > subtree_) // don't draw self-loop at the root
+            out << '\t' <<  parent_id_ << " -> " << my_id << edge_attr_ << std::endl;
+
+        // Draw the node itself
+        std::string label = KeyLabel(key);
+        if (export_format_ != kGraphExportNone) {
+            int32 flags = (color == kTraceColor_ ? kGraphExportTraced : 0);
+            if (my_id == subtree_)
+                flags |= kGraphExportStart;
+            // without the DOT quotes
+            export_writer_.AddNode(my_id, label.substr(1, label.size() - 2),
+                                   color, flags);
+            return;
+        }
+        out << my_id << " [label=" << label
+            << ", color=" << color
+            << ", penwidth=" << pen << "];";
+        os_ << out.str() << std::endl;
+    }
+
+    /// Keeps the label and color of the edge to the next node visited, for
+    /// the export(edge_attr_ holds the same for DOT)
+    void SetEdge(const std::string &label, const std::string &color)
+    {
+        edge_label_ = label;
+        edge_color_ = color;
+    }
+
+    void ExportEdge(kaldi::int32 id)
+    {
+        export_writer_.AddArc(parent_id_, id, edge_label_, edge_color_,
+                              edge_color_ == kTraceColor_ ?
+                              kGraphExportTraced : 0);
+    }
+
+    /// The label of a node asking about "key"(quoted, for DOT)
+    std::string KeyLabel(EventKeyType key) const
+    {
+        if (key == kPdfClass)
+            return "\"HMM state = ?\"";
+        if (key == 0)
+            return (N == 1 ? "\"Phone = ?\"" : "\"LContext = ?\"");
+        if (key == 1 && key < N)
+            return "\"Center = ?\"";
+        if (key == 2 && key < N)
+            return "\"RContext = ?\"";
+        KALDI_ERR << "Unexpected key: " << key;
+        return "";
+    }
+
+    /// The label of the edge to the "value"-th entry of a table
+    std::string TableLabel(EventKeyType key, kaldi::int32 value) const
+    {
+        std::ostringstream label;
+        if (key == kPdfClass) {
+            label << value;
+        }
+        else if (key < N) {
+            std::string phone = phone_syms_->Find(
+                        static_cast<kaldi::int64>(value));
+            if (phone.empty()) {
+                KALDI_ERR << "Invalid phone key!";
+            }
+            label << phone;
+        }
+        else {
+            KALDI_ERR << "Invalid event key!";
+        }
+        return label.str();
+    }
+
+    /// Returns the index in labels_ of the tooltip listing "yes_set". Large
+    /// trees ask the same questions at many nodes, so each tooltip is built
+    /// only once.
+    kaldi::int32 Question(EventKeyType key,
+                          const ConstIntegerSet<EventValueType> &yes_set)
+    {
+        std::vector<EventValueType> question;
+        question.reserve(yes_set.size() + 1);
+        question.push_back(key == kPdfClass ? 1 : 0);
+        question.insert(question.end(), yes_set.begin(), yes_set.end());
+        std::map<std::vector<EventValueType>, kaldi::int32>::iterator it =
+                questions_.find(question);
+        if (it != questions_.end())
+            return it->second;
+        kaldi::int32 index = labels_.size();
+        labels_.push_back(MakeYesTooltip(key, yes_set));
+        questions_[question] = index;
+        return index;
+    }
+
+    /// Returns the index of "label" in labels_, adding it if it is new
+    kaldi::int32 InternLabel(const std::string &label)
+    {
+        std::map<std::string, kaldi::int32>::iterator it =
+                label_index_.find(label);
+        if (it != label_index_.end())
+            return it->second;
+        kaldi::int32 index = labels_.size();
+        labels_.push_back(label);
+        label_index_[label] = index;
+        return index;
+    }
+
+    std::string MakeYesTooltip(EventKeyType key,
+                               const ConstIntegerSet<EventValueType> &yes_set)
+    {
+        std::ostringstream oss;
+        ConstIntegerSet<EventValueType>::iterator child = yes_set.begin();
+        for (; child != yes_set.end(); child ++) {
+            if (child != yes_set.begin())
+                oss << ", ";
+            if (key != kPdfClass) {
+                std::string phone =
+                        phone_syms_->Find(static_cast<kaldi::int64>(*child));
+                if (phone.empty())
+                    KALDI_ERR << "No phone found for Phone ID " << *child;
+                oss << phone;
+            }
+            else {
+                oss << *child;
+            }
+        }
+        return oss.str();
+    }
+
+    // The DAG mode: the tree is walked once, bottom-up, and each node is
+    // looked up by its signature - the key, the question and the ids of its
+    // children(or the answer, for a leaf) - so the identical subtrees get
+    // the same id. The distinct nodes are then drawn from the root of the
+    // (sub)tree.
+
+    struct DagEdge {
+        kaldi::int32 to;
+        kaldi::int32 label; // index in labels_, or -1
+        DagEdge(kaldi::int32 to, kaldi::int32 label): to(to), label(label) {}
+    };
+
+    struct DagNode {
+        std::string label; // quoted for DOT
+        bool leaf;
+        std::vector<DagEdge> edges;
+    };
+
+    /// Returns the id of the node with this signature, adding it(with the
+    /// given label and edges) if it is new
+    kaldi::int32 InternNode(const std::vector<kaldi::int32> &signature,
+                            const std::string &label, bool leaf,
+                            const std::vector<DagEdge> &edges)
+    {
+        std::map<std::vector<kaldi::int32>, kaldi::int32>::iterator it =
+                dag_index_.find(signature);
+        if (it != dag_index_.end())
+            return it->second;
+        kaldi::int32 id = dag_nodes_.size();
+        dag_nodes_.push_back(DagNode());
+        dag_nodes_.back().label = label;
+        dag_nodes_.back().leaf = leaf;
+        dag_nodes_.back().edges = edges;
+        dag_index_[signature] = id;
+        return id;
+    }
+
+    /// Called when the node with tree id "tree_id" gets the DAG id "id"
+    void DagVisited(kaldi::int32 tree_id, kaldi::int32 id, bool active)
+    {
+        if (active && event_)
+            dag_traced_nodes_.insert(id);
+        if (tree_id == subtree_)
+            dag_root_ = id;
+        dag_last_ = id;
+    }
+
+    void DagSplit(EventKeyType key, ConstIntegerSet<EventValueType> &yes_set,
+                  EventMap *yes_map, EventMap *no_map)
+    {
+        kaldi::int32 tree_id = next_id_++;
+        bool active = path_active_;
+        bool yes_active = false;
+        if (event_ != 0 && active) {
+            EventValueType value;
+            EventMap::Lookup(*event_, key, &value);
+            yes_active = (yes_set.count(value) != 0);
+        }
+        kaldi::int32 question = Question(key, yes_set);
+        path_active_ = (active && yes_active);
+        yes_map->Accept(*this);
+        kaldi::int32 yes = dag_last_;
+        path_active_ = (active && !yes_active);
+        no_map->Accept(*this);
+        kaldi::int32 no = dag_last_;
+        path_active_ = active;
+
+        std::vector<kaldi::int32> signature;
+        signature.push_back(kDagSplit);
+        signature.push_back(key);
+        signature.push_back(question);
+        signature.push_back(yes);
+        signature.push_back(no);
+        std::vector<DagEdge> edges;
+        edges.push_back(DagEdge(yes, question));
+        edges.push_back(DagEdge(no, -1));
+        kaldi::int32 id = InternNode(signature, KeyLabel(key), false, edges);
+        if (active && event_)
+            dag_traced_edges_.insert(std::make_pair(id, yes_active ? 0 : 1));
+        DagVisited(tree_id, id, active);
+    }
+
+    void DagConst(const EventAnswerType &answer)
+    {
+        kaldi::int32 tree_id = next_id_++;
+        std::vector<kaldi::int32> signature;
+        signature.push_back(kDagConst);
+        signature.push_back(answer);
+        std::ostringstream label;
+        label << answer;
+        kaldi::int32 id = InternNode(signature, label.str(), true,
+                                     std::vector<DagEdge>());
+        DagVisited(tree_id, id, path_active_);
+    }
+
+    void DagTable(const EventKeyType &key, std::vector<EventMap*> &table)
+    {
+        kaldi::int32 tree_id = next_id_++;
+        bool active = path_active_;
+        EventValueType value = -1;
+        if (event_)
+            EventMap::Lookup(*event_, key, &value);
+        std::vector<kaldi::int32> signature;
+        signature.push_back(kDagTable);
+        signature.push_back(key);
+        std::vector<DagEdge> edges;
+        kaldi::int32 traced_edge = -1;
+        for (kaldi::int32 i = 0; i < static_cast<kaldi::int32>(table.size()); i++) {
+            if (table[i] == NULL)
+                continue;
+            path_active_ = (active && i == value);
+            table[i]->Accept(*this);
+            if (path_active_)
+                traced_edge = edges.size();
+            signature.push_back(i);
+            signature.push_back(dag_last_);
+            edges.push_back(DagEdge(dag_last_,
+                                    InternLabel(TableLabel(key, i))));
+        }
+        path_active_ = active;
+        kaldi::int32 id = InternNode(signature, KeyLabel(key), false, edges);
+        if (traced_edge >= 0)
+            dag_traced_edges_.insert(std::make_pair(id, traced_edge));
+        DagVisited(tree_id, id, active);
+    }
+
+    void RenderDag()
+    {
+        dag_nodes_.clear();
+        dag_index_.clear();
+        dag_traced_nodes_.clear();
+        dag_traced_edges_.clear();
+        dag_root_ = -1;
+        root_.Accept(*this);
+        KALDI_VLOG(1) << "The tree has " << next_id_ << " nodes, of which "
+                      << dag_nodes_.size() << " are distinct, and "
+                      << labels_.size() << " distinct labels";
+        if (dag_root_ < 0)
+            KALDI_WARN << "No node with id " << subtree_;
+
+        if (export_format_ != kGraphExportNone)
+            export_writer_.Begin(os_, export_format_);
+        else
+            os_ << "digraph EventMap {" << std::endl;
+
+        // the nodes reachable from the root, each once
+        std::vector<bool> drawn(dag_nodes_.size(), false);
+        std::vector<kaldi::int32> stack;
+        if (dag_root_ >= 0) {
+            stack.push_back(dag_root_);
+            drawn[dag_root_] = true;
+        }
+        while (!stack.empty()) {
+            kaldi::int32 id = stack.back();
+            stack.pop_back();
+            DrawDagNode(id);
+            const DagNode &node = dag_nodes_[id];
+            for (size_t e = 0; e < node.edges.size(); e++) {
+                kaldi::int32 to = node.edges[e].to;
+                if (!drawn[to]) {
+                    drawn[to] = true;
+                    stack.push_back(to);
+                }
+            }
+        }
+
+        if (export_format_ != kGraphExportNone)
+            export_writer_.End();
+        else
+            os_ << '}' << std::endl;
+    }
+
+    /// Draws a node of the DAG and the edges to its children
+    void DrawDagNode(kaldi::int32 id)
+    {
+        const DagNode &node = dag_nodes_[id];
+        bool traced = (dag_traced_nodes_.count(id) != 0);
+        const std::string &color = (traced ? kTraceColor_ : kColor_);
+        if (export_format_ != kGraphExportNone) {
+            int32 flags = (traced ? kGraphExportTraced : 0);
+            if (node.leaf)
+                flags |= kGraphExportFinal;
+            if (id == dag_root_)
+                flags |= kGraphExportStart;
+            export_writer_.AddNode(id, node.leaf ? node.label :
+                                   node.label.substr(1, node.label.size() - 2),
+                                   color, flags);
+        } else {
+            os_ << id << " [";
+            if (node.leaf)
+                os_ << "shape=\"doublecircle\", ";
+            os_ << "label=" << node.label << ", color=" << color
+                << ", penwidth=" << (traced ? kTracePen_ : kPen_) << "];"
+                << std::endl;
+        }
+        for (size_t e = 0; e < node.edges.size(); e++) {
+            const DagEdge &edge = node.edges[e];
+            bool edge_traced =
+                    (dag_traced_edges_.count(std::make_pair(id, e)) != 0);
+            const std::string &edge_color = (edge_traced ? kTraceColor_ : kColor_);
+            if (export_format_ != kGraphExportNone) {
+                export_writer_.AddArc(id, edge.to,
+                                      edge.label < 0 ? "" : labels_[edge.label],
+                                      edge_color,
+                                      edge_traced ? kGraphExportTraced : 0);
+                continue;
+            }
+            os_ << '\t' << id << " -> " << edge.to << " [color=" << edge_color;
+            if (edge.label >= 0)
+                os_ << ", label=\"" << labels_[edge.label] << '\"';
+            os_ << ", penwidth=" << (edge_traced ? kTracePen_ : kPen_) << "];"
+                << std::endl;
+        }
+    }
+
+    enum { kDagConst, kDagSplit, kDagTable }; // the kinds of the DAG nodes
+
+    const std::string kColor_;
+    const std::string kTraceColor_;
+    const kaldi::int32 kPen_;
+    const kaldi::int32 kTracePen_; // GraphViz pen width for the "traced" path
+
+    EventMap &root_; // the root of the tree
+    const kaldi::int32 N; // context length
+    const kaldi::int32 P; // central phone
+    const EventType *event_; // the 'event' to be traced (0 means "don't trace")
+    const fst::SymbolTable *phone_syms_;
+    std::ostream &os_; // the DOT output goes here
+    const kaldi::int32 subtree_; // the id of the root of the subtree to be drawn
+    bool in_subtree_; // True while visiting the nodes of the subtree to be drawn
+
+    kaldi::int32 next_id_; // The next node id to be assigned
+    kaldi::int32 parent_id_; // The id of the current node's parent
+    std::string edge_attr_; // The attributes of the edge to current node from its parent
+    std::string edge_label_; // The label and color of the same edge, for the export
+    std::string edge_color_;
+    GraphExportFormat export_format_; // kGraphExportNone unless exporting
+    GraphExportWriter export_writer_;
+    bool path_active_; // True if the current node is traversed when tracing an event through the tree
+
+    // the tooltips of the questions and the labels of the table edges, each
+    // built once; indexed by questions_(the key kind followed by the yes-set)
+    // and by label_index_
+    std::vector<std::string> labels_;
+    std::map<std::vector<EventValueType>, kaldi::int32> questions_;
+    std::map<std::string, kaldi::int32> label_index_;
+
+    bool dag_; // draw the distinct subtrees only once
+    std::vector<DagNode> dag_nodes_;
+    std::map<std::vector<kaldi::int32>, kaldi::int32> dag_index_; // by signature
+    std::set<kaldi::int32> dag_traced_nodes_;
+    std::set<std::pair<kaldi::int32, size_t> > dag_traced_edges_; // (node, edge)
+    kaldi::int32 dag_last_; // the DAG id of the node visited last
+    kaldi::int32 dag_root_; // the DAG id of the root of the (sub)tree drawn
+}; // TreeRenderer
+
+} // namespace kaldi
+
+#endif // KALDI_DECODER_TREE_RENDERER_H_
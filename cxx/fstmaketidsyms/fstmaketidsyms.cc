@@ -19,6 +19,8 @@
 #include "fst/fstlib.h"
 #include "fstext/fstext-utils.h"
 #include "fstext/context-fst.h"
+#include "decoder/vis-model-cache.h"
+#include "decoder/tid-index.h"
 
 int main(int argc, char **argv)
 {
@@ -27,38 +29,49 @@ int main(int argc, char **argv)
         std::string sep = "_";
         bool verbose = false;
         bool show_tids = false;
+        std::string ilabels_file, context_syms_file, index_file;
+        std::string context_sep = "/", initial_disambig = "#-1";
         const char *usage = "Outputs symbolic names for all transition ids"
                 "(can be used in graph visualizations)\n"
                 "The format of the output is phone_hmm-state_pdfid_transidx tid"
-                "(assuming the separator is \'_\')\n\n"
-                "Usage: fstmaketidsyms [options] phones model [out_tid_symtab]\n";
+                "(assuming the separator is \'_\')\n"
+                "Optionally, in the same run, writes the symbols for the context-dependent\n"
+                "phones(as fstmakecontextsyms) and an index from pdfs, phones and\n"
+                "transition states to transition ids\n\n"
+                "Usage: fstmaketidsyms [options] phones model [out_tid_symtab]\n"
+                "e.g.: fstmaketidsyms --ilabels=exp/graph_tri1/ilabels "
+                "--context-syms-out=context_syms.txt --index-out=final.tidx "
+                "data/phones_disambig.txt exp/tri1/final.mdl transid_syms.txt\n";
         ParseOptions po(usage);
         po.Register("separator", &sep, "The symbol to be used as separator b/w tid's constituents");
         po.Register("verbose-output", &verbose, "Verbose output to stderr?");
         po.Register("show-tids", &show_tids, "Also show the transitions IDs");
+        po.Register("ilabels", &ilabels_file, "The ilabel info of the context FST"
+                    "(as written by fstcomposecontext), for --context-syms-out");
+        po.Register("context-syms-out", &context_syms_file, "Write the symbol table "
+                    "of the context-dependent phones to this file");
+        po.Register("context-separator", &context_sep, "Separator for the phones "
+                    "of a context, in --context-syms-out");
+        po.Register("initial-disambig", &initial_disambig, "Name of the initial "
+                    "disambiguation symbol, in --context-syms-out");
+        po.Register("index-out", &index_file, "Write an index from pdfs, phones and "
+                    "transition states to transition ids to this file(binary, "
+                    "meant to be mmap()-ed; see tid-lookup)");
         po.Read(argc, argv);
         if (po.NumArgs() < 2 || po.NumArgs() > 3) {
             po.PrintUsage();
             exit(1);
         }
+        if (context_syms_file.empty() != ilabels_file.empty())
+            KALDI_ERR << "--ilabels and --context-syms-out go together";
 
         std::string phnfile = po.GetArg(1);
         std::string mdlfile = po.GetArg(2);
         std::string tidsymfile = po.GetOptArg(3);
 
-        TransitionModel trans_model;
-        {
-            bool binary;
-            Input ki(mdlfile, &binary);
-            trans_model.Read(ki.Stream(), binary);
-        }
-
-        fst::SymbolTable *phones_symtab = NULL;
-        {   // read phone symbol table.
-            std::ifstream is(phnfile.c_str());
-            phones_symtab = ::fst::SymbolTable::ReadText(is, phnfile);
-            if (!phones_symtab) KALDI_ERR << "Could not read phones symbol-table file "<< phnfile;
-        }
+        VisModelCache &cache = VisModelCache::Default();
+        const TransitionModel &trans_model = cache.GetTransitionModel(mdlfile);
+        const fst::SymbolTable *phones_symtab = &cache.GetSymbolTable(phnfile);
 
         if (verbose)
             KALDI_LOG << "#phones: " << trans_model.GetPhones().size();
@@ -90,6 +103,20 @@ int main(int argc, char **argv)
         else
             tidsymtab.WriteText(tidsymfile);
 
+        if (!context_syms_file.empty()) {
+            bool binary;
+            Input ki(ilabels_file, &binary);
+            std::vector<std::vector<kaldi::int32> > ilabel_info;
+            fst::ReadILabelInfo(ki.Stream(), binary, &ilabel_info);
+            fst::SymbolTable *ctx_symtab = fst::CreateILabelInfoSymbolTable(
+                        ilabel_info, *phones_symtab, context_sep, initial_disambig);
+            ctx_symtab->WriteText(context_syms_file);
+            delete ctx_symtab;
+        }
+
+        if (!index_file.empty())
+            WriteTidIndex(trans_model, index_file);
+
         return 0;
     }
     catch (const std::exception& e) {
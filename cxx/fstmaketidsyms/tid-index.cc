@@ -0,0 +1,186 @@
+// decoder/tid-index.cc
+
+// Copyright 2012  Vassil Panayotov <vd.panayotov@gmail.com>
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include "decoder/tid-index.h"
+
+namespace kaldi {
+
+namespace {
+
+const char kTidIndexMagic[8] = { 'K', 'V', 'T', 'I', 'D', 'I', 'X', 0 };
+const int32 kTidIndexVersion = 1;
+const uint32 kTidIndexByteOrder = 0x01020304;
+
+/// Builds the CSR rows of a map from the key of each tid(keys[0] is unused)
+void BuildTidMap(const std::vector<int32> &keys, int32 num_keys,
+                 std::vector<int32> *offsets, std::vector<int32> *tids) {
+  offsets->assign(num_keys + 1, 0);
+  for (size_t tid = 1; tid < keys.size(); tid++)
+    (*offsets)[keys[tid] + 1]++;
+  for (int32 k = 0; k < num_keys; k++)
+    (*offsets)[k + 1] += (*offsets)[k];
+  tids->resize(keys.size() - 1);
+  std::vector<int32> next(offsets->begin(), offsets->end() - 1);
+  // the tids are visited in increasing order, so each row ends up sorted
+  for (size_t tid = 1; tid < keys.size(); tid++)
+    (*tids)[next[keys[tid]]++] = tid;
+}
+
+void WriteOrDie(const void *data, size_t size, FILE *file,
+                const std::string &filename) {
+  if (size > 0 && fwrite(data, size, 1, file) != 1)
+    KALDI_ERR << "Error writing transition-id index " << filename;
+}
+
+}  // namespace
+
+
+void WriteTidIndex(const TransitionModel &trans_model,
+                   const std::string &filename) {
+  int32 num_tids = trans_model.NumTransitionIds();
+  std::vector<TidInfo> info(num_tids + 1);
+  memset(&info[0], 0, sizeof(TidInfo));
+  std::vector<int32> keys[kNumTidIndexMaps];
+  for (int32 m = 0; m < kNumTidIndexMaps; m++)
+    keys[m].assign(num_tids + 1, 0);
+  int32 num_keys[kNumTidIndexMaps] = { 0, 0, 0 };
+  for (int32 tid = 1; tid <= num_tids; tid++) {
+    TidInfo &ti = info[tid];
+    ti.phone = trans_model.TransitionIdToPhone(tid);
+    ti.hmm_state = trans_model.TransitionIdToHmmState(tid);
+    ti.pdf = trans_model.TransitionIdToPdf(tid);
+    ti.transition_index = trans_model.TransitionIdToTransitionIndex(tid);
+    ti.transition_state = trans_model.TransitionIdToTransitionState(tid);
+    keys[kPdfToTids][tid] = ti.pdf;
+    keys[kPhoneToTids][tid] = ti.phone;
+    keys[kTransitionStateToTids][tid] = ti.transition_state;
+    for (int32 m = 0; m < kNumTidIndexMaps; m++)
+      num_keys[m] = std::max(num_keys[m], keys[m][tid] + 1);
+  }
+
+  TidIndexHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, kTidIndexMagic, sizeof(header.magic));
+  header.version = kTidIndexVersion;
+  header.byte_order = kTidIndexByteOrder;
+  header.num_tids = num_tids;
+  header.info_offset = sizeof(header);
+  int64 offset = header.info_offset + info.size() * sizeof(TidInfo);
+  std::vector<int32> offsets[kNumTidIndexMaps], tids[kNumTidIndexMaps];
+  for (int32 m = 0; m < kNumTidIndexMaps; m++) {
+    BuildTidMap(keys[m], num_keys[m], &offsets[m], &tids[m]);
+    header.num_keys[m] = num_keys[m];
+    header.map_offsets[m] = offset;
+    offset += (offsets[m].size() + tids[m].size()) * sizeof(int32);
+  }
+
+  FILE *file = fopen(filename.c_str(), "wb");
+  if (file == NULL)
+    KALDI_ERR << "Could not open " << filename << " for writing";
+  WriteOrDie(&header, sizeof(header), file, filename);
+  WriteOrDie(&info[0], info.size() * sizeof(TidInfo), file, filename);
+  for (int32 m = 0; m < kNumTidIndexMaps; m++) {
+    WriteOrDie(&offsets[m][0], offsets[m].size() * sizeof(int32), file,
+               filename);
+    if (!tids[m].empty())
+      WriteOrDie(&tids[m][0], tids[m].size() * sizeof(int32), file, filename);
+  }
+  if (fclose(file) != 0)
+    KALDI_ERR << "Error writing transition-id index " << filename;
+}
+
+
+void TidIndexReader::Open(const std::string &filename) {
+  Close();
+  filename_ = filename;
+  int fd = open(filename.c_str(), O_RDONLY);
+  if (fd < 0)
+    KALDI_ERR << "Could not open transition-id index " << filename;
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size < (off_t) sizeof(TidIndexHeader)) {
+    close(fd);
+    KALDI_ERR << "Invalid transition-id index " << filename;
+  }
+  void *data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);  // the mapping stays valid
+  if (data == MAP_FAILED)
+    KALDI_ERR << "Could not mmap transition-id index " << filename;
+  data_ = static_cast<char*>(data);
+  size_ = st.st_size;
+
+  header_ = reinterpret_cast<const TidIndexHeader*>(data_);
+  if (memcmp(header_->magic, kTidIndexMagic, sizeof(header_->magic)) != 0 ||
+      header_->version != kTidIndexVersion) {
+    Close();
+    KALDI_ERR << "Not a transition-id index(or unsupported version): "
+              << filename;
+  }
+  if (header_->byte_order != kTidIndexByteOrder) {
+    Close();
+    KALDI_ERR << "Transition-id index " << filename << " was written on a "
+              << "machine with a different byte order";
+  }
+  int64 end = header_->info_offset +
+      (header_->num_tids + 1) * static_cast<int64>(sizeof(TidInfo));
+  for (int32 m = 0; m < kNumTidIndexMaps; m++) {
+    int64 map_end = header_->map_offsets[m] + sizeof(int32) *
+        (static_cast<int64>(header_->num_keys[m]) + 1 + header_->num_tids);
+    end = std::max(end, map_end);
+  }
+  if (end > static_cast<int64>(size_)) {
+    Close();
+    KALDI_ERR << "Truncated transition-id index " << filename;
+  }
+  info_ = reinterpret_cast<const TidInfo*>(data_ + header_->info_offset);
+  for (int32 m = 0; m < kNumTidIndexMaps; m++) {
+    offsets_[m] = reinterpret_cast<const int32*>(data_ +
+                                                 header_->map_offsets[m]);
+    tids_[m] = offsets_[m] + header_->num_keys[m] + 1;
+  }
+}
+
+void TidIndexReader::Close() {
+  if (data_ != NULL)
+    munmap(data_, size_);
+  data_ = NULL;
+  size_ = 0;
+  header_ = NULL;
+  info_ = NULL;
+}
+
+const int32 *TidIndexReader::Tids(TidIndexMap map, int32 key,
+                                  int32 *num_tids) const {
+  KALDI_ASSERT(map >= 0 && map < kNumTidIndexMaps);
+  if (key < 0 || key >= header_->num_keys[map]) {
+    *num_tids = 0;
+    return NULL;
+  }
+  const int32 *offsets = offsets_[map];
+  *num_tids = offsets[key + 1] - offsets[key];
+  return tids_[map] + offsets[key];
+}
+
+}  // end namespace kaldi
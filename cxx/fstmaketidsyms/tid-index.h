@@ -0,0 +1,108 @@
+// decoder/tid-index.h
+
+// Copyright 2012  Vassil Panayotov <vd.panayotov@gmail.com>
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef KALDI_DECODER_TID_INDEX_H_
+#define KALDI_DECODER_TID_INDEX_H_
+
+#include <string>
+
+#include "base/kaldi-common.h"
+#include "hmm/transition-model.h"
+
+namespace kaldi {
+
+// An index of the transition-ids of a model, meant to be mmap()-ed and used
+// in place.
+//
+// Layout (all integers in native byte order; the header records it):
+//   TidIndexHeader
+//   TidInfo[num_tids + 1]      indexed by transition-id(entry 0 is unused)
+//   for each TidIndexMap:
+//     int32[num_keys + 1]      the offsets of the keys' tids(CSR rows)
+//     int32[num_tids]          the tids, sorted within each key
+// The tids of key k are at [offsets[k], offsets[k + 1]), so each lookup is
+// two reads.
+
+enum TidIndexMap {
+  kPdfToTids = 0,
+  kPhoneToTids,
+  kTransitionStateToTids,   // the transition states(phone, HMM state, pdf)
+  kNumTidIndexMaps
+};
+
+struct TidIndexHeader {
+  char magic[8];            // "KVTIDIX\0"
+  int32 version;
+  uint32 byte_order;        // kTidIndexByteOrder, as written
+  int32 num_tids;
+  int32 num_keys[kNumTidIndexMaps];
+  int64 info_offset;
+  int64 map_offsets[kNumTidIndexMaps];
+};
+
+struct TidInfo {
+  int32 phone;
+  int32 hmm_state;
+  int32 pdf;
+  int32 transition_index;
+  int32 transition_state;
+};
+
+/// Writes the index of all the transition-ids of the model to a file(which
+/// has to be a regular file, not a pipe)
+void WriteTidIndex(const TransitionModel &trans_model,
+                   const std::string &filename);
+
+/// Maps a transition-id index in memory
+class TidIndexReader {
+ public:
+  TidIndexReader(): data_(NULL), size_(0), header_(NULL), info_(NULL) {}
+  ~TidIndexReader() { Close(); }
+
+  void Open(const std::string &filename);
+  void Close();
+
+  int32 NumTids() const { return header_->num_tids; }
+
+  /// The number of keys(pdfs, phones, transition states) of a map; the
+  /// phones and the transition states start at 1, so key 0 has no tids.
+  int32 NumKeys(TidIndexMap map) const { return header_->num_keys[map]; }
+
+  const TidInfo &Info(int32 tid) const {
+    KALDI_ASSERT(tid > 0 && tid <= NumTids());
+    return info_[tid];
+  }
+
+  /// Returns the tids of "key" and sets "*num_tids" to their number(0 if
+  /// the key is out of range)
+  const int32 *Tids(TidIndexMap map, int32 key, int32 *num_tids) const;
+
+ private:
+  std::string filename_;
+  char *data_;
+  size_t size_;
+  const TidIndexHeader *header_;
+  const TidInfo *info_;
+  const int32 *offsets_[kNumTidIndexMaps];
+  const int32 *tids_[kNumTidIndexMaps];
+
+  KALDI_DISALLOW_COPY_AND_ASSIGN(TidIndexReader);
+};
+
+}  // end namespace kaldi
+
+#endif  // KALDI_DECODER_TID_INDEX_H_
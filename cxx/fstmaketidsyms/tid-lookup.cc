@@ -0,0 +1,78 @@
+// Copyright 2012  Vassil Panayotov <vd.panayotov@gmail.com>
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#include "base/kaldi-common.h"
+#include "util/common-utils.h"
+#include "decoder/tid-index.h"
+
+int main(int argc, char **argv)
+{
+    using namespace kaldi;
+    try {
+        const char *usage = "Looks up transition ids in an index written by "
+                "fstmaketidsyms --index-out\n"
+                "For \"tid\" prints the phone, HMM state, pdf, transition index and "
+                "transition state of each id; for the other kinds the transition ids "
+                "of each pdf/phone/transition state, one line per id\n\n"
+                "Usage: tid-lookup <index> <tid|pdf|phone|state> <id1> [<id2> ...]\n"
+                "e.g.: tid-lookup exp/tri1/final.tidx pdf 1234\n";
+        ParseOptions po(usage);
+        po.Read(argc, argv);
+        if (po.NumArgs() < 3) {
+            po.PrintUsage();
+            exit(1);
+        }
+
+        TidIndexReader index;
+        index.Open(po.GetArg(1));
+        std::string kind = po.GetArg(2);
+        TidIndexMap map = kNumTidIndexMaps;
+        if (kind == "pdf")
+            map = kPdfToTids;
+        else if (kind == "phone")
+            map = kPhoneToTids;
+        else if (kind == "state")
+            map = kTransitionStateToTids;
+        else if (kind != "tid")
+            KALDI_ERR << "Unknown kind of id \"" << kind << '"';
+
+        for (int32 i = 3; i <= po.NumArgs(); i++) {
+            int32 id;
+            if (!ConvertStringToInteger(po.GetArg(i), &id))
+                KALDI_ERR << "Invalid id " << po.GetArg(i);
+            if (map == kNumTidIndexMaps && (id <= 0 || id > index.NumTids()))
+                KALDI_ERR << "Transition id " << id << " is out of range";
+            std::cout << id;
+            if (map == kNumTidIndexMaps) {
+                const TidInfo &info = index.Info(id);
+                std::cout << ' ' << info.phone << ' ' << info.hmm_state << ' '
+                          << info.pdf << ' ' << info.transition_index << ' '
+                          << info.transition_state;
+            } else {
+                int32 num_tids;
+                const int32 *tids = index.Tids(map, id, &num_tids);
+                for (int32 j = 0; j < num_tids; j++)
+                    std::cout << ' ' << tids[j];
+            }
+            std::cout << std::endl;
+        }
+
+        return 0;
+    }
+    catch (const std::exception& e) {
+        std::cerr << e.what();
+        return -1;
+    }
+}
@@ -13,120 +13,221 @@
 // See the Apache 2 License for the specific language governing permissions and
 // limitations under the License.
 
+#include <sys/stat.h>
 #include <iostream>
 #include <exception>
+#include <map>
 
 #include <util/common-utils.h>
 #include <matrix/matrix-lib.h>
+#include <feat/feature-functions.h>
+#include <feat/sphinx-feat-holder.h>
+#include <transform/cmvn.h>
+#include <util/sharded-table-writer.h>
+#include <util/trace-events.h>
 
 namespace kaldi {
 
-/// As far as I understand from sphinx_fe's code it writes big endian float MFCCs
-/// SphinxFeatHolder assumes that the floating point byte-order is the same
-/// as the integer byte-order.
-/// The template parameters are more about documenting assumptions, than anything else.
-template <typename FeatType=float, int fvec_len=13, bool be_feats=true, bool be_machine=false>
-class SphinxFeatHolder {
+typedef ShardedTableWriter<KaldiObjectHolder<Matrix<BaseFloat> > >
+        ShardedMatrixWriter;
+
+/// Gets the keys and the numbers of frames of the feature files listed in a
+/// script rspecifier, from the files' sizes. Returns false if a size is not
+/// known(e.g. the features come from a pipe).
+bool GetSphinxFrameCounts(const std::string &rspec, int32 fvec_len,
+                          std::vector<std::string> *keys,
+                          std::vector<double> *frames) {
+    std::string rxfilename;
+    RspecifierOptions opts;
+    if (ClassifyRspecifier(rspec, &rxfilename, &opts) != kScriptRspecifier)
+        return false;
+    std::vector<std::pair<std::string, std::string> > script;
+    if (!ReadScriptFile(rxfilename, true, &script))
+        KALDI_ERR << "Could not read the script file " << rxfilename;
+    keys->clear();
+    frames->clear();
+    for (size_t i = 0; i < script.size(); i++) {
+        struct stat st;
+        if (stat(script[i].second.c_str(), &st) != 0 || !S_ISREG(st.st_mode))
+            return false;
+        // a 4-byte header, followed by the vectors of floats
+        keys->push_back(script[i].first);
+        frames->push_back(static_cast<double>(st.st_size - 4) /
+                          (fvec_len * sizeof(float)));
+    }
+    return true;
+}
+
+struct PackFeatsOptions {
+    bool add_deltas;
+    DeltaFeaturesOptions delta_opts;
+    bool apply_cmvn;
+    bool norm_vars;
+
+    PackFeatsOptions(): add_deltas(false), apply_cmvn(false), norm_vars(false) {}
+};
+
+/// Post-processes the features while they are packed: accumulates their CMVN
+/// statistics, optionally applies CMVN and adds deltas, and writes them out.
+/// Per-speaker CMVN takes two passes over the input: AccStats() is called for
+/// all the utterances first, and then FinishStats(), after which Pack()
+/// normalizes each utterance as soon as it is read. Otherwise Pack() is all
+/// that is needed, and the statistics of a speaker are written once all of
+/// the speaker's utterances are read.
+class SphinxFeatPacker {
 public:
-    typedef Matrix<FeatType> T;
+    SphinxFeatPacker(const PackFeatsOptions &opts, ShardedMatrixWriter *writer,
+                     DoubleMatrixWriter *utt_stats_writer,
+                     DoubleMatrixWriter *spk_stats_writer):
+        opts_(opts), writer_(writer), utt_stats_writer_(utt_stats_writer),
+        spk_stats_writer_(spk_stats_writer), stats_done_(false), num_frames_(0) {}
 
-    SphinxFeatHolder(): feats_(0) {}
+    ~SphinxFeatPacker() {
+        std::map<std::string, Speaker*>::iterator it = speakers_.begin();
+        for (; it != speakers_.end(); ++it)
+            delete it->second;
+    }
 
-    /// Read a sphinx feature file
-    bool Read(std::istream &is) {
-        int nmfcc;
-        try {
-            if (feats_) {
-                delete feats_;
-                feats_ = 0;
-            }
-            is.read((char*) &nmfcc, sizeof(nmfcc));
-            if (be_feats != be_machine)
-                nmfcc = swap(nmfcc);
-            KALDI_VLOG(2) << "#feats: " << nmfcc;
-
-            int nfvec = nmfcc / fvec_len;
-            KALDI_ASSERT((nmfcc % fvec_len) == 0);
-            feats_ = new T(nfvec, fvec_len);
-            for (int i = 0; i < nfvec; i++) {
-                if (!is.read((char*) feats_->RowData(i), fvec_len * sizeof(FeatType))) {
-                    KALDI_ERR << "Unexpected EOF" << std::endl;
-                    return false;
-                }
-
-                if (be_feats != be_machine) {
-                    FeatType *f = feats_->RowData(i);
-                    for (int j=0; j < fvec_len; j++) {
-                        f[j] = swap(f[j]);
-                    }
-                }
+    /// Reads the utterances of each speaker
+    void ReadSpk2Utt(const std::string &rspec) {
+        SequentialTokenVectorReader reader(rspec);
+        for (; !reader.Done(); reader.Next()) {
+            const std::string &spk = reader.Key();
+            const std::vector<std::string> &utts = reader.Value();
+            if (speakers_.count(spk) != 0)
+                KALDI_ERR << "Speaker " << spk << " is listed twice";
+            Speaker *speaker = new Speaker;
+            speaker->num_pending = utts.size();
+            speakers_[spk] = speaker;
+            for (size_t i = 0; i < utts.size(); i++) {
+                if (!utt2spk_.insert(std::make_pair(utts[i], spk)).second)
+                    KALDI_ERR << "Utterance " << utts[i] << " has more than one speaker";
             }
         }
-        catch(std::exception e) {
-            KALDI_ERR << e.what() << std::endl;
-            return false;
-        }
+    }
 
-        return true;
+    /// The first pass of per-speaker CMVN: adds an utterance to the statistics
+    /// of its speaker, without writing anything
+    void AccStats(const std::string &key, const Matrix<BaseFloat> &feats) {
+        KALDI_ASSERT(!stats_done_);
+        std::map<std::string, std::string>::const_iterator spk = utt2spk_.find(key);
+        if (spk != utt2spk_.end())
+            AccSpeakerStats(key, spk->second, feats);
     }
 
-    /// Write a Sphinx-format feature file
-    static bool Write(std::ostream& os, bool binary, const T& m) {
-        if (!binary) {
-            KALDI_ERR << "Can't write Sphinx features in text" << std::endl;
-            return false;
+    /// Ends the first pass and writes the statistics of the speakers
+    void FinishStats() {
+        WritePendingStats();
+        stats_done_ = true;
+    }
+
+    void Pack(const std::string &key, const Matrix<BaseFloat> &feats) {
+        num_frames_ += feats.NumRows();
+        Matrix<double> utt_stats;
+        if (utt_stats_writer_ != NULL ||
+            (opts_.apply_cmvn && utt2spk_.count(key) == 0)) {
+            InitCmvnStats(feats.NumCols(), &utt_stats);
+            AccCmvnStats(feats, NULL, &utt_stats);
+            if (utt_stats_writer_ != NULL)
+                utt_stats_writer_->Write(key, utt_stats);
         }
 
-        try {
-            int rows = m.NumRows();
-            int head = (be_feats == be_machine)? rows: swap(rows);
-            os.write((char*) head, sizeof(head));
-            for (int i = 0; i < rows; i++) {
-                os.write((char*) m.RowData(i), fvec_len * sizeof(FeatType));
-            }
+        std::map<std::string, std::string>::const_iterator spk = utt2spk_.find(key);
+        if (spk == utt2spk_.end()) {
+            if (!speakers_.empty())
+                KALDI_WARN << "No speaker for utterance " << key
+                           << "; using the utterance's own statistics";
+            Write(key, feats, opts_.apply_cmvn ? &utt_stats : NULL);
+            return;
         }
-        catch(std::exception e) {
-            KALDI_ERR << e.what() << std::endl;
-            return false;
+
+        if (stats_done_) {
+            Speaker *speaker = speakers_[spk->second];
+            Write(key, feats, (opts_.apply_cmvn && speaker->stats.NumRows() != 0) ?
+                  &speaker->stats : NULL);
+            return;
         }
+        // the speaker's statistics are not known yet, so CMVN can't be applied
+        KALDI_ASSERT(!opts_.apply_cmvn);
+        Write(key, feats, NULL);
+        AccSpeakerStats(key, spk->second, feats);
+    }
 
-        return true;
+    /// Writes out the statistics of the speakers with utterances missing from
+    /// the input
+    void Finish() {
+        if (!stats_done_)
+            WritePendingStats();
     }
 
-    /// Get the features
-    T& Value() { return *feats_; }
+    int64 NumFrames() const { return num_frames_; }
 
-    /// The Sphinx's feature files are binary
-    static bool IsReadInBinary() { return true; }
+private:
+    struct Speaker {
+        int32 num_pending; // the utterances not read yet
+        Matrix<double> stats;
+    };
 
-    /// Free the buffer if requested
-    void Clear() {
-        if (feats_)
-            delete feats_;
-        feats_ = 0;
+    void AccSpeakerStats(const std::string &key, const std::string &spk,
+                         const Matrix<BaseFloat> &feats) {
+        Speaker *speaker = speakers_[spk];
+        if (speaker->num_pending <= 0)
+            KALDI_ERR << "Utterance " << key << " was seen after all the utterances "
+                      << "of speaker " << spk;
+        if (speaker->stats.NumRows() == 0)
+            InitCmvnStats(feats.NumCols(), &speaker->stats);
+        AccCmvnStats(feats, NULL, &speaker->stats);
+        if (--speaker->num_pending == 0 && !stats_done_ && !opts_.apply_cmvn &&
+            spk_stats_writer_ != NULL)
+            spk_stats_writer_->Write(spk, speaker->stats);
     }
 
-    ~SphinxFeatHolder() {
-        if (feats_)
-            delete feats_;
+    /// Writes the statistics of the speakers not written yet: all of them
+    /// after the first pass of per-speaker CMVN, and else those with missing
+    /// utterances
+    void WritePendingStats() {
+        std::map<std::string, Speaker*>::iterator it = speakers_.begin();
+        for (; it != speakers_.end(); ++it) {
+            Speaker *speaker = it->second;
+            if (speaker->stats.NumRows() == 0)
+                continue;
+            if (speaker->num_pending != 0)
+                KALDI_WARN << speaker->num_pending << " utterances of speaker "
+                           << it->first << " were not found";
+            else if (!opts_.apply_cmvn)
+                continue;  // written by AccSpeakerStats()
+            if (spk_stats_writer_ != NULL)
+                spk_stats_writer_->Write(it->first, speaker->stats);
+        }
     }
 
-private:
-    /// A naive byte-swapping routine
-    template<class N>
-    inline N swap(N val) {
-        char tmp[4];
-        char *p = (char*) &val;
-        tmp[0] = p[3];
-        tmp[1] = p[2];
-        tmp[2] = p[1];
-        tmp[3] = p[0];
-
-        return *((N*) tmp);
+    void Write(const std::string &key, const Matrix<BaseFloat> &feats,
+               const Matrix<double> *stats) {
+        if (stats == NULL && !opts_.add_deltas) {
+            TraceScope write_scope("Write");
+            writer_->Write(key, feats);
+            return;
+        }
+        TraceScope process_scope("CmvnDeltas");
+        Matrix<BaseFloat> normalized(feats);
+        if (stats != NULL)
+            ApplyCmvn(*stats, opts_.norm_vars, &normalized);
+        Matrix<BaseFloat> deltas;
+        if (opts_.add_deltas)
+            ComputeDeltas(opts_.delta_opts, normalized, &deltas);
+        process_scope.End();
+        TraceScope write_scope("Write");
+        writer_->Write(key, opts_.add_deltas ? deltas : normalized);
     }
 
-    /// The feature matrix
-    T *feats_;
+    PackFeatsOptions opts_;
+    ShardedMatrixWriter *writer_;
+    DoubleMatrixWriter *utt_stats_writer_;
+    DoubleMatrixWriter *spk_stats_writer_;
+    std::map<std::string, std::string> utt2spk_;
+    std::map<std::string, Speaker*> speakers_;
+    bool stats_done_; // the speakers' statistics are complete(first pass done)
+    int64 num_frames_;
 };
 
 } // namespace kaldi
@@ -134,30 +235,118 @@ private:
 int main(int argc, char **argv) {
     using namespace kaldi;
 
-    ParseOptions po("Usage: pack-sphinx-feats [options] <rxspecifier> <wxspecifier>\n");
+    const char *usage =
+            "Packs Sphinx feature files into a Kaldi archive, optionally applying\n"
+            "CMVN, adding deltas and writing the CMVN statistics in the same pass\n"
+            "Usage: pack-sphinx-feats [options] <rxspecifier> <wxspecifier>\n"
+            "e.g.: pack-sphinx-feats --add-deltas --spk2utt=ark:data/train.spk2utt "
+            "--spk-cmvn-stats=ark:data/train.cmvn scp:train.scp ark,scp:train.ark,train.scp\n"
+            "      pack-sphinx-feats --num-shards=4 scp:train.scp "
+            "ark,scp:train.%d.ark,train.%d.scp\n";
+
+    PackFeatsOptions opts;
+    std::string spk2utt_rspec, utt_stats_wspec, spk_stats_wspec;
+    int32 num_shards = 1;
+    std::string trace_wxfilename;
+    ParseOptions po(usage);
+    po.Register("add-deltas", &opts.add_deltas, "Write the features with deltas "
+                "added(as add-deltas does)");
+    po.Register("delta-order", &opts.delta_opts.order, "Order of the deltas, "
+                "with --add-deltas");
+    po.Register("delta-window", &opts.delta_opts.window, "Window size for the "
+                "delta computation, with --add-deltas");
+    po.Register("apply-cmvn", &opts.apply_cmvn, "Apply CMVN(per speaker if "
+                "--spk2utt is given, which reads the input twice, else per "
+                "utterance) before adding deltas");
+    po.Register("norm-vars", &opts.norm_vars, "Normalize the variances too, "
+                "with --apply-cmvn");
+    po.Register("spk2utt", &spk2utt_rspec, "rspecifier of the speaker to "
+                "utterances map");
+    po.Register("utt-cmvn-stats", &utt_stats_wspec, "wspecifier for the "
+                "per-utterance CMVN statistics of the raw features");
+    po.Register("spk-cmvn-stats", &spk_stats_wspec, "wspecifier for the "
+                "per-speaker CMVN statistics of the raw features(needs --spk2utt)");
+    po.Register("num-shards", &num_shards, "Split the features into this many "
+                "contiguous archives of about the same number of frames; \"%d\" "
+                "in <wxspecifier> is replaced by the shard index(1-based)");
+    po.Register("trace-out", &trace_wxfilename, "Write the time spent in the "
+                "reading, byte-swapping, processing and writing of each file "
+                "as Chrome trace events(JSON)");
     po.Read(argc, argv);
     if (po.NumArgs() != 2) {
         po.PrintUsage();
         exit(1);
     }
+    if (!spk_stats_wspec.empty() && spk2utt_rspec.empty())
+        KALDI_ERR << "--spk-cmvn-stats needs --spk2utt";
+    if (num_shards < 1)
+        KALDI_ERR << "Invalid --num-shards=" << num_shards;
 
+    TraceSession trace_session(trace_wxfilename, "pack-sphinx-feats");
     std::string rspec = po.GetArg(1);
     std::string wspec = po.GetArg(2);
-    SequentialTableReader<SphinxFeatHolder<> > reader(rspec);
-    BaseFloatMatrixWriter writer;
-    if (!writer.Open(wspec)) {
+    ShardedMatrixWriter writer;
+    bool opened;
+    if (num_shards > 1) {
+        std::vector<std::string> keys;
+        std::vector<double> frames;
+        // 13 coefficients per frame, as read by SphinxFeatHolder<>
+        if (!GetSphinxFrameCounts(rspec, 13, &keys, &frames)) {
+            KALDI_ERR << "--num-shards needs a script rspecifier of regular "
+                      << "files, to balance the shards by frames";
+        }
+        opened = writer.Open(wspec, num_shards, keys, frames);
+    } else {
+        opened = writer.Open(wspec);
+    }
+    if (!opened) {
         KALDI_ERR << "Error while trying to open \"" << wspec << '\"';
         return 1;
     }
+    DoubleMatrixWriter utt_stats_writer, spk_stats_writer;
+    if (!utt_stats_wspec.empty() && !utt_stats_writer.Open(utt_stats_wspec))
+        KALDI_ERR << "Error while trying to open \"" << utt_stats_wspec << '\"';
+    if (!spk_stats_wspec.empty() && !spk_stats_writer.Open(spk_stats_wspec))
+        KALDI_ERR << "Error while trying to open \"" << spk_stats_wspec << '\"';
 
+    SphinxFeatPacker packer(opts, &writer,
+                            utt_stats_wspec.empty() ? NULL : &utt_stats_writer,
+                            spk_stats_wspec.empty() ? NULL : &spk_stats_writer);
+    if (!spk2utt_rspec.empty())
+        packer.ReadSpk2Utt(spk2utt_rspec);
+
+    if (opts.apply_cmvn && !spk2utt_rspec.empty()) {
+        // The first pass: the statistics of the speakers, so that the second
+        // pass can normalize each utterance without holding any back
+        std::string rxfilename;
+        RspecifierOptions ropts;
+        ClassifyRspecifier(rspec, &rxfilename, &ropts);
+        if (ClassifyRxfilename(rxfilename) != kFileInput)
+            KALDI_ERR << "Per-speaker CMVN reads the features twice, so they "
+                      << "can't come from a pipe or the standard input";
+        TraceScope stats_scope("SpeakerStats");
+        SequentialTableReader<SphinxFeatHolder<> > stats_reader(rspec);
+        for (; !stats_reader.Done(); stats_reader.Next())
+            packer.AccStats(stats_reader.Key(), stats_reader.Value());
+        packer.FinishStats();
+    }
+
+    SequentialTableReader<SphinxFeatHolder<> > reader(rspec);
     int count = 0;
     for (; !reader.Done(); reader.Next(), count++) {
         std::string key = reader.Key();
         const Matrix<float> &feats = reader.Value();
-        writer.Write(key, feats);
+        packer.Pack(key, feats);
+        TraceCounter("frames", packer.NumFrames());
         KALDI_VLOG(2) << "Packaged: " << key;
     }
-    KALDI_LOG << "Done packaging " << count << " feature files";
+    packer.Finish();
+    TraceScope close_scope("Close");
+    if (!writer.Close())
+        KALDI_ERR << "Error closing \"" << wspec << '\"';
+    close_scope.End();
+    KALDI_LOG << "Done packaging " << count << " feature files("
+              << packer.NumFrames() << " frames)";
 
     return 0;
 }
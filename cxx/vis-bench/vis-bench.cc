@@ -0,0 +1,444 @@
+// bin/vis-bench.cc
+
+// Copyright 2012  Vassil Panayotov <vd.panayotov@gmail.com>
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#include <unistd.h>
+
+#include <cstdio>
+#include <sstream>
+
+#include "base/kaldi-common.h"
+#include "base/timer.h"
+#include "util/common-utils.h"
+#include "tree/context-dep.h"
+#include "tree/event-map.h"
+#include "hmm/hmm-topology.h"
+#include "hmm/transition-model.h"
+#include "fstext/fstext-lib.h"
+#include "decoder/training-graph-compiler-vis.h"
+#include "decoder/alignment-drawer.h"
+#include "decoder/tree-renderer.h"
+#include "decoder/flat-event-map.h"
+#include "feat/sphinx-feat-holder.h"
+
+namespace kaldi {
+
+struct VisBenchOptions {
+  int32 num_phones;
+  int32 num_words;
+  int32 max_pron_len;
+  int32 tree_depth;
+  int32 num_utts;
+  int32 utt_len;
+  int32 batch_size;
+  int32 num_traces;
+  int32 num_tree_lookups;
+  int32 num_feat_files;
+  int32 num_frames;
+  int32 seed;
+  bool share_prefixes;
+  bool word_fragments;
+
+  VisBenchOptions(): num_phones(48), num_words(1000), max_pron_len(8),
+                     tree_depth(3), num_utts(500), utt_len(10),
+                     batch_size(250), num_traces(50),
+                     num_tree_lookups(1000000), num_feat_files(200),
+                     num_frames(300), seed(777), share_prefixes(false),
+                     word_fragments(false) { }
+
+  void Register(ParseOptions *po) {
+    po->Register("num-phones", &num_phones, "Number of phones in the "
+                 "synthetic phone set");
+    po->Register("num-words", &num_words, "Number of words in the synthetic "
+                 "lexicon");
+    po->Register("max-pron-len", &max_pron_len, "Maximum number of phones in "
+                 "a pronunciation(the minimum is 2)");
+    po->Register("tree-depth", &tree_depth, "Depth of the random question "
+                 "subtree under each phone and HMM state");
+    po->Register("num-utts", &num_utts, "Number of synthetic transcripts");
+    po->Register("utt-len", &utt_len, "Number of words per transcript");
+    po->Register("batch-size", &batch_size, "Number of FSTs to compile at "
+                 "a time");
+    po->Register("num-traces", &num_traces, "Number of random alignments to "
+                 "trace through the compiled graphs");
+    po->Register("num-tree-lookups", &num_tree_lookups, "Number of random "
+                 "contexts to map through the tree");
+    po->Register("num-feat-files", &num_feat_files, "Number of synthetic "
+                 "Sphinx feature files to pack");
+    po->Register("num-frames", &num_frames, "Number of frames per Sphinx "
+                 "feature file");
+    po->Register("seed", &seed, "Seed for the random generators");
+    po->Register("share-prefixes", &share_prefixes, "Compile the batches "
+                 "with TrainingGraphCompilerVisOptions::share_prefixes");
+    po->Register("word-fragments", &word_fragments, "Compile the graphs "
+                 "with TrainingGraphCompilerVisOptions::word_fragments");
+  }
+};
+
+/// Writes the results as one JSON object per line
+class BenchReporter {
+ public:
+  explicit BenchReporter(std::ostream &os): os_(os) {}
+
+  void Report(const std::string &stage, int64 items, double seconds,
+              int64 bytes = 0) {
+    os_ << "{\"stage\": \"" << stage << "\""
+        << ", \"items\": " << items
+        << ", \"seconds\": " << seconds
+        << ", \"items_per_sec\": " << (seconds > 0 ? items / seconds : 0.0);
+    if (bytes > 0)
+      os_ << ", \"bytes\": " << bytes;
+    os_ << ", \"rss_kb\": " << CurrentRssKb() << "}" << std::endl;
+    KALDI_LOG << stage << ": " << items << " items in " << seconds << " sec.";
+  }
+
+  /// The resident set size of the process now(ru_maxrss would be the peak
+  /// of all the stages so far), or -1 if it is not available
+  static int64 CurrentRssKb() {
+    FILE *statm = fopen("/proc/self/statm", "r");
+    if (statm == NULL)
+      return -1;
+    long size, resident;
+    int n = fscanf(statm, "%ld %ld", &size, &resident);
+    fclose(statm);
+    if (n != 2)
+      return -1;
+    return static_cast<int64>(resident) * (sysconf(_SC_PAGESIZE) / 1024);
+  }
+
+ private:
+  std::ostream &os_;
+};
+
+/// Creates phone("p1", "p2", ...) or word("w1", ...) symbols
+fst::SymbolTable *MakeSymbols(const std::string &prefix, int32 num_syms) {
+  fst::SymbolTable *syms = new fst::SymbolTable(prefix + "-syms");
+  syms->AddSymbol("<eps>", 0);
+  for (int32 i = 1; i <= num_syms; i++) {
+    std::ostringstream oss;
+    oss << prefix << i;
+    syms->AddSymbol(oss.str(), i);
+  }
+  return syms;
+}
+
+/// A 3-state left-to-right topology, shared by all phones
+void MakeTopology(int32 num_phones, HmmTopology *topo) {
+  std::ostringstream oss;
+  oss << "<Topology>\n<TopologyEntry>\n<ForPhones>";
+  for (int32 p = 1; p <= num_phones; p++)
+    oss << ' ' << p;
+  oss << " </ForPhones>\n";
+  for (int32 s = 0; s < 3; s++)
+    oss << "<State> " << s << " <PdfClass> " << s
+        << " <Transition> " << s << " 0.5 <Transition> " << (s + 1)
+        << " 0.5 </State>\n";
+  oss << "<State> 3 </State>\n</TopologyEntry>\n</Topology>\n";
+  std::istringstream is(oss.str());
+  topo->Read(is, false);
+}
+
+/// A random tree of questions about the left and right phones
+EventMap *MakeRandomSplits(int32 num_phones, int32 depth, int32 *next_pdf) {
+  if (depth == 0)
+    return new ConstantEventMap((*next_pdf)++);
+  EventKeyType key = (RandInt(0, 1) == 0 ? 0 : 2);
+  std::vector<EventValueType> yes_set;
+  for (int32 p = 0; p <= num_phones; p++) // 0 is the utterance boundary
+    if (RandInt(0, 1) == 0)
+      yes_set.push_back(p);
+  if (yes_set.empty())
+    yes_set.push_back(RandInt(0, num_phones));
+  return new SplitEventMap(key, yes_set,
+                           MakeRandomSplits(num_phones, depth - 1, next_pdf),
+                           MakeRandomSplits(num_phones, depth - 1, next_pdf));
+}
+
+/// A triphone tree: tables on the central phone and the HMM state, with
+/// random question subtrees below them
+EventMap *MakeTree(int32 num_phones, int32 depth, int32 *num_pdfs) {
+  *num_pdfs = 0;
+  std::vector<EventMap*> phone_table(num_phones + 1, NULL);
+  for (int32 p = 1; p <= num_phones; p++) {
+    std::vector<EventMap*> state_table(3, NULL);
+    for (int32 s = 0; s < 3; s++)
+      state_table[s] = MakeRandomSplits(num_phones, depth, num_pdfs);
+    phone_table[p] = new TableEventMap(kPdfClass, state_table);
+  }
+  return new TableEventMap(1, phone_table);
+}
+
+/// A lexicon FST with a single loop state and no silence
+fst::VectorFst<fst::StdArc> *MakeLexicon(
+    const std::vector<std::vector<int32> > &prons) {
+  using fst::StdArc;
+  fst::VectorFst<StdArc> *lex = new fst::VectorFst<StdArc>();
+  StdArc::StateId loop = lex->AddState();
+  lex->SetStart(loop);
+  lex->SetFinal(loop, StdArc::Weight::One());
+  for (size_t w = 1; w < prons.size(); w++) {
+    StdArc::StateId cur = loop;
+    for (size_t i = 0; i < prons[w].size(); i++) {
+      StdArc::StateId next =
+          (i + 1 == prons[w].size() ? loop : lex->AddState());
+      lex->AddArc(cur, StdArc(prons[w][i], (i == 0 ? w : 0),
+                              StdArc::Weight::One(), next));
+      cur = next;
+    }
+  }
+  return lex;
+}
+
+/// Serializes features in the Sphinx format(big endian floats)
+std::string MakeSphinxFeats(int32 num_frames) {
+  std::vector<char> buf(sizeof(int32) + num_frames * 13 * sizeof(float));
+  int32 nmfcc = num_frames * 13;
+  char *p = &buf[0];
+  for (int32 i = sizeof(int32) - 1; i >= 0; i--)
+    *p++ = reinterpret_cast<char*>(&nmfcc)[i];
+  for (int32 f = 0; f < num_frames * 13; f++) {
+    float val = RandGauss();
+    for (int32 i = sizeof(float) - 1; i >= 0; i--)
+      *p++ = reinterpret_cast<char*>(&val)[i];
+  }
+  return std::string(buf.begin(), buf.end());
+}
+
+}  // end namespace kaldi
+
+int main(int argc, char *argv[]) {
+  try {
+    using namespace kaldi;
+    typedef kaldi::int32 int32;
+    using fst::VectorFst;
+    using fst::StdArc;
+
+    const char *usage =
+        "Benchmarks the graph compilation and visualization code on synthetic\n"
+        "data: a random lexicon, transcripts, triphone tree, alignments and\n"
+        "Sphinx feature files of configurable size. For each stage it reports\n"
+        "the throughput, the time and the RSS at the end of the stage(not the\n"
+        "peak) as one JSON object per line.\n"
+        "\n"
+        "Usage:   vis-bench [options] [results-wxfilename]\n"
+        "e.g.: \n"
+        " vis-bench --num-utts=1000 --tree-depth=4 results.json\n";
+    ParseOptions po(usage);
+    VisBenchOptions opts;
+    opts.Register(&po);
+    po.Read(argc, argv);
+
+    if (po.NumArgs() > 1) {
+      po.PrintUsage();
+      exit(1);
+    }
+    std::string results_wxfilename = po.GetOptArg(1);
+    Output ko(results_wxfilename == "" ? "-" : results_wxfilename, false);
+    BenchReporter reporter(ko.Stream());
+    srand(opts.seed);
+
+    // Synthetic models
+    fst::SymbolTable *phone_syms = MakeSymbols("p", opts.num_phones);
+    fst::SymbolTable *word_syms = MakeSymbols("w", opts.num_words);
+    HmmTopology topo;
+    MakeTopology(opts.num_phones, &topo);
+    int32 num_pdfs;
+    ContextDependency ctx_dep(3, 1, MakeTree(opts.num_phones,
+                                             opts.tree_depth, &num_pdfs));
+    TransitionModel trans_model(ctx_dep, topo);
+    KALDI_LOG << "Synthetic tree has " << num_pdfs << " leaves; "
+              << trans_model.NumTransitionIds() << " transition ids";
+
+    std::vector<std::vector<int32> > prons(opts.num_words + 1);
+    for (int32 w = 1; w <= opts.num_words; w++) {
+      prons[w].resize(RandInt(2, std::max(2, opts.max_pron_len)));
+      for (size_t i = 0; i < prons[w].size(); i++)
+        prons[w][i] = RandInt(1, opts.num_phones);
+    }
+    std::vector<std::vector<int32> > transcripts(opts.num_utts);
+    for (int32 u = 0; u < opts.num_utts; u++)
+      for (int32 i = 0; i < opts.utt_len; i++)
+        transcripts[u].push_back(RandInt(1, opts.num_words));
+
+    // Graph compilation
+    TrainingGraphCompilerVisOptions gopts;
+    gopts.transition_scale = 0.0;
+    gopts.self_loop_scale = 0.0;
+    gopts.share_prefixes = opts.share_prefixes;
+    gopts.word_fragments = opts.word_fragments;
+    std::vector<int32> disambig_syms;
+    TrainingGraphCompilerVis gc(trans_model, ctx_dep, MakeLexicon(prons),
+                                disambig_syms, gopts);
+    // only the stage times are used, so the FSTs are not walked to get
+    // their sizes, which would add to the total time
+    TrainingGraphCompilerVisStats compile_stats(NULL, false);
+    gc.SetStats(&compile_stats);
+    std::vector<VectorFst<StdArc>*> graphs;
+    int64 num_states = 0, num_arcs = 0;
+    Timer timer;
+    for (size_t start = 0; start < transcripts.size();
+         start += opts.batch_size) {
+      size_t end = std::min(transcripts.size(),
+                            start + static_cast<size_t>(opts.batch_size));
+      std::vector<std::vector<int32> > batch(transcripts.begin() + start,
+                                             transcripts.begin() + end);
+      std::vector<VectorFst<StdArc>*> fsts;
+      if (!gc.CompileGraphsFromText(batch, &fsts))
+        KALDI_ERR << "Graph compilation failed";
+      graphs.insert(graphs.end(), fsts.begin(), fsts.end());
+    }
+    reporter.Report("compile", graphs.size(), timer.Elapsed());
+    for (int32 s = 0; s < TrainingGraphCompilerVisStats::kNumStages; s++)
+      reporter.Report(std::string("compile/") +
+                      TrainingGraphCompilerVisStats::StageName(s),
+                      compile_stats.StageCount(s), compile_stats.StageTime(s));
+    gc.SetStats(NULL);
+    for (size_t i = 0; i < graphs.size(); i++) {
+      num_states += graphs[i]->NumStates();
+      for (fst::StateIterator<VectorFst<StdArc> > si(*graphs[i]);
+           !si.Done(); si.Next())
+        num_arcs += graphs[i]->NumArcs(si.Value());
+    }
+    KALDI_LOG << "Compiled graphs have " << num_states << " states and "
+              << num_arcs << " arcs in total";
+
+    // Alignment tracing and DOT emission
+    int32 num_traces = std::min(opts.num_traces,
+                                static_cast<int32>(graphs.size()));
+    std::vector<std::vector<int32> > alignments(num_traces);
+    for (int32 i = 0; i < num_traces; i++) {
+      fst::UniformArcSelector<StdArc> selector(opts.seed + i);
+      fst::RandGenOptions<fst::UniformArcSelector<StdArc> > rand_opts(selector);
+      VectorFst<StdArc> path;
+      fst::RandGen(*graphs[i], &path, rand_opts);
+      std::vector<int32> words;
+      StdArc::Weight weight;
+      fst::GetLinearSymbolSequence(path, &alignments[i], &words, &weight);
+    }
+    typedef AlignmentDrawer<VectorFst<StdArc> > Drawer;
+    int64 num_frames = 0;
+    double trace_time = 0.0, draw_time = 0.0;
+    int64 dot_bytes = 0;
+    for (int32 i = 0; i < num_traces; i++) {
+      std::ostringstream dot;
+      Drawer drawer(*graphs[i], trans_model, alignments[i], *phone_syms,
+                    *word_syms, "_", false, false, -1, dot);
+      timer.Reset();
+      if (!drawer.Trace())
+        KALDI_WARN << "Could not trace alignment " << i;
+      trace_time += timer.Elapsed();
+      timer.Reset();
+      drawer.Draw();
+      draw_time += timer.Elapsed();
+      num_frames += alignments[i].size();
+      dot_bytes += dot.str().size();
+    }
+    reporter.Report("trace", num_frames, trace_time);
+    // Draw() traces the alignment again, so its time is subtracted
+    reporter.Report("dot-ali", num_traces,
+                    std::max(0.0, draw_time - trace_time), dot_bytes);
+
+    // The same, with draw-ali's own layout and SVG output
+    {
+      double svg_time = 0.0;
+      int64 svg_bytes = 0;
+      for (int32 i = 0; i < num_traces; i++) {
+        std::ostringstream svg;
+        Drawer drawer(*graphs[i], trans_model, alignments[i], *phone_syms,
+                      *word_syms, "_", false, false, -1, svg);
+        drawer.SetSvg(true);
+        timer.Reset();
+        drawer.Draw();
+        svg_time += timer.Elapsed();
+        svg_bytes += svg.str().size();
+      }
+      reporter.Report("svg-ali", num_traces,
+                      std::max(0.0, svg_time - trace_time), svg_bytes);
+    }
+
+    // Tree rendering
+    {
+      std::ostringstream dot;
+      EventMap &root = const_cast<EventMap&>(ctx_dep.ToPdfMap());
+      TreeRenderer renderer(root, phone_syms, 3, 1, dot);
+      timer.Reset();
+      renderer.Render(NULL);
+      reporter.Report("dot-tree", num_pdfs, timer.Elapsed(), dot.str().size());
+    }
+
+    // Tree lookups: EventMap::Map() per context vs. FlatEventMap::MapMany()
+    {
+      int32 n = opts.num_tree_lookups;
+      std::vector<EventType> events(n);
+      std::vector<EventValueType> rows(static_cast<size_t>(n) * 4);
+      for (int32 i = 0; i < n; i++) {
+        EventValueType *row = &rows[static_cast<size_t>(i) * 4];
+        row[0] = RandInt(0, 2);
+        row[1] = RandInt(0, opts.num_phones);
+        row[2] = RandInt(1, opts.num_phones);
+        row[3] = RandInt(0, opts.num_phones);
+        for (int32 k = 0; k < 4; k++)
+          events[i].push_back(std::make_pair(k == 0 ? kPdfClass : k - 1,
+                                             row[k]));
+      }
+      const EventMap &root = ctx_dep.ToPdfMap();
+      std::vector<EventAnswerType> pdfs(n), flat_pdfs(n);
+      timer.Reset();
+      for (int32 i = 0; i < n; i++)
+        if (!root.Map(events[i], &pdfs[i]))
+          pdfs[i] = -1;
+      reporter.Report("tree-map", n, timer.Elapsed());
+
+      timer.Reset();
+      FlatEventMap flat(const_cast<EventMap&>(root), 3);
+      reporter.Report("tree-flatten", flat.NumNodes(), timer.Elapsed());
+      timer.Reset();
+      if (n > 0)
+        flat.MapMany(&rows[0], n, &flat_pdfs[0]);
+      reporter.Report("tree-map-many", n, timer.Elapsed());
+      if (pdfs != flat_pdfs)
+        KALDI_ERR << "FlatEventMap::MapMany() disagrees with EventMap::Map()";
+    }
+
+    // Sphinx feature packing
+    {
+      std::vector<std::string> feat_files(opts.num_feat_files);
+      for (int32 i = 0; i < opts.num_feat_files; i++)
+        feat_files[i] = MakeSphinxFeats(opts.num_frames);
+      std::ostringstream ark;
+      SphinxFeatHolder<> holder;
+      timer.Reset();
+      for (int32 i = 0; i < opts.num_feat_files; i++) {
+        std::istringstream is(feat_files[i]);
+        if (!holder.Read(is))
+          KALDI_ERR << "Could not read synthetic feature file " << i;
+        ark << "utt" << i << ' ';
+        holder.Value().Write(ark, true);
+      }
+      reporter.Report("sphinx-pack",
+                      static_cast<int64>(opts.num_feat_files) * opts.num_frames,
+                      timer.Elapsed(), ark.str().size());
+    }
+
+    DeletePointers(&graphs);
+    delete phone_syms;
+    delete word_syms;
+    return 0;
+  } catch(const std::exception& e) {
+    std::cerr << e.what();
+    return -1;
+  }
+}
@@ -0,0 +1,379 @@
+// decoder/graph-export-writer.h
+
+// Copyright 2012  Vassil Panayotov <vd.panayotov@gmail.com>
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef KALDI_DECODER_GRAPH_EXPORT_WRITER_H_
+#define KALDI_DECODER_GRAPH_EXPORT_WRITER_H_
+
+#include <cstring>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <tr1/unordered_map>
+
+#include "base/kaldi-common.h"
+#include "util/json-escape.h"
+
+namespace kaldi {
+
+// Writes the states(nodes) and arcs drawn by AlignmentDrawer and TreeRenderer
+// for interactive viewers, which can page through the graph instead of
+// parsing DOT. The records are written as they come, in chunks of at most
+// "chunk_size" nodes or arcs, so a graph is never held in memory; the labels
+// and colors are replaced by indices in a deduplicated string table, written
+// after the chunks. An index of the chunks comes last, so a viewer reads the
+// end of the file first and then loads only the chunks it shows.
+//
+// Binary layout(all integers in native byte order; the header records it):
+//   GraphExportHeader
+//   chunks: GraphExportNode[count] or GraphExportArc[count]
+//   (padding to 8 bytes)
+//   string table: int32 offsets[num_strings + 1], then the bytes of the
+//                 strings(string i is at [offsets[i], offsets[i + 1]) from
+//                 the end of the offsets), padded to 8 bytes
+//   GraphExportChunk[num_chunks]
+//   GraphExportTrailer(at the very end of the file)
+//
+// NDJSON layout(one JSON object per line):
+//   {"format":"kaldi-vis-graph","version":1,"chunk_size":65536}
+//   {"chunk":0,"kind":"node","first":0,"count":2}   - before each chunk
+//   {"id":0,"label":1,"color":0,"flags":5}          - a node
+//   {"from":0,"to":1,"label":2,"color":0,"flags":4} - an arc
+//   {"strings":["black","","aa_1_5_0:<eps>",...]}
+//   {"nodes":2,"arcs":1,"strings_offset":123,"chunks":[[offset,"node",first,count],...]}
+// The last line is the index; the offsets are those of the "chunk" lines,
+// in bytes from the start of the output.
+//
+// The node ids are written only as numbers: a node's label is the text shown
+// besides its id(e.g. a final weight, a question or a pdf-id), or "". Every
+// arc's "from" and "to" are ids of nodes in the same file, though a node may
+// come after the arcs that refer to it.
+
+enum GraphExportFormat {
+    kGraphExportNone = 0, // not exporting(the drawers write DOT)
+    kGraphExportNdjson,
+    kGraphExportBinary
+};
+
+enum GraphExportFlags {
+    kGraphExportStart = 1,  // the start state(the root of a tree)
+    kGraphExportFinal = 2,  // a final state(a leaf of a tree)
+    kGraphExportTraced = 4  // on the traced alignment/event path
+};
+
+enum GraphExportKind {
+    kGraphExportNodes = 0,
+    kGraphExportArcs = 1
+};
+
+struct GraphExportHeader {
+    char magic[8];          // "KVGRAPH\0"
+    int32 version;
+    uint32 byte_order;      // 0x01020304, as written
+    int32 chunk_size;
+    int32 node_size;        // sizeof(GraphExportNode)
+    int32 arc_size;         // sizeof(GraphExportArc)
+};
+
+struct GraphExportNode {
+    int32 id;
+    int32 label;            // index in the string table(not the id)
+    int32 color;            // index in the string table
+    int32 flags;            // GraphExportFlags
+};
+
+struct GraphExportArc {
+    int32 from;
+    int32 to;
+    int32 label;
+    int32 color;            // a ':' separated list if several alignments
+    int32 flags;
+};
+
+struct GraphExportChunk {
+    int64 offset;           // of the first record
+    int64 first;            // the number of nodes(or arcs) before the chunk
+    int32 kind;             // GraphExportKind
+    int32 count;
+};
+
+struct GraphExportTrailer {
+    int64 num_nodes;
+    int64 num_arcs;
+    int64 strings_offset;
+    int64 index_offset;
+    int32 num_strings;
+    int32 num_chunks;
+    char magic[8];          // "KVGRAPH\0" again, to recognize a whole file
+};
+
+class GraphExportWriter
+{
+public:
+    static const int32 kDefaultChunkSize = 65536;
+
+    GraphExportWriter(): os_(NULL), format_(kGraphExportNone) {}
+
+    /// Maps "ndjson" and "bin" to a format; returns false for other names
+    static bool ParseFormat(const std::string &name, GraphExportFormat *format)
+    {
+        if (name == "ndjson")
+            *format = kGraphExportNdjson;
+        else if (name == "bin")
+            *format = kGraphExportBinary;
+        else
+            return false;
+        return true;
+    }
+
+    /// Starts writing a graph to "os"; the stream has to stay valid until
+    /// End(). Nothing is buffered beyond the current chunks and the strings.
+    void Begin(std::ostream &os, GraphExportFormat format,
+               int32 chunk_size = kDefaultChunkSize)
+    {
+        KALDI_ASSERT(format != kGraphExportNone && chunk_size > 0);
+        os_ = &os;
+        format_ = format;
+        chunk_size_ = chunk_size;
+        pos_ = 0;
+        num_nodes_ = num_arcs_ = 0;
+        nodes_.clear();
+        arcs_.clear();
+        strings_.clear();
+        string_index_.clear();
+        chunks_.clear();
+
+        if (format_ == kGraphExportBinary) {
+            GraphExportHeader header;
+            memset(&header, 0, sizeof(header));
+            memcpy(header.magic, kMagic(), sizeof(header.magic));
+            header.version = kVersion;
+            header.byte_order = kByteOrder;
+            header.chunk_size = chunk_size_;
+            header.node_size = sizeof(GraphExportNode);
+            header.arc_size = sizeof(GraphExportArc);
+            WriteBytes(&header, sizeof(header));
+        } else {
+            std::ostringstream line;
+            line << "{\"format\":\"kaldi-vis-graph\",\"version\":" << kVersion
+                 << ",\"chunk_size\":" << chunk_size_ << "}\n";
+            WriteBytes(line.str().data(), line.str().size());
+        }
+    }
+
+    void AddNode(int32 id, const std::string &label, const std::string &color,
+                 int32 flags)
+    {
+        GraphExportNode node;
+        node.id = id;
+        node.label = StringId(label);
+        node.color = StringId(color);
+        node.flags = flags;
+        nodes_.push_back(node);
+        if (nodes_.size() == static_cast<size_t>(chunk_size_))
+            FlushNodes();
+    }
+
+    void AddArc(int32 from, int32 to, const std::string &label,
+                const std::string &color, int32 flags)
+    {
+        GraphExportArc arc;
+        arc.from = from;
+        arc.to = to;
+        arc.label = StringId(label);
+        arc.color = StringId(color);
+        arc.flags = flags;
+        arcs_.push_back(arc);
+        if (arcs_.size() == static_cast<size_t>(chunk_size_))
+            FlushArcs();
+    }
+
+    /// Writes the last chunks, the string table and the index
+    void End()
+    {
+        KALDI_ASSERT(os_ != NULL);
+        FlushNodes();
+        FlushArcs();
+        if (format_ == kGraphExportBinary)
+            EndBinary();
+        else
+            EndNdjson();
+        os_->flush();
+        if (!os_->good())
+            KALDI_ERR << "Error writing the graph export";
+        os_ = NULL;
+    }
+
+private:
+    static const int32 kVersion = 1;
+    static const uint32 kByteOrder = 0x01020304;
+
+    static const char *kMagic() { return "KVGRAPH"; } // with the '\0', 8 bytes
+
+    int32 StringId(const std::string &str)
+    {
+        std::tr1::unordered_map<std::string, int32>::iterator it =
+                string_index_.find(str);
+        if (it != string_index_.end())
+            return it->second;
+        int32 id = strings_.size();
+        string_index_.insert(std::make_pair(str, id));
+        strings_.push_back(str);
+        return id;
+    }
+
+    void WriteBytes(const void *data, size_t size)
+    {
+        os_->write(static_cast<const char*>(data), size);
+        pos_ += size;
+    }
+
+    void Pad()
+    {
+        static const char kZeros[8] = { 0 };
+        if (pos_ % 8 != 0)
+            WriteBytes(kZeros, 8 - pos_ % 8);
+    }
+
+    void BeginChunk(GraphExportKind kind, int64 first, size_t count)
+    {
+        GraphExportChunk chunk;
+        chunk.offset = pos_;
+        chunk.first = first;
+        chunk.kind = kind;
+        chunk.count = count;
+        chunks_.push_back(chunk);
+        if (format_ == kGraphExportNdjson) {
+            std::ostringstream line;
+            line << "{\"chunk\":" << (chunks_.size() - 1) << ",\"kind\":\""
+                 << KindName(kind) << "\",\"first\":" << first
+                 << ",\"count\":" << count << "}\n";
+            WriteBytes(line.str().data(), line.str().size());
+        }
+    }
+
+    void FlushNodes()
+    {
+        if (nodes_.empty())
+            return;
+        BeginChunk(kGraphExportNodes, num_nodes_, nodes_.size());
+        if (format_ == kGraphExportBinary) {
+            WriteBytes(&nodes_[0], nodes_.size() * sizeof(GraphExportNode));
+        } else {
+            std::ostringstream lines;
+            for (size_t i = 0; i < nodes_.size(); i++) {
+                const GraphExportNode &node = nodes_[i];
+                lines << "{\"id\":" << node.id << ",\"label\":" << node.label
+                      << ",\"color\":" << node.color << ",\"flags\":"
+                      << node.flags << "}\n";
+            }
+            WriteBytes(lines.str().data(), lines.str().size());
+        }
+        num_nodes_ += nodes_.size();
+        nodes_.clear();
+    }
+
+    void FlushArcs()
+    {
+        if (arcs_.empty())
+            return;
+        BeginChunk(kGraphExportArcs, num_arcs_, arcs_.size());
+        if (format_ == kGraphExportBinary) {
+            WriteBytes(&arcs_[0], arcs_.size() * sizeof(GraphExportArc));
+        } else {
+            std::ostringstream lines;
+            for (size_t i = 0; i < arcs_.size(); i++) {
+                const GraphExportArc &arc = arcs_[i];
+                lines << "{\"from\":" << arc.from << ",\"to\":" << arc.to
+                      << ",\"label\":" << arc.label << ",\"color\":"
+                      << arc.color << ",\"flags\":" << arc.flags << "}\n";
+            }
+            WriteBytes(lines.str().data(), lines.str().size());
+        }
+        num_arcs_ += arcs_.size();
+        arcs_.clear();
+    }
+
+    void EndBinary()
+    {
+        Pad();
+        GraphExportTrailer trailer;
+        memset(&trailer, 0, sizeof(trailer));
+        trailer.strings_offset = pos_;
+        std::vector<int32> offsets(1, 0);
+        for (size_t i = 0; i < strings_.size(); i++)
+            offsets.push_back(offsets.back() + strings_[i].size());
+        WriteBytes(&offsets[0], offsets.size() * sizeof(int32));
+        for (size_t i = 0; i < strings_.size(); i++)
+            WriteBytes(strings_[i].data(), strings_[i].size());
+        Pad();
+
+        trailer.index_offset = pos_;
+        if (!chunks_.empty())
+            WriteBytes(&chunks_[0], chunks_.size() * sizeof(GraphExportChunk));
+        trailer.num_nodes = num_nodes_;
+        trailer.num_arcs = num_arcs_;
+        trailer.num_strings = strings_.size();
+        trailer.num_chunks = chunks_.size();
+        memcpy(trailer.magic, kMagic(), sizeof(trailer.magic));
+        WriteBytes(&trailer, sizeof(trailer));
+    }
+
+    void EndNdjson()
+    {
+        int64 strings_offset = pos_;
+        std::ostringstream lines;
+        lines << "{\"strings\":[";
+        for (size_t i = 0; i < strings_.size(); i++)
+            lines << (i == 0 ? "" : ",") << '"' << JsonEscape(strings_[i]) << '"';
+        lines << "]}\n";
+
+        lines << "{\"nodes\":" << num_nodes_ << ",\"arcs\":" << num_arcs_
+              << ",\"strings_offset\":" << strings_offset << ",\"chunks\":[";
+        for (size_t c = 0; c < chunks_.size(); c++) {
+            const GraphExportChunk &chunk = chunks_[c];
+            lines << (c == 0 ? "" : ",") << '[' << chunk.offset << ",\""
+                  << KindName(static_cast<GraphExportKind>(chunk.kind))
+                  << "\"," << chunk.first << ',' << chunk.count << ']';
+        }
+        lines << "]}\n";
+        WriteBytes(lines.str().data(), lines.str().size());
+    }
+
+    static const char *KindName(GraphExportKind kind)
+    {
+        return kind == kGraphExportNodes ? "node" : "arc";
+    }
+
+    std::ostream *os_;
+    GraphExportFormat format_;
+    int32 chunk_size_;
+    int64 pos_; // the number of bytes written so far
+    int64 num_nodes_; // the nodes in the chunks written so far
+    int64 num_arcs_;
+    std::vector<GraphExportNode> nodes_; // the current chunk of nodes
+    std::vector<GraphExportArc> arcs_; // the current chunk of arcs
+    std::vector<std::string> strings_;
+    std::tr1::unordered_map<std::string, int32> string_index_;
+    std::vector<GraphExportChunk> chunks_;
+
+    KALDI_DISALLOW_COPY_AND_ASSIGN(GraphExportWriter);
+};
+
+} // namespace kaldi
+
+#endif // KALDI_DECODER_GRAPH_EXPORT_WRITER_H_
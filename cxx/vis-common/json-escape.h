@@ -0,0 +1,49 @@
+// util/json-escape.h
+
+// Copyright 2012  Vassil Panayotov <vd.panayotov@gmail.com>
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef KALDI_UTIL_JSON_ESCAPE_H_
+#define KALDI_UTIL_JSON_ESCAPE_H_
+
+#include <cstdio>
+#include <string>
+
+namespace kaldi {
+
+/// Escapes "text" for use inside a JSON string: quotes, backslashes and
+/// control characters. Used by all the JSON outputs of the visualization
+/// tools(the graph export, the trace events, draw-ali's --summary-out).
+inline std::string JsonEscape(const std::string &text) {
+  std::string escaped;
+  for (size_t i = 0; i < text.size(); i++) {
+    unsigned char c = text[i];
+    if (c == '"' || c == '\\') {
+      escaped += '\\';
+      escaped += c;
+    } else if (c < 0x20) {
+      char buf[8];
+      snprintf(buf, sizeof(buf), "\\u%04x", c);
+      escaped += buf;
+    } else {
+      escaped += c;
+    }
+  }
+  return escaped;
+}
+
+}  // end namespace kaldi
+
+#endif  // KALDI_UTIL_JSON_ESCAPE_H_
@@ -0,0 +1,173 @@
+// util/sharded-table-writer.h
+
+// Copyright 2012  Vassil Panayotov <vd.panayotov@gmail.com>
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef KALDI_UTIL_SHARDED_TABLE_WRITER_H_
+#define KALDI_UTIL_SHARDED_TABLE_WRITER_H_
+
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "base/kaldi-common.h"
+#include "util/common-utils.h"
+
+namespace kaldi {
+
+/// Returns the wspecifier of the shard-th shard(1-based, as the JOB index
+/// of the parallel scripts), by replacing each "%d" in "wspec" with it.
+inline std::string ShardWspecifier(const std::string &wspec, int32 shard) {
+  std::ostringstream index;
+  index << shard;
+  std::string ans;
+  size_t pos = 0;
+  while (true) {
+    size_t next = wspec.find("%d", pos);
+    if (next == std::string::npos)
+      break;
+    ans.append(wspec, pos, next - pos);
+    ans += index.str();
+    pos = next + 2;
+  }
+  if (pos == 0)
+    KALDI_ERR << "Expected \"%d\"(the shard index) in the wspecifier " << wspec;
+  return ans + wspec.substr(pos);
+}
+
+/// Splits a sequence of items with the given weights into "num_shards"
+/// contiguous ranges of about the same total weight. Sets (*first)[s] to the
+/// index of the first item of the s-th(0-based) shard; the shards are
+/// non-empty as long as there are enough items.
+inline void BalanceShards(const std::vector<double> &weights, int32 num_shards,
+                          std::vector<size_t> *first) {
+  KALDI_ASSERT(num_shards > 0);
+  double total = 0.0;
+  for (size_t i = 0; i < weights.size(); i++)
+    total += weights[i];
+  first->assign(num_shards, 0);
+  double sum = 0.0;
+  size_t i = 0;
+  for (int32 s = 1; s < num_shards; s++) {
+    // leave at least one item for each of the remaining shards, if there are
+    // enough items(otherwise the last shards are empty)
+    size_t max_first = (weights.size() > static_cast<size_t>(num_shards - s) ?
+                        weights.size() - (num_shards - s) : weights.size());
+    // at least one item in each shard
+    if (i < max_first && i == (*first)[s - 1]) {
+      sum += weights[i];
+      i++;
+    }
+    // the shard ends at the item closest to its share of the total weight
+    double target = total * s / num_shards;
+    while (i < max_first && sum + weights[i] / 2 < target) {
+      sum += weights[i];
+      i++;
+    }
+    (*first)[s] = i;
+  }
+}
+
+/// Writes a table either to a single wspecifier, or split into contiguous
+/// shards: the items are assigned to the shards by key, in the order in
+/// which their weights were given to Open(), and each shard is written with
+/// ShardWspecifier(wspec, shard).
+template<class Holder>
+class ShardedTableWriter {
+ public:
+  typedef typename Holder::T T;
+
+  ShardedTableWriter() {}
+
+  ~ShardedTableWriter() { Close(); }
+
+  /// Opens a single table, as TableWriter::Open()
+  bool Open(const std::string &wspec) {
+    Close();
+    writers_.push_back(new TableWriter<Holder>());
+    return writers_.back()->Open(wspec);
+  }
+
+  /// Opens "num_shards" shards, balanced by the weights of the keys
+  bool Open(const std::string &wspec, int32 num_shards,
+            const std::vector<std::string> &keys,
+            const std::vector<double> &weights) {
+    KALDI_ASSERT(keys.size() == weights.size());
+    if (num_shards == 1)
+      return Open(wspec);
+    Close();
+    std::vector<size_t> first;
+    BalanceShards(weights, num_shards, &first);
+    first.push_back(keys.size());
+    for (int32 s = 0; s < num_shards; s++) {
+      double weight = 0.0;
+      for (size_t i = first[s]; i < first[s + 1]; i++) {
+        shard_[keys[i]] = s;
+        weight += weights[i];
+      }
+      KALDI_VLOG(1) << "Shard " << (s + 1) << ": " << (first[s + 1] - first[s])
+                    << " items, weight " << weight;
+      writers_.push_back(new TableWriter<Holder>());
+      if (!writers_.back()->Open(ShardWspecifier(wspec, s + 1)))
+        return false;
+    }
+    return true;
+  }
+
+  int32 NumShards() const { return writers_.size(); }
+
+  /// Writes to the shard of the key; keys that were not given to Open() go
+  /// to the last shard
+  void Write(const std::string &key, const T &value) {
+    KALDI_ASSERT(!writers_.empty());
+    if (writers_.size() == 1) {
+      writers_[0]->Write(key, value);
+      return;
+    }
+    std::map<std::string, int32>::const_iterator it = shard_.find(key);
+    if (it == shard_.end()) {
+      KALDI_WARN << "Key " << key << " was not expected; writing it to the "
+                 << "last shard";
+      writers_.back()->Write(key, value);
+    } else {
+      writers_[it->second]->Write(key, value);
+    }
+  }
+
+  /// Returns false if any of the shards could not be closed
+  bool Close() {
+    bool ok = true;
+    for (size_t i = 0; i < writers_.size(); i++) {
+      if (!writers_[i]->Close()) {
+        KALDI_WARN << "Error closing the output table(shard " << (i + 1) << ")";
+        ok = false;
+      }
+      delete writers_[i];
+    }
+    writers_.clear();
+    shard_.clear();
+    return ok;
+  }
+
+ private:
+  std::vector<TableWriter<Holder>*> writers_;
+  std::map<std::string, int32> shard_;
+  KALDI_DISALLOW_COPY_AND_ASSIGN(ShardedTableWriter);
+};
+
+} // namespace kaldi
+
+#endif // KALDI_UTIL_SHARDED_TABLE_WRITER_H_
@@ -0,0 +1,238 @@
+// util/trace-events.h
+
+// Copyright 2012  Vassil Panayotov <vd.panayotov@gmail.com>
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef KALDI_UTIL_TRACE_EVENTS_H_
+#define KALDI_UTIL_TRACE_EVENTS_H_
+
+#include <sys/time.h>
+#include <unistd.h>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "base/kaldi-common.h"
+#include "util/common-utils.h"
+#include "util/json-escape.h"
+
+namespace kaldi {
+
+/// Records the time spent in the scopes of a tool(see TraceScope) and the
+/// values of counters, and writes them in the trace-event format of Chrome
+/// (a JSON array, one event per line), which chrome://tracing and other
+/// trace viewers load. Nothing is recorded unless a TraceSession is open; a
+/// TraceScope then costs only the test of a flag. The events are written in
+/// batches of kMaxPending as they come, so the memory taken doesn't grow with
+/// the length of the run. The timestamps are in microseconds since the
+/// epoch, so the traces of the tools of a pipeline(or of the worker
+/// processes of a tool) can be concatenated.
+class TraceRecorder {
+ public:
+  static const size_t kMaxPending = 4096;
+
+  static TraceRecorder &Default() {
+    static TraceRecorder recorder;
+    return recorder;
+  }
+
+  bool Enabled() const { return enabled_; }
+
+  /// Starts recording to "wxfilename". The events are attributed to the
+  /// current process, named "process_name".
+  void Start(const std::string &wxfilename, const std::string &process_name) {
+    KALDI_ASSERT(output_ == NULL);
+    events_.clear();
+    output_ = new Output(wxfilename, false);
+    output_->Stream() << "[";
+    num_written_ = 0;
+    pid_ = getpid();
+    category_ = process_name.substr(0, process_name.find(' '));
+    std::ostringstream event;
+    event << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":" << pid_
+          << ",\"tid\":" << pid_ << ",\"args\":{\"name\":\""
+          << JsonEscape(process_name) << "\"}}";
+    AddEvent(event.str());
+    enabled_ = true;
+    WriteEvents();  // nothing is left in the stream's buffer for a fork()
+  }
+
+  /// Writes the remaining events, ends the array and closes the output
+  void Stop() {
+    enabled_ = false;
+    if (output_ == NULL)
+      return;
+    WriteEvents();
+    if (output_ == NULL)  // a write error
+      return;
+    output_->Stream() << "\n]\n";
+    bool ok = output_->Close();
+    delete output_;
+    output_ = NULL;
+    if (!ok)
+      KALDI_ERR << "Error closing the trace";
+  }
+
+  /// In a process created by fork() while recording: forgets the parent's
+  /// output, without closing it(it is the parent's to finish) or writing
+  /// the events the parent has yet to write
+  void Detach() {
+    enabled_ = false;
+    output_ = NULL;  // the parent's object; not deleted
+    events_.clear();
+  }
+
+  /// Adds the events of a trace written by Stop(), e.g. by another process
+  void AddFile(const std::string &rxfilename) {
+    Input ki(rxfilename);
+    std::string line;
+    while (std::getline(ki.Stream(), line)) {
+      if (!line.empty() && line[line.size() - 1] == ',')
+        line.erase(line.size() - 1);
+      if (!line.empty() && line != "[" && line != "]")
+        AddEvent(line);
+    }
+  }
+
+  /// A scope entered at "start" and left at "end"(see Now())
+  void AddComplete(const char *name, int64 start, int64 end) {
+    std::ostringstream event;
+    event << "{\"name\":\"" << name << "\",\"cat\":\"" << category_
+          << "\",\"ph\":\"X\",\"ts\":" << start << ",\"dur\":" << end - start
+          << ",\"pid\":" << pid_ << ",\"tid\":" << pid_ << "}";
+    AddEvent(event.str());
+  }
+
+  void AddCounter(const char *name, double value) {
+    std::ostringstream event;
+    event.precision(15);
+    event << "{\"name\":\"" << name << "\",\"cat\":\"" << category_
+          << "\",\"ph\":\"C\",\"ts\":" << Now() << ",\"pid\":" << pid_
+          << ",\"tid\":" << pid_ << ",\"args\":{\"value\":" << value << "}}";
+    AddEvent(event.str());
+  }
+
+  /// Microseconds since the epoch
+  static int64 Now() {
+    struct timeval time;
+    gettimeofday(&time, NULL);
+    return static_cast<int64>(time.tv_sec) * 1000000 + time.tv_usec;
+  }
+
+ private:
+  TraceRecorder(): enabled_(false), output_(NULL), num_written_(0), pid_(0) {}
+
+  void AddEvent(const std::string &event) {
+    if (output_ == NULL)
+      return;
+    events_.push_back(event);
+    if (events_.size() >= kMaxPending)
+      WriteEvents();
+  }
+
+  /// Writes and flushes the pending events. On an error(also from a
+  /// TraceScope's destructor) only warns, and stops recording.
+  void WriteEvents() {
+    std::ostream &os = output_->Stream();
+    for (size_t i = 0; i < events_.size(); i++, num_written_++)
+      os << (num_written_ == 0 ? "\n" : ",\n") << events_[i];
+    events_.clear();
+    os.flush();
+    if (!os.good()) {
+      KALDI_WARN << "Error writing the trace; no more events are recorded";
+      enabled_ = false;
+      delete output_;
+      output_ = NULL;
+    }
+  }
+
+  bool enabled_;
+  Output *output_;         // open while recording
+  int64 num_written_;      // the events written to output_
+  int32 pid_;
+  std::string category_;   // the tool's name
+  std::vector<std::string> events_;  // not yet written
+
+  KALDI_DISALLOW_COPY_AND_ASSIGN(TraceRecorder);
+};
+
+/// Records the time from its construction to its destruction as an event
+/// named "name"(a string literal, which is not copied or escaped)
+class TraceScope {
+ public:
+  explicit TraceScope(const char *name):
+      name_(name), start_(TraceRecorder::Default().Enabled() ?
+                          TraceRecorder::Now() : -1) {}
+
+  ~TraceScope() { End(); }
+
+  /// Ends the scope before the destruction
+  void End() {
+    if (start_ >= 0 && TraceRecorder::Default().Enabled())
+      TraceRecorder::Default().AddComplete(name_, start_, TraceRecorder::Now());
+    start_ = -1;
+  }
+
+ private:
+  const char *name_;
+  int64 start_;
+
+  KALDI_DISALLOW_COPY_AND_ASSIGN(TraceScope);
+};
+
+/// Records the value of a counter(e.g. the number of states drawn)
+inline void TraceCounter(const char *name, double value) {
+  if (TraceRecorder::Default().Enabled())
+    TraceRecorder::Default().AddCounter(name, value);
+}
+
+/// Records the events of a tool's run(or of a request in server mode) to
+/// "wxfilename", which is completed when the session goes out of scope. Does
+/// nothing if "wxfilename" is empty, which is what --trace-out defaults to.
+class TraceSession {
+ public:
+  TraceSession(const std::string &wxfilename, const std::string &process_name):
+      wxfilename_(wxfilename) {
+    if (wxfilename_ != "")
+      TraceRecorder::Default().Start(wxfilename_, process_name);
+  }
+
+  ~TraceSession() {
+    if (wxfilename_ == "")
+      return;
+    try {
+      TraceRecorder::Default().Stop();
+    } catch(const std::exception &e) {
+      KALDI_WARN << "Could not write the trace to " << wxfilename_;
+    }
+  }
+
+  /// In a forked worker process: leaves the parent's trace to the parent and
+  /// records to another file, which the parent merges with AddFile()
+  void Reopen(const std::string &wxfilename, const std::string &process_name) {
+    wxfilename_ = wxfilename;
+    TraceRecorder::Default().Detach();
+    TraceRecorder::Default().Start(wxfilename_, process_name);
+  }
+
+ private:
+  std::string wxfilename_;
+
+  KALDI_DISALLOW_COPY_AND_ASSIGN(TraceSession);
+};
+
+}  // end namespace kaldi
+
+#endif  // KALDI_UTIL_TRACE_EVENTS_H_
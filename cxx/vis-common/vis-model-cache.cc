@@ -0,0 +1,231 @@
+// decoder/vis-model-cache.cc
+
+// Copyright 2012  Vassil Panayotov <vd.panayotov@gmail.com>
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <fstream>
+
+#include "util/common-utils.h"
+#include "decoder/vis-model-cache.h"
+
+namespace kaldi {
+
+VisModelCache &VisModelCache::Default() {
+  static VisModelCache cache;
+  return cache;
+}
+
+VisFileStamp VisFileStamp::Get(const std::string &rxfilename) {
+  VisFileStamp stamp;
+  if (ClassifyRxfilename(rxfilename) != kFileInput)
+    return stamp;
+  struct stat st;
+  if (stat(rxfilename.c_str(), &st) == 0 && S_ISREG(st.st_mode)) {
+    stamp.mtime = static_cast<int64>(st.st_mtime);
+    stamp.size = static_cast<int64>(st.st_size);
+  }
+  return stamp;
+}
+
+std::string VisModelCache::RspecifierFile(const std::string &rspecifier) {
+  std::string rxfilename;
+  RspecifierOptions opts;
+  // For a script it is the script file: the reader holds the script's list
+  // of keys and files, and reads the objects from these as they are looked
+  // up.
+  if (ClassifyRspecifier(rspecifier, &rxfilename, &opts) == kNoRspecifier)
+    return "";
+  return rxfilename;
+}
+
+template<class T>
+T *VisModelCache::Lookup(const std::string &name,
+                         const std::string &stamp_name,
+                         T *(*load)(const std::string &name),
+                         std::map<std::string, Entry<T> > *cache) {
+  VisFileStamp stamp = VisFileStamp::Get(stamp_name);
+  typename std::map<std::string, Entry<T> >::iterator it = cache->find(name);
+  if (it != cache->end()) {
+    if (it->second.stamp == stamp)
+      return it->second.object;
+    KALDI_VLOG(1) << "Reloading modified file " << name;
+    delete it->second.object;
+    cache->erase(it);
+  }
+  Entry<T> entry;
+  entry.stamp = stamp;
+  entry.object = load(name);
+  (*cache)[name] = entry;
+  return entry.object;
+}
+
+template<class T>
+void VisModelCache::ClearMap(std::map<std::string, Entry<T> > *cache) {
+  typename std::map<std::string, Entry<T> >::iterator it = cache->begin();
+  for (; it != cache->end(); ++it)
+    delete it->second.object;
+  cache->clear();
+}
+
+void VisModelCache::Clear() {
+  ClearMap(&models_);
+  ClearMap(&trees_);
+  ClearMap(&symtabs_);
+  ClearMap(&fsts_);
+  ClearMap(&fst_readers_);
+  ClearMap(&ali_readers_);
+  ClearMap(&graph_archives_);
+}
+
+TransitionModel *VisModelCache::LoadTransitionModel(
+    const std::string &rxfilename) {
+  TransitionModel *trans_model = new TransitionModel();
+  try {
+    bool binary;
+    Input ki(rxfilename, &binary);
+    trans_model->Read(ki.Stream(), binary);
+  } catch (...) {
+    delete trans_model;
+    throw;
+  }
+  return trans_model;
+}
+
+ContextDependency *VisModelCache::LoadContextDependency(
+    const std::string &rxfilename) {
+  ContextDependency *ctx_dep = new ContextDependency();
+  try {
+    bool binary;
+    Input ki(rxfilename, &binary);
+    ctx_dep->Read(ki.Stream(), binary);
+  } catch (...) {
+    delete ctx_dep;
+    throw;
+  }
+  return ctx_dep;
+}
+
+fst::SymbolTable *VisModelCache::LoadSymbolTable(const std::string &filename) {
+  std::ifstream is(filename.c_str());
+  fst::SymbolTable *symtab = fst::SymbolTable::ReadText(is, filename);
+  if (!symtab)
+    KALDI_ERR << "Could not read symbol table file " << filename;
+  return symtab;
+}
+
+fst::VectorFst<fst::StdArc> *VisModelCache::LoadFst(
+    const std::string &filename) {
+  fst::VectorFst<fst::StdArc> *fst = fst::VectorFst<fst::StdArc>::Read(filename);
+  if (fst == NULL)
+    KALDI_ERR << "Could not read FST from " << filename;
+  return fst;
+}
+
+VisModelCache::FstReader *VisModelCache::OpenFstReader(
+    const std::string &rspecifier) {
+  FstReader *reader = new FstReader();
+  if (!reader->Open(rspecifier)) {
+    delete reader;
+    KALDI_ERR << "Could not open FST archive " << rspecifier;
+  }
+  return reader;
+}
+
+RandomAccessInt32VectorReader *VisModelCache::OpenAlignmentReader(
+    const std::string &rspecifier) {
+  RandomAccessInt32VectorReader *reader = new RandomAccessInt32VectorReader();
+  if (!reader->Open(rspecifier)) {
+    delete reader;
+    KALDI_ERR << "Could not open alignment archive " << rspecifier;
+  }
+  return reader;
+}
+
+GraphArchiveReader *VisModelCache::OpenGraphArchive(
+    const std::string &filename) {
+  GraphArchiveReader *archive = new GraphArchiveReader();
+  try {
+    archive->Open(filename);
+  } catch (...) {
+    delete archive;
+    throw;
+  }
+  return archive;
+}
+
+const TransitionModel &VisModelCache::GetTransitionModel(
+    const std::string &rxfilename) {
+  return *Lookup(rxfilename, rxfilename, &LoadTransitionModel, &models_);
+}
+
+const ContextDependency &VisModelCache::GetContextDependency(
+    const std::string &rxfilename) {
+  return *Lookup(rxfilename, rxfilename, &LoadContextDependency, &trees_);
+}
+
+const fst::SymbolTable &VisModelCache::GetSymbolTable(
+    const std::string &filename) {
+  return *Lookup(filename, filename, &LoadSymbolTable, &symtabs_);
+}
+
+const fst::VectorFst<fst::StdArc> &VisModelCache::GetFst(
+    const std::string &filename) {
+  return *Lookup(filename, filename, &LoadFst, &fsts_);
+}
+
+VisModelCache::FstReader &VisModelCache::GetFstReader(
+    const std::string &rspecifier) {
+  return *Lookup(rspecifier, RspecifierFile(rspecifier),
+                 &OpenFstReader, &fst_readers_);
+}
+
+RandomAccessInt32VectorReader &VisModelCache::GetAlignmentReader(
+    const std::string &rspecifier) {
+  return *Lookup(rspecifier, RspecifierFile(rspecifier),
+                 &OpenAlignmentReader, &ali_readers_);
+}
+
+const GraphArchiveReader &VisModelCache::GetGraphArchive(
+    const std::string &filename) {
+  return *Lookup(filename, filename, &OpenGraphArchive, &graph_archives_);
+}
+
+void VisModelCache::GetContextPhones(const std::string &model_rxfilename,
+                                     const fst::SymbolTable &phone_syms,
+                                     int32 num_pdf_classes,
+                                     std::vector<int32> *phones,
+                                     std::vector<int32> *phone_pdf_classes) {
+  phones->clear();
+  phone_pdf_classes->clear();
+  if (!model_rxfilename.empty()) {
+    const TransitionModel &trans_model = GetTransitionModel(model_rxfilename);
+    *phones = trans_model.GetPhones();
+    for (size_t i = 0; i < phones->size(); i++)
+      phone_pdf_classes->push_back(
+          trans_model.GetTopo().NumPdfClasses((*phones)[i]));
+    return;
+  }
+  for (fst::SymbolTableIterator it(phone_syms); !it.Done(); it.Next()) {
+    if (it.Value() == 0 || it.Symbol()[0] == '#')
+      continue;
+    phones->push_back(static_cast<int32>(it.Value()));
+    phone_pdf_classes->push_back(num_pdf_classes);
+  }
+}
+
+}  // end namespace kaldi
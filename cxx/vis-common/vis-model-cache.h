@@ -0,0 +1,152 @@
+// decoder/vis-model-cache.h
+
+// Copyright 2012  Vassil Panayotov <vd.panayotov@gmail.com>
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef KALDI_DECODER_VIS_MODEL_CACHE_H_
+#define KALDI_DECODER_VIS_MODEL_CACHE_H_
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "base/kaldi-common.h"
+#include "util/common-utils.h"
+#include "hmm/transition-model.h"
+#include "tree/context-dep.h"
+#include "fst/fstlib.h"
+#include "fstext/fstext-lib.h"
+#include "decoder/mapped-graph-archive.h"
+
+namespace kaldi {
+
+/// Identifies a particular version of a file
+struct VisFileStamp {
+  int64 mtime;
+  int64 size;
+
+  VisFileStamp(): mtime(-1), size(-1) {}
+
+  bool operator == (const VisFileStamp &other) const {
+    return mtime == other.mtime && size == other.size;
+  }
+
+  /// Returns the stamp of a regular file, or the default (-1, -1) stamp
+  /// for anything else(pipes, standard input, missing files)
+  static VisFileStamp Get(const std::string &rxfilename);
+};
+
+/// Loads the transition models, trees and phone/word symbol tables used by the
+/// visualization tools and keeps them in memory, so that a long-running
+/// process doesn't have to parse the same file twice.
+/// The objects are keyed by their (r)xfilename. If the name refers to a regular
+/// file, the object is reloaded when the file's modification time or size
+/// changes. Objects coming from pipes or the standard input are read only once.
+/// Table readers for graph and alignment archives, and mapped graph archives
+/// (see GraphArchiveReader), can be kept open too, so that a server doesn't
+/// re-read or re-check an archive for every request; they are reopened when
+/// the archive(or script) file changes.
+/// Note that a reload invalidates the references returned for the old object,
+/// so the callers should not hold them across requests.
+class VisModelCache {
+ public:
+  VisModelCache() {}
+
+  ~VisModelCache() { Clear(); }
+
+  const TransitionModel &GetTransitionModel(const std::string &rxfilename);
+
+  const ContextDependency &GetContextDependency(const std::string &rxfilename);
+
+  /// Reads a symbol table in OpenFst's text format
+  const fst::SymbolTable &GetSymbolTable(const std::string &filename);
+
+  /// Reads a single FST in OpenFst's binary format(e.g. HCLG.fst)
+  const fst::VectorFst<fst::StdArc> &GetFst(const std::string &filename);
+
+  typedef RandomAccessTableReader<fst::VectorFstHolder> FstReader;
+
+  /// Returns an open random access reader for an FST archive
+  FstReader &GetFstReader(const std::string &rspecifier);
+
+  /// Returns an open random access reader for an alignment archive
+  RandomAccessInt32VectorReader &GetAlignmentReader(
+      const std::string &rspecifier);
+
+  /// Returns a mapped graph archive(compile-train-graphs-vis --archive-out),
+  /// opened and checked only the first time and when the file changes
+  const GraphArchiveReader &GetGraphArchive(const std::string &filename);
+
+  /// Gets the central phones whose contexts the tree tools(tree-diff,
+  /// tree-context-index) enumerate, and the number of pdf classes(HMM states)
+  /// of each: the phones of the model "model_rxfilename" or, if it is empty,
+  /// all the symbols of "phone_syms" except epsilon and the disambiguation
+  /// symbols("#..."), with "num_pdf_classes" each.
+  void GetContextPhones(const std::string &model_rxfilename,
+                        const fst::SymbolTable &phone_syms,
+                        int32 num_pdf_classes, std::vector<int32> *phones,
+                        std::vector<int32> *phone_pdf_classes);
+
+  /// Drops all cached objects
+  void Clear();
+
+  /// The process-wide cache instance
+  static VisModelCache &Default();
+
+ private:
+  template<class T> struct Entry {
+    VisFileStamp stamp;
+    T *object;
+  };
+
+  /// Returns the cached object for "name" or loads it. "stamp_name" is the file,
+  /// whose changes make the cached object invalid.
+  template<class T>
+  static T *Lookup(const std::string &name,
+                   const std::string &stamp_name,
+                   T *(*load)(const std::string &name),
+                   std::map<std::string, Entry<T> > *cache);
+
+  /// The archive or script file of an rspecifier, whose stamp is checked
+  /// (for pipes and the standard input the stamp is the default one, so the
+  /// readers of these are never reopened)
+  static std::string RspecifierFile(const std::string &rspecifier);
+
+  template<class T>
+  static void ClearMap(std::map<std::string, Entry<T> > *cache);
+
+  static TransitionModel *LoadTransitionModel(const std::string &rxfilename);
+  static ContextDependency *LoadContextDependency(const std::string &rxfilename);
+  static fst::SymbolTable *LoadSymbolTable(const std::string &filename);
+  static fst::VectorFst<fst::StdArc> *LoadFst(const std::string &filename);
+  static FstReader *OpenFstReader(const std::string &rspecifier);
+  static RandomAccessInt32VectorReader *OpenAlignmentReader(
+      const std::string &rspecifier);
+  static GraphArchiveReader *OpenGraphArchive(const std::string &filename);
+
+  std::map<std::string, Entry<TransitionModel> > models_;
+  std::map<std::string, Entry<ContextDependency> > trees_;
+  std::map<std::string, Entry<fst::SymbolTable> > symtabs_;
+  std::map<std::string, Entry<fst::VectorFst<fst::StdArc> > > fsts_;
+  std::map<std::string, Entry<FstReader> > fst_readers_;
+  std::map<std::string, Entry<RandomAccessInt32VectorReader> > ali_readers_;
+  std::map<std::string, Entry<GraphArchiveReader> > graph_archives_;
+
+  KALDI_DISALLOW_COPY_AND_ASSIGN(VisModelCache);
+};
+
+}  // end namespace kaldi
+
+#endif  // KALDI_DECODER_VIS_MODEL_CACHE_H_
@@ -0,0 +1,445 @@
+// decoder/vis-server.cc
+
+// Copyright 2012  Vassil Panayotov <vd.panayotov@gmail.com>
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <ctype.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <sstream>
+
+#include "base/timer.h"
+#include "decoder/vis-server.h"
+
+namespace kaldi {
+
+void SplitRequestArgs(const std::string &request,
+                      std::vector<std::string> *args) {
+  args->clear();
+  std::string cur;
+  bool in_arg = false;
+  char quote = 0;
+  for (size_t i = 0; i < request.size(); i++) {
+    char c = request[i];
+    if (quote != 0) {
+      if (c == quote)
+        quote = 0;
+      else
+        cur += c;
+    } else if (c == '\'' || c == '"') {
+      quote = c;
+      in_arg = true;
+    } else if (isspace(c)) {
+      if (in_arg)
+        args->push_back(cur);
+      cur.clear();
+      in_arg = false;
+    } else {
+      cur += c;
+      in_arg = true;
+    }
+  }
+  if (quote != 0)
+    KALDI_WARN << "Unterminated quote in request: " << request;
+  if (in_arg)
+    args->push_back(cur);
+}
+
+namespace {
+
+/// Checks the arguments of a request before they are given to the tool.
+/// A request must not run commands(pipe rspecifiers and wspecifiers, e.g.
+/// "ark:gunzip -c x.gz |") and must not make ParseOptions read a config
+/// file or print the usage and exit, which would stop the server.
+bool CheckRequestArgs(const std::vector<std::string> &args,
+                      std::string *reason) {
+  for (size_t i = 0; i < args.size(); i++) {
+    const std::string &arg = args[i];
+    if (arg == "--help" || arg.compare(0, 7, "--help=") == 0 ||
+        arg == "--config" || arg.compare(0, 9, "--config=") == 0) {
+      *reason = "option " + arg.substr(0, arg.find('=')) + " is not allowed";
+      return false;
+    }
+    std::string name = arg;
+    if (name.compare(0, 2, "--") == 0) { // an option's value may be a file
+      size_t eq = name.find('=');
+      if (eq == std::string::npos)
+        continue;
+      name = name.substr(eq + 1);
+    }
+    for (int32 pass = 0; pass < 2; pass++) {
+      // the whole name, then without the "ark:", "scp,p:" etc. prefix
+      size_t begin = name.find_first_not_of(" \t"),
+          end = name.find_last_not_of(" \t");
+      if (begin != std::string::npos &&
+          (name[begin] == '|' || name[end] == '|')) {
+        *reason = "pipes are not allowed(" + arg + ")";
+        return false;
+      }
+      size_t colon = name.find(':');
+      if (colon == std::string::npos)
+        break;
+      name = name.substr(colon + 1);
+    }
+  }
+  return true;
+}
+
+/// Returns true if "arg" names the standard input or output: "-", or "-"
+/// after a "--option=" and/or an "ark:", "scp,p:" etc. prefix
+bool NamesStdio(const std::string &arg) {
+  std::string name = arg;
+  if (name.compare(0, 2, "--") == 0) {
+    size_t eq = name.find('=');
+    if (eq == std::string::npos)
+      return false;
+    name = name.substr(eq + 1);
+  }
+  size_t colon = name.find(':');
+  if (colon != std::string::npos)
+    name = name.substr(colon + 1);
+  size_t begin = name.find_first_not_of(" \t"),
+      end = name.find_last_not_of(" \t");
+  return begin != std::string::npos && begin == end && name[begin] == '-';
+}
+
+}  // end unnamed namespace
+
+bool VisToolRequestHandler::HandleRequest(const std::string &request,
+                                          std::ostream &os) {
+  std::vector<std::string> args;
+  SplitRequestArgs(request, &args);
+  failed_ = false;
+  if (args.size() == 1 && args[0] == "quit")
+    return false;
+  std::string reason;
+  if (!CheckRequestArgs(args, &reason)) {
+    KALDI_WARN << "Request \"" << request << "\" rejected: " << reason;
+    failed_ = true;
+    return true;
+  }
+
+  args.insert(args.begin(), tool_name_);
+  std::vector<const char*> argv(args.size() + 1, NULL);
+  for (size_t i = 0; i < args.size(); i++)
+    argv[i] = args[i].c_str();
+
+  try {
+    int ret = tool_main_(static_cast<int>(args.size()), &argv[0], os);
+    if (ret != 0) {
+      KALDI_WARN << "Request \"" << request << "\" failed with status " << ret;
+      failed_ = true;
+    }
+  } catch (const std::exception &e) {
+    KALDI_WARN << "Request \"" << request << "\" failed: " << e.what();
+    failed_ = true;
+  }
+  return true;
+}
+
+void CachingRequestHandler::GetRequestStamps(
+    const std::vector<std::string> &args, FileStamps *stamps) {
+  for (size_t i = 0; i < args.size(); i++) {
+    std::string name = args[i];
+    if (name.compare(0, 2, "--") == 0) { // an option's value may be a file
+      size_t eq = name.find('=');
+      if (eq == std::string::npos)
+        continue;
+      name = name.substr(eq + 1);
+    }
+    size_t colon = name.find(':'); // strip "ark:", "scp,p:" etc.
+    if (colon != std::string::npos)
+      name = name.substr(colon + 1);
+    VisFileStamp stamp = VisFileStamp::Get(name);
+    if (stamp.mtime != -1)
+      stamps->push_back(std::make_pair(name, stamp));
+  }
+}
+
+bool CachingRequestHandler::Filter(const std::string &input,
+                                   std::string *output) {
+  char tmpname[] = "/tmp/vis-server.XXXXXX";
+  int fd = mkstemp(tmpname);
+  if (fd < 0)
+    KALDI_ERR << "Could not create a temporary file: " << strerror(errno);
+  FILE *tmp = fdopen(fd, "w");
+  fwrite(input.data(), 1, input.size(), tmp);
+  fclose(tmp);
+
+  std::string cmd = filter_ + " < " + tmpname;
+  FILE *pipe = popen(cmd.c_str(), "r");
+  if (pipe == NULL) {
+    unlink(tmpname);
+    KALDI_ERR << "Could not run filter command: " << filter_;
+  }
+  output->clear();
+  char buf[4096];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), pipe)) > 0)
+    output->append(buf, n);
+  int status = pclose(pipe);
+  unlink(tmpname);
+  if (status != 0) {
+    KALDI_WARN << "Filter command \"" << filter_ << "\" returned " << status;
+    return false;
+  }
+  return true;
+}
+
+bool CachingRequestHandler::HandleRequest(const std::string &request,
+                                          std::ostream &os) {
+  std::vector<std::string> args;
+  SplitRequestArgs(request, &args);
+  failed_ = false;
+  std::string key; // normalized request, which doesn't depend on the spacing
+  for (size_t i = 0; i < args.size(); i++)
+    key += args[i] + '\n';
+
+  std::map<std::string, CacheEntry>::iterator it = cache_.find(key);
+  if (it != cache_.end()) {
+    FileStamps stamps;
+    GetRequestStamps(args, &stamps);
+    if (stamps == it->second.stamps) {
+      lru_.splice(lru_.begin(), lru_, it->second.lru_pos);
+      os << it->second.response;
+      KALDI_VLOG(1) << "Cache hit: " << request;
+      return true;
+    }
+    lru_.erase(it->second.lru_pos);
+    cache_.erase(it);
+  }
+
+  std::ostringstream response;
+  bool running = handler_->HandleRequest(request, response);
+  if (!running)
+    return false;
+  std::string out = response.str();
+  // a failed request may have written a part of its response
+  failed_ = handler_->LastRequestFailed();
+  if (!filter_.empty() && !out.empty()) {
+    std::string filtered;
+    if (!Filter(out, &filtered))
+      failed_ = true;
+    out = filtered;
+  }
+  os << out;
+
+  if (capacity_ <= 0 || failed_ || out.empty())
+    return true;
+  CacheEntry &entry = cache_[key];
+  entry.response = out;
+  GetRequestStamps(args, &entry.stamps);
+  lru_.push_front(key);
+  entry.lru_pos = lru_.begin();
+  while (static_cast<int32>(lru_.size()) > capacity_) {
+    cache_.erase(lru_.back());
+    lru_.pop_back();
+  }
+  return true;
+}
+
+namespace {
+
+/// Reads a single request line (the terminating newline is not included)
+bool ReadRequest(int fd, std::string *request) {
+  request->clear();
+  char c;
+  ssize_t n;
+  while ((n = read(fd, &c, 1)) == 1) {
+    if (c == '\n')
+      return true;
+    *request += c;
+  }
+  return (n == 0 && !request->empty());
+}
+
+void WriteResponse(int fd, const std::string &response) {
+  const char *p = response.data();
+  size_t left = response.size();
+  while (left > 0) {
+    ssize_t n = write(fd, p, left);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      KALDI_WARN << "Error writing response: " << strerror(errno);
+      return;
+    }
+    p += n;
+    left -= n;
+  }
+}
+
+}  // end unnamed namespace
+
+void ServeUnixSocket(const std::string &socket_path,
+                     VisRequestHandler *handler) {
+  struct sockaddr_un addr;
+  if (socket_path.size() >= sizeof(addr.sun_path))
+    KALDI_ERR << "Socket path too long: " << socket_path;
+
+  int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (listen_fd < 0)
+    KALDI_ERR << "Could not create socket: " << strerror(errno);
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, socket_path.c_str(), sizeof(addr.sun_path) - 1);
+  // remove a stale socket left by a dead server, but nothing else
+  struct stat st;
+  if (lstat(socket_path.c_str(), &st) == 0) {
+    if (!S_ISSOCK(st.st_mode)) {
+      close(listen_fd);
+      KALDI_ERR << socket_path << " exists and is not a socket";
+    }
+    if (unlink(socket_path.c_str()) != 0) {
+      close(listen_fd);
+      KALDI_ERR << "Could not remove the stale socket " << socket_path << ": "
+                << strerror(errno);
+    }
+  } else if (errno != ENOENT) {
+    close(listen_fd);
+    KALDI_ERR << "Could not stat " << socket_path << ": " << strerror(errno);
+  }
+  // only the user running the server may connect to it
+  mode_t old_umask = umask(0077);
+  int bind_ret = bind(listen_fd, reinterpret_cast<struct sockaddr*>(&addr),
+                      sizeof(addr));
+  umask(old_umask);  // can't fail and leaves errno alone
+  if (bind_ret < 0 || chmod(socket_path.c_str(), 0600) < 0 ||
+      listen(listen_fd, 16) < 0) {
+    int saved_errno = errno;
+    close(listen_fd);
+    KALDI_ERR << "Could not listen on " << socket_path << ": "
+              << strerror(saved_errno);
+  }
+  KALDI_LOG << "Serving requests on " << socket_path;
+
+  bool running = true;
+  while (running) {
+    int fd = accept(listen_fd, NULL, NULL);
+    if (fd < 0) {
+      if (errno == EINTR)
+        continue;
+      KALDI_WARN << "accept() failed: " << strerror(errno);
+      break;
+    }
+    std::string request;
+    if (ReadRequest(fd, &request)) {
+      KALDI_VLOG(1) << "Request: " << request;
+      std::ostringstream response;
+      running = handler->HandleRequest(request, response);
+      WriteResponse(fd, response.str());
+    }
+    close(fd);
+  }
+
+  close(listen_fd);
+  unlink(socket_path.c_str());
+  KALDI_LOG << "Server on " << socket_path << " stopped";
+}
+
+void ServeStream(std::istream &is, std::ostream &os,
+                 VisRequestHandler *handler) {
+  std::string request;
+  while (std::getline(is, request)) {
+    if (request.empty())
+      continue;
+    KALDI_VLOG(1) << "Request: " << request;
+    std::ostringstream response;
+    bool running = handler->HandleRequest(request, response);
+    const std::string &out = response.str();
+    os << out.size() << '\n' << out;
+    os.flush();
+    if (!running)
+      break;
+  }
+}
+
+namespace {
+
+/// Logs the time spent on each request
+class TimedRequestHandler: public VisRequestHandler {
+ public:
+  explicit TimedRequestHandler(VisRequestHandler *handler): handler_(handler) {}
+
+  virtual bool HandleRequest(const std::string &request, std::ostream &os) {
+    Timer timer;
+    bool ans = handler_->HandleRequest(request, os);
+    KALDI_VLOG(1) << "Request took " << (timer.Elapsed() * 1000) << " ms";
+    return ans;
+  }
+
+  virtual bool LastRequestFailed() const {
+    return handler_->LastRequestFailed();
+  }
+
+ private:
+  VisRequestHandler *handler_;
+};
+
+/// Rejects the requests that name the standard input or output, when these
+/// carry the requests and the responses(--serve=-)
+class StdioRequestHandler: public VisRequestHandler {
+ public:
+  explicit StdioRequestHandler(VisRequestHandler *handler):
+      handler_(handler), failed_(false) {}
+
+  virtual bool HandleRequest(const std::string &request, std::ostream &os) {
+    std::vector<std::string> args;
+    SplitRequestArgs(request, &args);
+    for (size_t i = 0; i < args.size(); i++) {
+      if (NamesStdio(args[i])) {
+        KALDI_WARN << "Request \"" << request << "\" rejected: the standard "
+                   << "input and output are used by the server(" << args[i]
+                   << ")";
+        failed_ = true;
+        return true;
+      }
+    }
+    bool ans = handler_->HandleRequest(request, os);
+    failed_ = handler_->LastRequestFailed();
+    return ans;
+  }
+
+  virtual bool LastRequestFailed() const { return failed_; }
+
+ private:
+  VisRequestHandler *handler_;
+  bool failed_;
+};
+
+}  // end unnamed namespace
+
+void RunVisServer(const VisServerOptions &opts, VisRequestHandler *handler) {
+  CachingRequestHandler caching(handler, opts.cache_size, opts.filter);
+  if (opts.serve == "-") {
+    StdioRequestHandler stdio(&caching);
+    TimedRequestHandler timed(&stdio);
+    ServeStream(std::cin, std::cout, &timed);
+  } else {
+    TimedRequestHandler timed(&caching);
+    ServeUnixSocket(opts.serve, &timed);
+  }
+}
+
+}  // end namespace kaldi
@@ -0,0 +1,159 @@
+// decoder/vis-server.h
+
+// Copyright 2012  Vassil Panayotov <vd.panayotov@gmail.com>
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef KALDI_DECODER_VIS_SERVER_H_
+#define KALDI_DECODER_VIS_SERVER_H_
+
+#include <list>
+#include <map>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "base/kaldi-common.h"
+#include "util/parse-options.h"
+#include "decoder/vis-model-cache.h"
+
+namespace kaldi {
+
+struct VisServerOptions {
+  std::string serve;   // socket path, or "-" to read requests from stdin
+  int32 cache_size;    // the number of responses kept in the LRU cache
+  std::string filter;  // shell command the responses are piped through
+
+  VisServerOptions(): cache_size(64) {}
+
+  bool Enabled() const { return !serve.empty(); }
+
+  void Register(ParseOptions *po) {
+    po->Register("serve", &serve, "Keep running and answer requests on this "
+                 "local socket, or on stdin/stdout if \"-\"");
+    po->Register("cache-size", &cache_size, "Number of recently rendered "
+                 "responses kept in memory by the server");
+    po->Register("filter", &filter, "Shell command the server pipes each "
+                 "response through before caching it, e.g. \"dot -Tsvg\"");
+  }
+};
+
+/// Interface for the objects that answer the requests received by a
+/// visualization server
+class VisRequestHandler {
+ public:
+  /// Writes the response to "request" into "os".
+  /// Returns false if the server should shut down.
+  virtual bool HandleRequest(const std::string &request, std::ostream &os) = 0;
+
+  /// Returns true if the last request failed, so that its response may be
+  /// incomplete(and must not be cached)
+  virtual bool LastRequestFailed() const { return false; }
+
+  virtual ~VisRequestHandler() {}
+};
+
+/// The signature of a tool's main function, which writes its output to "os"
+/// instead of to the standard output
+typedef int (*VisToolMain)(int argc, const char *const *argv, std::ostream &os);
+
+/// Treats each request as a command line for a visualization tool.
+/// The request is split into arguments and passed to "tool_main", so the
+/// options and arguments have the same meaning as on the command line.
+/// The request "quit" stops the server.
+class VisToolRequestHandler: public VisRequestHandler {
+ public:
+  VisToolRequestHandler(const std::string &tool_name, VisToolMain tool_main):
+      tool_name_(tool_name), tool_main_(tool_main), failed_(false) {}
+
+  virtual bool HandleRequest(const std::string &request, std::ostream &os);
+
+  /// True if the last request was rejected, or the tool returned a non-zero
+  /// status or threw
+  virtual bool LastRequestFailed() const { return failed_; }
+
+ private:
+  std::string tool_name_;
+  VisToolMain tool_main_;
+  bool failed_;
+};
+
+/// Keeps the responses to the most recent requests of another handler.
+/// An entry is dropped when any of the files named in its request changes,
+/// and the least recently used entry is evicted when the cache is full. The
+/// responses of failed requests(or of a failed filter) are not kept.
+/// Optionally pipes each response through a shell command(e.g. "dot -Tsvg"),
+/// so the costly layout is also done only once per request.
+class CachingRequestHandler: public VisRequestHandler {
+ public:
+  CachingRequestHandler(VisRequestHandler *handler, int32 capacity,
+                        const std::string &filter = ""):
+      handler_(handler), capacity_(capacity), filter_(filter),
+      failed_(false) {}
+
+  virtual bool HandleRequest(const std::string &request, std::ostream &os);
+
+  virtual bool LastRequestFailed() const { return failed_; }
+
+ private:
+  typedef std::vector<std::pair<std::string, VisFileStamp> > FileStamps;
+
+  struct CacheEntry {
+    std::string response;
+    FileStamps stamps;
+    std::list<std::string>::iterator lru_pos;
+  };
+
+  /// Collects the stamps of the regular files named in the request arguments
+  static void GetRequestStamps(const std::vector<std::string> &args,
+                               FileStamps *stamps);
+
+  /// Runs "filter_" with "input" on its standard input. Returns false if
+  /// the command failed.
+  bool Filter(const std::string &input, std::string *output);
+
+  VisRequestHandler *handler_;
+  int32 capacity_;
+  std::string filter_;
+  bool failed_;
+  std::list<std::string> lru_; // most recently used requests at the front
+  std::map<std::string, CacheEntry> cache_;
+};
+
+/// Splits a request line into whitespace-separated arguments.
+/// Single or double quotes can be used to group arguments containing spaces.
+void SplitRequestArgs(const std::string &request,
+                      std::vector<std::string> *args);
+
+/// Listens on a local(AF_UNIX) stream socket at "socket_path" and serves the
+/// requests one at a time. Each connection carries a single request line; the
+/// response is written back and the connection is closed.
+/// Returns when the handler asks the server to stop.
+void ServeUnixSocket(const std::string &socket_path,
+                     VisRequestHandler *handler);
+
+/// Reads request lines from "is" and answers them on "os" until end of input.
+/// Each response is preceded by a line holding its length in bytes, so a
+/// client can tell where it ends. RunVisServer() rejects the requests that
+/// name the standard input or output("-", "ark:-", ...), which carry the
+/// requests and the responses.
+void ServeStream(std::istream &is, std::ostream &os,
+                 VisRequestHandler *handler);
+
+/// Serves the requests as configured by "opts", caching the responses
+void RunVisServer(const VisServerOptions &opts, VisRequestHandler *handler);
+
+}  // end namespace kaldi
+
+#endif  // KALDI_DECODER_VIS_SERVER_H_
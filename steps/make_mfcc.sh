@@ -29,6 +29,8 @@ scpin=data_prep/$2.scp
 out=$1
 mkdir -p $out
 
+# Raw features(no --add-deltas/--apply-cmvn): the training and decoding
+# scripts add the deltas and apply CMVN themselves.
 pack-sphinx-feats scp:$scpin ark,scp:$out/$2.ark,$out/$2.scp
 cp $out/$2.scp data/$2.scp
 
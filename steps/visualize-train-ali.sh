@@ -22,6 +22,7 @@ stage=$2
 dir=exp/$2
 niters=30 # should match the #of iteration in the training script
 show_tids=false # make it true if you want to also see the trans-ids on input labels
+use_dot=true # make it false to get SVG laid out by draw-ali(much faster for big graphs)
 draw_iters=$3 # should correspond to a subset of the realignment passes
 
 mkdir -p $picdir
@@ -29,18 +30,34 @@ mkdir -p $picdir
 # The of the chosen training utterance
 utt=trn_adg04_st1350
 
-# Visualize the alignment at some passes
+# Visualize the alignments at some passes, overlaid on a single graph
 # (add --show-tids=true if you want transition id to be shown too)
+alis=
+labels=
+last=
 x=0
 while [ $x -lt $niters ]; do
     if echo $draw_iters | egrep -w $x > /dev/null; then
-	draw-ali --key=$utt --show-tids=$show_tids data/phones_disambig.txt\
-           data/words.txt $dir/$x.mdl ark:$dir/$x.ali \
-           "ark:gunzip -c $dir/graphs.fsts.gz |" | \
-           dot -Tpdf > $picdir/${utt}_ali_${x}.pdf
+        alis="$alis ark:$dir/$x.ali"
+        labels="$labels${labels:+,}$x"
+        last=$x
     fi
     x=$[$x + 1]
 done
 
+if [ -n "$last" ]; then
+    # the frames that changed state between the passes go to the .json file
+    draw_ali="draw-ali --key=$utt --show-tids=$show_tids --ali-labels=$labels \
+        --summary-out=$picdir/${utt}_ali_changes.json"
+    draw_args="data/phones_disambig.txt data/words.txt $dir/$last.mdl $alis"
+    if $use_dot; then
+        $draw_ali $draw_args "ark:gunzip -c $dir/graphs.fsts.gz |" | \
+            dot -Tpdf > $picdir/${utt}_ali_${labels//,/_}.pdf
+    else
+        $draw_ali --format=svg $draw_args "ark:gunzip -c $dir/graphs.fsts.gz |" \
+            > $picdir/${utt}_ali_${labels//,/_}.svg
+    fi
+fi
+
 
 echo "--- Done training alignment visualization ($stage) !"
\ No newline at end of file
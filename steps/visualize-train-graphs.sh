@@ -31,7 +31,16 @@ utt_id="trn_adg04_st1350"
 utt_transcript="314 425 17"
 
 # The transcription for "trn_adg04_st1350" is "FIND INDEPENDENCE+S ALERTS"
-echo "$utt_id $utt_transcript" > $scriptdir/in.ark
+# If the training transcripts are there, the utterance is looked up in them
+# (through an index kept next to them), otherwise the transcript above is used
+transcripts="ark:$scriptdir/in.ark"
+keys_opts=
+if [ -f data/train.tra ]; then
+    transcripts="ark:data/train.tra"
+    keys_opts="--keys=$utt_id --transcript-index=data/train.tra.idx"
+else
+    echo "$utt_id $utt_transcript" > $scriptdir/in.ark
+fi
 
 # Final graph
 echo "$utt_id $scriptdir/train.fst" > $scriptdir/out.scp
@@ -52,14 +61,17 @@ model="final.mdl"
 #fi
 
 # Compile the train graphs and output the intermediate WFSTs
-compile-train-graphs-vis --batch-size=1 exp/$stage/tree exp/$stage/$model  data/L.fst ark:$scriptdir/in.ark scp:$scriptdir/out.scp  scp:$scriptdir/lg_out.scp scp:$scriptdir/clg_out.scp scp:$scriptdir/hclg_noopt_out.scp
+compile-train-graphs-vis --batch-size=1 $keys_opts exp/$stage/tree exp/$stage/$model  data/L.fst $transcripts scp:$scriptdir/out.scp  scp:$scriptdir/lg_out.scp scp:$scriptdir/clg_out.scp scp:$scriptdir/hclg_noopt_out.scp
 
 # Prepare the symbol tables
 phnsymtab="data/phones_disambig.txt"
 
-fstmakecontextsyms $phnsymtab exp/graph_$stage/ilabels > $scriptdir/context_syms.txt
-
-fstmaketidsyms $phnsymtab exp/$stage/$model > $scriptdir/transid_syms.txt
+# The transition-id and the context-dependent phone symbols, with a single load
+# of the model and the phone table
+fstmaketidsyms --ilabels=exp/graph_$stage/ilabels \
+    --context-syms-out=$scriptdir/context_syms.txt \
+    --index-out=$scriptdir/transids.tidx \
+    $phnsymtab exp/$stage/$model $scriptdir/transid_syms.txt
 
 # Render the graphs
 